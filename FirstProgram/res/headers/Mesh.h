@@ -1,6 +1,7 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -8,117 +9,379 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "geometry_arena.h"
+#include "material.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
 #include "shader.h"
+#include "trace.h"
+#include "vertex_format.h"
 
 using namespace std;
 
-struct Vertex {
-
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-    glm::vec3 Tangent;
-    glm::vec3 Bitangent;
+// what a mesh keeps on the CPU once its buffers are uploaded
+enum MeshRetainPolicy
+{
+    MESH_RELEASE_CPU_DATA = 0,  // only the GPU buffers
+    MESH_RETAIN_CPU_DATA = 1,   // vertices and indices stay readable (picking, physics)
+    MESH_RETAIN_INDICES = 2     // only the indices stay, cluster culling copies the visible meshlets out of them
 };
 
-struct Texture {
+// resident bytes of a mesh (or of all meshes of a model)
+struct MeshMemory
+{
+    size_t cpu_bytes = 0, gpu_bytes = 0;
 
-    GLuint id;
-    string type;
-    string path;
+    MeshMemory & operator+=(const MeshMemory & other)
+    {
+        cpu_bytes += other.cpu_bytes;
+        gpu_bytes += other.gpu_bytes;
+        return *this;
+    }
 };
 
+// GPU buffers of one mesh, move-only: the buffers belong to exactly one Mesh and are deleted with it
+// a mesh created while the GeometryArena is enabled has no buffers of its own, it draws its part of the shared ones
 class Mesh {
 public:
 
-    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+    // object space bounding box and bounding sphere (around the box center) of the vertices
+    glm::vec3 aabb_min = glm::vec3(0.0f), aabb_max = glm::vec3(0.0f);
+    glm::vec3 sphere_center = glm::vec3(0.0f);
+    float sphere_radius = 0.0f;
+
+    // indices drawn at a level of detail (the index buffer holds every level, LOD 0 first)
+    GLsizei IndexCount(size_t lod = 0) const { return (GLsizei)lods[lod].index_count; }
+
+    // takes over the arrays, they are freed after the upload unless retain asks to keep them
+    // format selects the layout of the vertex buffer, the CPU copy always keeps the float vertices
+    Mesh(vector<Vertex> && vertices, vector<GLuint> && indices, shared_ptr<const Material> material, MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA,
+         VertexFormat format = VERTEX_FORMAT_FLOAT)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = move(vertices);
+        this->indices = move(indices);
+        this->material = material;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size(), format);
+        if (retain == MESH_RELEASE_CPU_DATA)
+            ReleaseCpuData();
+        else if (retain == MESH_RETAIN_INDICES)
+            vector<Vertex>().swap(this->vertices);
+    }
+
+    // uploads the arrays straight into the buffers (e.g. from a memory mapped mesh cache), they are only copied if retain asks for it
+    Mesh(const Vertex * vertices, size_t vertex_count, const GLuint * indices, size_t index_count, shared_ptr<const Material> material,
+         MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA, VertexFormat format = VERTEX_FORMAT_FLOAT)
+    {
+        this->material = material;
+
+        setupMesh(vertices, vertex_count, indices, index_count, format);
+        if (retain == MESH_RETAIN_CPU_DATA)
+            this->vertices.assign(vertices, vertices + vertex_count);
+        if (retain != MESH_RELEASE_CPU_DATA)
+            this->indices.assign(indices, indices + index_count);
+    }
+
+    ~Mesh()
+    {
+        deleteBuffers();
+    }
+
+    Mesh(const Mesh &) = delete;
+    Mesh & operator=(const Mesh &) = delete;
+
+    Mesh(Mesh && other) noexcept
+    {
+        *this = move(other);
+    }
+
+    Mesh & operator=(Mesh && other) noexcept
+    {
+        if (this == &other)
+            return *this;
+        deleteBuffers();
+        aabb_min = other.aabb_min;
+        aabb_max = other.aabb_max;
+        sphere_center = other.sphere_center;
+        sphere_radius = other.sphere_radius;
+        vertices = move(other.vertices);
+        indices = move(other.indices);
+        material = move(other.material);
+        VAO = other.VAO;
+        VBO = other.VBO;
+        EBO = other.EBO;
+        in_arena = other.in_arena;
+        base_vertex = other.base_vertex;
+        index_offset = other.index_offset;
+        vertex_count = other.vertex_count;
+        index_count = other.index_count;
+        format = other.format;
+        decode_slot = other.decode_slot;
+        quantization_error = other.quantization_error;
+        lods = move(other.lods);
+        meshlets = move(other.meshlets);
+        other.VAO = other.VBO = other.EBO = 0;
+        return *this;
+    }
+
+    // levels of detail as ranges of the index buffer, ordered by growing error, a mesh without them has LOD 0 only
+    void SetLods(const MeshLod * lods, size_t lod_count)
+    {
+        if (lod_count > 0)
+            this->lods.assign(lods, lods + min<size_t>(lod_count, MESH_MAX_LODS));
+    }
+
+    size_t LodCount() const { return lods.size(); }
+    const vector<MeshLod> & Lods() const { return lods; }
+
+    // meshlets of all levels (MeshLod::first_meshlet), they are kept on the CPU for cluster culling
+    void SetMeshlets(const Meshlet * meshlets, size_t meshlet_count) { this->meshlets.assign(meshlets, meshlets + meshlet_count); }
+    const vector<Meshlet> & Meshlets() const { return meshlets; }
+
+    // cluster culling needs the meshlets and the indices (MESH_RETAIN_INDICES or MESH_RETAIN_CPU_DATA)
+    bool HasClusters() const { return !meshlets.empty() && !indices.empty(); }
+
+    // the CPU copy, empty unless the mesh was created with MESH_RETAIN_CPU_DATA (Indices holds every level of detail,
+    // and is also kept by MESH_RETAIN_INDICES)
+    bool HasCpuData() const { return !vertices.empty(); }
+    const vector<Vertex> & Vertices() const { return vertices; }
+    const vector<GLuint> & Indices() const { return indices; }
+
+    void ReleaseCpuData()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<GLuint>().swap(indices);
+    }
+
+    // CPU bytes are the retained arrays, GPU bytes the vertex and index buffers
+    MeshMemory Memory() const
+    {
+        MeshMemory memory;
+        memory.cpu_bytes = vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(GLuint) + meshlets.capacity() * sizeof(Meshlet);
+        memory.gpu_bytes = vertex_count * VertexStride(format) + (size_t)index_count * sizeof(GLuint);
+        return memory;
+    }
+
+    VertexFormat Format() const { return format; }
+    size_t VertexCount() const { return vertex_count; }
+
+    // error of the uploaded vertices against the float ones (all zero for VERTEX_FORMAT_FLOAT)
+    const VertexQuantizationError & QuantizationError() const { return quantization_error; }
+
+    // the whole level lod in the own index buffer
+    IndexRange LodRange(unsigned int lod) const
+    {
+        IndexRange range = { 0, lods[lod].first_index, (GLsizei)lods[lod].index_count };
+        return range;
+    }
+
+    // vertex array and index buffer the draws use (the shared ones of the GeometryArena for meshes placed in it)
+    GLuint VertexArray() const { return VAO; }
+    GLuint IndexBuffer() const { return in_arena ? GeometryArena::Get().IndexBuffer(format) : EBO; }
+
+    // true if draws of both meshes need the same state (material, decode block and vertex array)
+    bool SharesDrawState(const Mesh & other) const { return material == other.material && decode_slot == other.decode_slot && VAO == other.VAO; }
+
+    // binds the material, the decode block and the vertex array of the mesh
+    void BindDrawState() const
+    {
+        material->Bind();
+        MeshDecodeBuffer::Get().Bind(decode_slot);
+        GLStateCache::Get().BindVertexArray(VAO);
     }
 
-    void Draw(Shader & shader)
+    // command of an indirect draw of range with the model matrices of the instance buffer from base_instance on, submitted
+    // later by a MultiDrawList with the state of BindDrawState; the draw is counted into the statistics here
+    DrawElementsIndirectCommand IndirectCommand(const IndexRange & range, unsigned int lod, GLuint instance_count, GLuint base_instance) const
     {
-        // bind appropriate textures
-        GLuint diffuseNr = 1;
-        GLuint specularNr = 1;
-        GLuint normalNr = 1;
-        GLuint heightNr = 1;
-        GLuint i = 0;
-        for (i = 0; i < textures.size(); i++)
+        VertexFetchStats::Get().AddDraw(vertex_count, range.index_count, VertexStride(format), instance_count);
+        TriangleStats::Get().AddDraw(range.index_count / 3, lods[0].index_count / 3, instance_count, lod);
+        DrawElementsIndirectCommand command = { (GLuint)range.index_count, instance_count,
+                                                range.buffer ? range.first_index : index_offset + range.first_index, base_vertex, base_instance };
+        return command;
+    }
+
+    // instance_count > 1 draws the mesh instanced (gl_InstanceID selects per-instance data in the shader)
+    void Draw(GLsizei instance_count = 1, unsigned int lod = 0)
+    {
+        TRACE_SCOPE("Mesh::Draw");
+        const MeshLod & range = lods[lod];
+        material->Bind();
+        MeshDecodeBuffer::Get().Bind(decode_slot);
+        VertexFetchStats::Get().AddDraw(vertex_count, range.index_count, VertexStride(format), instance_count);
+        TriangleStats::Get().AddDraw(range.index_count / 3, lods[0].index_count / 3, instance_count, lod);
+
+        // draw mesh (the vertex array stays bound, GLStateCache drops the bind of the next draw of this mesh)
+        GLStateCache::Get().BindVertexArray(VAO);
+        const void * first = (const void *)((index_offset + range.first_index) * sizeof(GLuint));
+        if (instance_count == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, first, base_vertex);
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, first, instance_count, base_vertex);
+    }
+
+    // draws a range of another index buffer (a compacted cluster stream, see ClusterStream) or, with range.buffer = 0,
+    // of the own one; lod is the level the indices come from, only for the statistics
+    void DrawRange(const IndexRange & range, unsigned int lod, GLsizei instance_count = 1)
+    {
+        TRACE_SCOPE("Mesh::DrawRange");
+        material->Bind();
+        MeshDecodeBuffer::Get().Bind(decode_slot);
+        VertexFetchStats::Get().AddDraw(vertex_count, range.index_count, VertexStride(format), instance_count);
+        TriangleStats::Get().AddDraw(range.index_count / 3, lods[0].index_count / 3, instance_count, lod);
+
+        // the element buffer binding is part of the vertex array, the own buffer is bound again afterwards
+        GLStateCache::Get().BindVertexArray(VAO);
+        if (range.buffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, range.buffer);
+        const void * first = (const void *)((range.buffer ? range.first_index : index_offset + range.first_index) * sizeof(GLuint));
+        if (instance_count == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, first, base_vertex);
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, first, instance_count, base_vertex);
+        if (range.buffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IndexBuffer());
+    }
+
+    // draws instance_count instances with the model matrices instance_buffer[first_instance ...] in the
+    // instance_model attribute (locations 5 - 8, one mat4 per instance), the program selects it with its instanced uniform
+    void DrawInstanced(GLuint instance_buffer, size_t first_instance, GLsizei instance_count, unsigned int lod = 0)
+    {
+        TRACE_SCOPE("Mesh::DrawInstanced");
+        const MeshLod & range = lods[lod];
+        material->Bind();
+        MeshDecodeBuffer::Get().Bind(decode_slot);
+        VertexFetchStats::Get().AddDraw(vertex_count, range.index_count, VertexStride(format), instance_count);
+        TriangleStats::Get().AddDraw(range.index_count / 3, lods[0].index_count / 3, instance_count, lod);
+
+        GLStateCache::Get().BindVertexArray(VAO);
+        PointInstanceAttributes(instance_buffer, first_instance);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT, (const void *)((index_offset + range.first_index) * sizeof(GLuint)),
+                                          instance_count, base_vertex);
+        // non-instanced draws of this mesh must not fetch from the buffer
+        DisableInstanceAttributes();
+    }
+
+    // points the instance_model attribute of the bound vertex array at instance_buffer[first_instance ...]
+    // (there is no base instance in GL 3.3, so the attribute is pointed at the first instance of a draw)
+    static void PointInstanceAttributes(GLuint instance_buffer, size_t first_instance)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+        for (GLuint column = 0; column < 4; column++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "diffuse_texture")
-                number = std::to_string(diffuseNr++);
-            else if (name == "specular_texture")
-                number = std::to_string(specularNr++); 
-            else if (name == "normal_texture")
-                number = std::to_string(normalNr++); 
-            else if (name == "height_texture")
-                number = std::to_string(heightNr++); 
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+            glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                (void*)(first_instance * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + column, 1);
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    static void DisableInstanceAttributes()
+    {
+        for (GLuint column = 0; column < 4; column++)
+            glDisableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
     }
 
 private:
 
     vector<Vertex>       vertices;
     vector<GLuint> indices;
-    vector<Texture>      textures;
+    shared_ptr<const Material> material;
+
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    // place in the GeometryArena (VBO and EBO stay 0), the indices are relative to base_vertex
+    bool in_arena = false;
+    GLint base_vertex = 0;
+    GLuint index_offset = 0;
+    size_t vertex_count = 0;
+    GLsizei index_count = 0;
+    VertexFormat format = VERTEX_FORMAT_FLOAT;
+    GLuint decode_slot = 0;     // MeshDecodeBuffer slot, 0 = float vertices
+    VertexQuantizationError quantization_error;
+    vector<MeshLod> lods;
+    vector<Meshlet> meshlets;
 
-    GLuint VAO, VBO, EBO;
+    static const GLuint INSTANCE_MODEL_LOCATION = 5;
+
+    void deleteBuffers()
+    {
+        if (VAO == 0)
+            return;
+        if (in_arena)
+        {
+            // the arena keeps the space until it is destroyed
+            VAO = 0;
+            return;
+        }
+        GLStateCache::Get().ForgetVertexArray(VAO);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VAO = VBO = EBO = 0;
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex * vertices, size_t vertex_count, const GLuint * indices, size_t index_count, VertexFormat format)
     {
+        this->vertex_count = vertex_count;
+        this->index_count = (GLsizei)index_count;
+        this->format = format;
+        MeshLod full = { 0, (GLuint)index_count, 0.0f, 0, 0 };
+        lods.assign(1, full);
+
+        if (vertex_count > 0)
+            aabb_min = aabb_max = vertices[0].Position;
+        for (size_t i = 1; i < vertex_count; i++)
+        {
+            aabb_min = glm::min(aabb_min, vertices[i].Position);
+            aabb_max = glm::max(aabb_max, vertices[i].Position);
+        }
+        sphere_center = (aabb_min + aabb_max) * 0.5f;
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < vertex_count; i++)
+        {
+            glm::vec3 offset = vertices[i].Position - sphere_center;
+            radius2 = glm::max(radius2, glm::dot(offset, offset));
+        }
+        sphere_radius = glm::sqrt(radius2);
+
+        // packed vertices are quantized against the bounds, their decode block goes into the MeshDecodeBuffer
+        vector<PackedVertex> packed;
+        const void * vertex_data = vertices;
+        if (format == VERTEX_FORMAT_PACKED)
+        {
+            MeshDecodeBlock block;
+            PackVertices(vertices, vertex_count, aabb_min, aabb_max, packed, block, quantization_error);
+            decode_slot = MeshDecodeBuffer::Get().Add(block);
+            vertex_data = packed.data();
+        }
+
+        if (GeometryArena::Get().Enabled())
+        {
+            ArenaAllocation allocation = GeometryArena::Get().Add(format, vertex_data, vertex_count, indices, index_count);
+            in_arena = true;
+            VAO = allocation.vertex_array;
+            base_vertex = allocation.base_vertex;
+            index_offset = allocation.first_index;
+            return;
+        }
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
+        GLStateCache::Get().BindVertexArray(VAO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLuint), indices, GL_STATIC_DRAW);
 
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // load data into vertex buffers
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * VertexStride(format), vertex_data, GL_STATIC_DRAW);
+        SetVertexAttributes(format);
 
-        glBindVertexArray(0);
+        GLStateCache::Get().BindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
@@ -5,10 +5,14 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include "stb_image.h"
 #include "assimp.h"
 
 #include "Mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "texture_cache.h"
+#include "trace.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -18,71 +22,295 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
 GLuint TextureFromFile(const char * path, const string & directory);
 
+// post-processing done by the importer, part of the mesh cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+// imported mesh before it is uploaded
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    vector<MeshLod> lods;       // levels of detail in indices, empty before BuildMeshLods
+    vector<Meshlet> meshlets;   // clusters of the levels, empty before BuildMeshlets
+    vector<Texture> textures;
+};
+
+// model file parsed on the CPU (read from the mesh cache or imported through Assimp)
+// no OpenGL calls are involved, so models can be imported on worker threads (see asset_loader.h)
+struct ImportedModel
+{
+    string directory;
+    MappedFile mapping;                 // backs the views of a cached model
+    vector<MeshData> mesh_data;         // backs the views of a freshly imported model
+    vector<MeshCache::MeshView> views;  // texture references only hold type and path
+};
+
 class Model
 {
 public:
 
-    Model(string const & path) { loadModel(path); }
+    Model(string const & path, MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA, VertexFormat format = VERTEX_FORMAT_FLOAT)
+    {
+        ImportedModel imported;
+        Import(path, imported);
+        createMeshes(imported, retain, format);
+    }
 
-    void Draw(Shader & shader)
+    // creates the meshes of an already imported model, textures come from the TextureCache
+    // (model directory + '/' + file), the ones it does not hold yet are loaded here
+    // meshes that retain their data take over the importer output, so imported is left without it
+    // format is the vertex buffer layout of all meshes (see VertexFormat)
+    Model(ImportedModel & imported, MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA, VertexFormat format = VERTEX_FORMAT_FLOAT)
     {
+        createMeshes(imported, retain, format);
+    }
+
+    // the meshes own their buffers, a model is never copied
+    Model(const Model &) = delete;
+    Model & operator=(const Model &) = delete;
+
+    // the program in use has its samplers at the fixed units of the mesh materials (see Shader)
+    // lods[i] is the level of detail of mesh i (NULL draws LOD 0), ranges[i] the visible clusters of that level
+    // (see ClusterStream, NULL draws the whole level), returns the triangles drawn per instance
+    size_t Draw(GLsizei instance_count = 1, const unsigned char * lods = NULL, const IndexRange * ranges = NULL)
+    {
+        TRACE_SCOPE("Model::Draw");
+        size_t triangles = 0;
         for (GLuint i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        {
+            unsigned int lod = lods ? lods[i] : 0;
+            if (ranges == NULL)
+            {
+                meshes[i].Draw(instance_count, lod);
+                triangles += meshes[i].IndexCount(lod) / 3;
+            }
+            else if (ranges[i].index_count > 0)
+            {
+                meshes[i].DrawRange(ranges[i], lod, instance_count);
+                triangles += ranges[i].index_count / 3;
+            }
+        }
+        return triangles;
     }
 
-private:
+    // draws only the meshes with visible[i] != 0 (per-mesh result of SceneCuller), returns the number of draw calls
+    // a mesh whose clusters (ranges, see Draw) are all culled is skipped as well
+    GLuint DrawVisible(const unsigned char * visible, const unsigned char * lods = NULL, const IndexRange * ranges = NULL)
+    {
+        TRACE_SCOPE("Model::DrawVisible");
+        GLuint draws = 0;
+        for (GLuint i = 0; i < meshes.size(); i++)
+            if (visible[i])
+            {
+                if (ranges == NULL)
+                    meshes[i].Draw(1, lods ? lods[i] : 0);
+                else if (ranges[i].index_count > 0)
+                    meshes[i].DrawRange(ranges[i], lods ? lods[i] : 0);
+                else
+                    continue;
+                draws++;
+            }
+        return draws;
+    }
 
-    // model data 
-    vector<Texture> textures_loaded;
-    vector<Mesh> meshes;
-    string directory;
+    // one instanced draw of a single mesh, see Mesh::DrawInstanced
+    void DrawMeshInstanced(size_t mesh, GLuint instance_buffer, size_t first_instance, GLsizei instance_count, unsigned int lod = 0)
+    {
+        meshes[mesh].DrawInstanced(instance_buffer, first_instance, instance_count, lod);
+    }
+
+    size_t MeshCount() const { return meshes.size(); }
+    const Mesh & GetMesh(size_t i) const { return meshes[i]; }
+
+    // resident bytes of all meshes (the textures are accounted by the TextureCache)
+    MeshMemory Memory() const
+    {
+        MeshMemory memory;
+        for (const Mesh & mesh : meshes)
+            memory += mesh.Memory();
+        return memory;
+    }
+
+    size_t VertexCount() const
+    {
+        size_t vertices = 0;
+        for (const Mesh & mesh : meshes)
+            vertices += mesh.VertexCount();
+        return vertices;
+    }
+
+    VertexFormat Format() const { return meshes.empty() ? VERTEX_FORMAT_FLOAT : meshes[0].Format(); }
+
+    VertexQuantizationError QuantizationError() const
+    {
+        VertexQuantizationError error;
+        for (const Mesh & mesh : meshes)
+            error += mesh.QuantizationError();
+        return error;
+    }
+
+    // triangles of all meshes at the levels of detail lods (NULL counts LOD 0)
+    size_t TriangleCount(const unsigned char * lods = NULL) const
+    {
+        size_t triangles = 0;
+        for (size_t i = 0; i < meshes.size(); i++)
+            triangles += meshes[i].IndexCount(lods ? lods[i] : 0) / 3;
+        return triangles;
+    }
+
+    // most levels of detail of a mesh
+    size_t LodCount() const
+    {
+        size_t lod_count = 0;
+        for (const Mesh & mesh : meshes)
+            lod_count = max(lod_count, mesh.LodCount());
+        return lod_count;
+    }
+
+    // object space bounding sphere around the boxes of all meshes
+    glm::vec3 BoundsCenter() const { return bounds_center; }
+    float BoundsRadius() const { return bounds_radius; }
 
-    void loadModel(string const& path)
+    // reads the model from its mesh cache, or imports it with Assimp, optimizes the meshes (MeshOptimization flags),
+    // builds their levels of detail and meshlets and writes the cache, returns false on import errors
+    static bool Import(string const & path, ImportedModel & imported, unsigned int optimization = MESH_OPTIMIZE_ALL)
     {
+        TRACE_SCOPE("Model::Import");
+        // get directory path of the filepath
+        imported.directory = path.substr(0, path.find_last_of('/'));
+
+        // warm start: the cache next to the model already holds the final vertex and index arrays
+        unsigned long long source_hash = 0;
+        bool has_source = HashModelSource(path, source_hash);
+        string cache_path = MeshCache::CachePath(path);
+        if (has_source && MeshCache::Read(cache_path, source_hash, MODEL_IMPORT_FLAGS, optimization, imported.mapping, imported.views))
+            return true;
+        imported.mapping.Close();
+        imported.views.clear();
+
+        if (!ImportSource(path, imported.mesh_data))
+            return false;
+        for (MeshData & data : imported.mesh_data)
+        {
+            OptimizeMesh(data.vertices, data.indices, optimization);
+            BuildMeshLods(data.vertices, data.indices, data.lods);
+            BuildMeshlets(data.vertices, data.indices, data.lods, data.meshlets);
+        }
+
+        // store the result, so the next start does not need the importer
+        for (const MeshData & data : imported.mesh_data)
+        {
+            MeshCache::MeshView view = { data.vertices.data(), (unsigned int)data.vertices.size(), data.indices.data(), (unsigned int)data.indices.size(),
+                                         data.lods.data(), (unsigned int)data.lods.size(), data.meshlets.data(), (unsigned int)data.meshlets.size(),
+                                         data.textures };
+            imported.views.push_back(view);
+        }
+        if (has_source && !MeshCache::Write(cache_path, source_hash, MODEL_IMPORT_FLAGS, optimization, imported.views))
+            cout << "WARNING::MESH_CACHE:: Failed to write " << cache_path << endl;
+        return true;
+    }
+
+    // the meshes of the model file as Assimp returns them, without the mesh cache and optimization
+    static bool ImportSource(string const & path, vector<MeshData> & mesh_data)
+    {
+        TRACE_SCOPE("Model::ImportSource");
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return false;
         }
 
-        // get directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
         // process ASSIMP node structure recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, scene, mesh_data);
+        return true;
     }
 
-    void processNode(aiNode* node, const aiScene* scene)
+private:
+
+    // model data 
+    vector<Mesh> meshes;
+    string directory;
+    glm::vec3 bounds_center = glm::vec3(0.0f);
+    float bounds_radius = 0.0f;
+
+    // uploads the meshes, either straight from the cache mapping or from the importer output
+    void createMeshes(ImportedModel & imported, MeshRetainPolicy retain, VertexFormat format)
+    {
+        TRACE_SCOPE("Model::createMeshes");
+        directory = imported.directory;
+
+        meshes.reserve(imported.views.size());
+        // meshes of the same model material (same texture list) share one Material
+        vector<shared_ptr<const Material>> materials;
+        for (size_t i = 0; i < imported.views.size(); i++)
+        {
+            const MeshCache::MeshView & view = imported.views[i];
+            vector<Texture> textures;
+            for (const Texture & reference : view.textures)
+                textures.push_back(resolveTexture(reference));
+
+            shared_ptr<const Material> material;
+            for (const shared_ptr<const Material> & existing : materials)
+                if (existing->Uses(textures))
+                    material = existing;
+            if (!material)
+            {
+                material = make_shared<const Material>(textures);
+                materials.push_back(material);
+            }
+
+            if (imported.mesh_data.empty() || retain == MESH_RELEASE_CPU_DATA)
+                meshes.push_back(Mesh(view.vertices, view.vertex_count, view.indices, view.index_count, material, retain, format));
+            else
+                meshes.push_back(Mesh(move(imported.mesh_data[i].vertices), move(imported.mesh_data[i].indices), material, retain, format));
+            meshes.back().SetLods(view.lods, view.lod_count);
+            meshes.back().SetMeshlets(view.meshlets, view.meshlet_count);
+        }
+
+        if (meshes.empty())
+            return;
+        glm::vec3 aabb_min = meshes[0].aabb_min, aabb_max = meshes[0].aabb_max;
+        for (const Mesh & mesh : meshes)
+        {
+            aabb_min = glm::min(aabb_min, mesh.aabb_min);
+            aabb_max = glm::max(aabb_max, mesh.aabb_max);
+        }
+        bounds_center = (aabb_min + aabb_max) * 0.5f;
+        bounds_radius = glm::length(aabb_max - aabb_min) * 0.5f;
+    }
+
+    static void processNode(aiNode* node, const aiScene* scene, vector<MeshData> & mesh_data)
     {
         // process each of mNumMeshes meshes in the current node
         for (GLuint i = 0; i < node->mNumMeshes; i++)
         {
             // get mesh from array in scene object using index from array mMeshes stored in current node
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            mesh_data.push_back(processMesh(mesh, scene));
         }
 
         // after we've processed all of the meshes we can recursively process each of the children nodes
         for (GLuint i = 0; i < node->mNumChildren; i++)
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, mesh_data);
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex> & vertices = data.vertices;
+        vector<GLuint> & indices = data.indices;
+        vector<Texture> & textures = data.textures;
 
         // walk through each of the mesh's vertices
         for (GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -158,82 +386,39 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "height_texture");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // the mesh object is created once all meshes are imported (and written to the cache)
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, string typeName)
+    // collects all material textures of a given type, only type and path are filled (textures are loaded when the meshes are created)
+    static vector<Texture> loadMaterialTextures(aiMaterial* material, aiTextureType type, string typeName)
     {
         vector<Texture> textures;
         for (GLuint i = 0; i < material->GetTextureCount(type); i++)
         {
             aiString str;
             material->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (GLuint j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
         return textures;
     }
+
+    Texture resolveTexture(const Texture & reference)
+    {
+        Texture texture = reference;
+        texture.id = TextureCache::Get().Load2D(directory + '/' + reference.path);
+        return texture;
+    }
 };
 
 
 GLuint TextureFromFile(const char* path, const string& directory)
 {
-    string filename = string(path);
-    filename = directory + '/' + filename ;
-
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    TRACE_SCOPE("TextureFromFile");
+    return TextureCache::Get().Load2D(directory + '/' + string(path));
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,579 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Model.h"
+#include "texture_cache.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// largest resident set of the process so far, 0 where it is not available
+size_t PeakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    // kilobytes on Linux
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// fixed set of worker threads executing queued tasks in submission order
+class ThreadPool
+{
+public:
+
+    // thread_count = 0 uses one thread per hardware core
+    ThreadPool(unsigned int thread_count = 0)
+    {
+        if (thread_count == 0)
+            thread_count = max(1u, thread::hardware_concurrency());
+        for (unsigned int i = 0; i < thread_count; i++)
+            workers.push_back(thread([this]() { WorkerLoop(); }));
+    }
+
+    // runs the remaining tasks, then joins the workers
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            stopping = true;
+        }
+        tasks_changed.notify_all();
+        for (thread & worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    // may also be called from a task
+    void Submit(function<void()> task)
+    {
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            tasks.push_back(move(task));
+        }
+        tasks_changed.notify_one();
+    }
+
+    unsigned int Size() const { return (unsigned int)workers.size(); }
+
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex tasks_mutex;
+    condition_variable tasks_changed;
+    bool stopping = false;
+
+    void WorkerLoop()
+    {
+        TRACE_THREAD_NAME("worker");
+        for (;;)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(tasks_mutex);
+                tasks_changed.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+
+// loads all models and cubemaps of the scene at once:
+//   worker threads read the mesh caches (or run Assimp) and decode the images with stb_image,
+//   the calling thread, which owns the OpenGL context, only uploads them (textures optionally through pixel buffer objects)
+// models are created as soon as their meshes and all of their textures are ready
+// textures and cubemaps the TextureCache already holds are neither decoded nor uploaded again
+//
+// usage: register everything with AddModel / AddCubemap, call Load() once, then fetch the results by index
+class AssetLoader
+{
+public:
+
+    // thread_count = 0 uses one thread per hardware core
+    AssetLoader(unsigned int thread_count = 0, bool use_pixel_buffers = true)
+        : thread_count(thread_count), use_pixel_buffers(use_pixel_buffers) {}
+
+    ~AssetLoader()
+    {
+        for (unique_ptr<ImageJob> & image : images)
+            FreeImage(image->image);
+        for (GLuint cubemap : cubemaps)
+            TextureCache::Get().Release(cubemap);
+    }
+
+    AssetLoader(const AssetLoader &) = delete;
+    AssetLoader & operator=(const AssetLoader &) = delete;
+
+    // retain keeps the vertices and indices of the meshes on the CPU (see MeshRetainPolicy), format is the layout of their vertex buffers
+    size_t AddModel(const string & path, MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA, VertexFormat format = VERTEX_FORMAT_FLOAT)
+    {
+        model_jobs.push_back(ModelJob());
+        model_jobs.back().path = path;
+        model_jobs.back().retain = retain;
+        model_jobs.back().format = format;
+        return model_jobs.size() - 1;
+    }
+
+    // MeshOptimization flags of the models imported without a valid mesh cache (set before Load)
+    void SetMeshOptimization(unsigned int optimization) { mesh_optimization = optimization; }
+
+    // faces in the order +x, -x, +y, -y, +z, -z
+    size_t AddCubemap(const vector<string> & faces)
+    {
+        cubemap_faces.push_back(faces);
+        return cubemap_faces.size() - 1;
+    }
+
+    void Load()
+    {
+        TRACE_SCOPE("AssetLoader::Load");
+        chrono::high_resolution_clock::time_point load_start = chrono::high_resolution_clock::now();
+
+        if (use_pixel_buffers)
+            glGenBuffers(PIXEL_BUFFER_COUNT, pixel_buffers);
+
+        TextureCache & texture_cache = TextureCache::Get();
+        cubemaps.resize(cubemap_faces.size());
+        cubemap_face_images.resize(cubemap_faces.size());
+        vector<bool> new_cubemaps(cubemap_faces.size(), false);
+        for (size_t c = 0; c < cubemap_faces.size(); c++)
+        {
+            cubemaps[c] = texture_cache.Find(TextureCache::CubemapKey(cubemap_faces[c]));
+            if (cubemaps[c] == 0)
+            {
+                glGenTextures(1, &cubemaps[c]);
+                new_cubemaps[c] = true;
+            }
+        }
+
+        size_t pending_faces = 0;
+        {
+            ThreadPool pool(thread_count);
+            used_threads = pool.Size();
+
+            // cubemap faces go first, they are known before any model is imported
+            for (size_t c = 0; c < cubemap_faces.size(); c++)
+                for (size_t f = 0; new_cubemaps[c] && f < cubemap_faces[c].size(); f++)
+                {
+                    RequestImage(pool, cubemap_faces[c][f], (int)c, (int)f);
+                    pending_faces++;
+                }
+
+            for (size_t m = 0; m < model_jobs.size(); m++)
+                pool.Submit([this, &pool, m]() { ImportModel(pool, m); });
+
+            // upload whatever the workers finish, until every model is created and every face is uploaded
+            size_t created_models = 0;
+            while (created_models < model_jobs.size() || pending_faces > 0)
+            {
+                Event event = WaitEvent();
+                if (event.type == Event::IMAGE_DECODED)
+                {
+                    ImageJob & image = GetImage(event.index);
+                    UploadImage(image);
+                    if (image.cubemap >= 0)
+                        pending_faces--;
+                }
+                else
+                    model_jobs[event.index].imported_done = true;
+
+                created_models += CreateReadyModels();
+            }
+        }
+
+        TextureSampling sampling = TextureSampling::Cubemap();
+        for (size_t c = 0; c < cubemaps.size(); c++)
+        {
+            if (new_cubemaps[c])
+            {
+                glBindTexture(GL_TEXTURE_CUBE_MAP, cubemaps[c]);
+                glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, sampling.min_filter);
+                glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, sampling.mag_filter);
+                glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, sampling.wrap);
+                glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, sampling.wrap);
+                glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, sampling.wrap);
+                texture_cache.Insert(TextureCache::CubemapKey(cubemap_faces[c]), cubemap_faces[c][0], cubemaps[c], GL_TEXTURE_CUBE_MAP,
+                                     cubemap_face_images[c], sampling.mipmaps, (int)cubemap_faces[c].size());
+            }
+            // the loader keeps its cubemaps alive until it is destroyed
+            texture_cache.Acquire(cubemaps[c]);
+        }
+
+        if (use_pixel_buffers)
+            glDeleteBuffers(PIXEL_BUFFER_COUNT, pixel_buffers);
+
+        wall_ms = MillisecondsSince(load_start);
+    }
+
+    Model & GetModel(size_t index) { return *model_jobs[index].model; }
+    GLuint GetCubemap(size_t index) const { return cubemaps[index]; }
+
+    // deletes the models (buffers, material texture references) while the context is still current
+    void DestroyModels()
+    {
+        for (ModelJob & job : model_jobs)
+            job.model.reset();
+    }
+
+    // resident CPU and GPU bytes of every model, the totals and the peak resident set of the process
+    void PrintMemoryReport() const
+    {
+        MeshMemory total;
+        for (const ModelJob & job : model_jobs)
+        {
+            if (!job.model)
+                continue;
+            MeshMemory memory = job.model->Memory();
+            cout << "MESH_MEMORY:: " << job.path << ": cpu = " << memory.cpu_bytes / 1024 << " KiB, gpu = " << memory.gpu_bytes / 1024 << " KiB, "
+                 << VertexFormatName(job.format) << " vertices" << (job.retain == MESH_RETAIN_CPU_DATA ? " (cpu data retained)" :
+                                                                     job.retain == MESH_RETAIN_INDICES ? " (indices retained)" : "") << endl;
+            total += memory;
+        }
+        cout << "MESH_MEMORY:: total cpu = " << total.cpu_bytes / 1024 << " KiB, gpu = " << total.gpu_bytes / 1024
+             << " KiB, peak resident set = " << PeakResidentBytes() / (1024 * 1024) << " MiB" << endl;
+    }
+
+    // vertex buffer bytes of every model against float vertices, and the error of the packed ones
+    void PrintVertexFormatReport() const
+    {
+        size_t vertex_bytes = 0, float_bytes = 0;
+        for (const ModelJob & job : model_jobs)
+        {
+            if (!job.model)
+                continue;
+            size_t vertices = job.model->VertexCount();
+            vertex_bytes += vertices * VertexStride(job.format);
+            float_bytes += vertices * sizeof(Vertex);
+            if (job.format != VERTEX_FORMAT_PACKED)
+                continue;
+
+            VertexQuantizationError error = job.model->QuantizationError();
+            cout << "VERTEX_FORMAT:: " << job.path << ": " << vertices << " vertices, " << vertices * sizeof(Vertex) / 1024 << " KiB -> "
+                 << vertices * sizeof(PackedVertex) / 1024 << " KiB" << endl;
+            cout << "VERTEX_FORMAT::   position max error = " << error.position_max << " (" << error.position_relative * 100.0
+                 << "% of the bounds), normal error mean = " << error.NormalMean() << " max = " << error.normal_max << " deg, tangent max = "
+                 << error.tangent_max << " deg, bitangent max = " << error.bitangent_max << " deg, uv max = " << error.uv_max << endl;
+        }
+        cout << "VERTEX_FORMAT:: vertex buffers " << vertex_bytes / 1024 << " KiB (" << float_bytes / 1024 << " KiB as float vertices, "
+             << (float_bytes ? 100.0 * (float_bytes - vertex_bytes) / float_bytes : 0.0) << "% saved)" << endl;
+    }
+
+    // triangles, error and meshlets of every level of detail of the models that have more than LOD 0
+    void PrintLodReport() const
+    {
+        for (const ModelJob & job : model_jobs)
+        {
+            if (!job.model || job.model->LodCount() < 2)
+                continue;
+            cout << "LOD:: " << job.path << ":";
+            for (size_t lod = 0; lod < job.model->LodCount(); lod++)
+            {
+                size_t triangles = 0, meshlets = 0;
+                float error = 0.0f;
+                for (size_t i = 0; i < job.model->MeshCount(); i++)
+                {
+                    const Mesh & mesh = job.model->GetMesh(i);
+                    const MeshLod & level = mesh.Lods()[min(lod, mesh.LodCount() - 1)];
+                    triangles += level.index_count / 3;
+                    meshlets += level.meshlet_count;
+                    error = max(error, level.error);
+                }
+                cout << (lod ? ", " : " ") << "LOD " << lod << " " << triangles << " triangles (error " << error << ", " << meshlets << " meshlets)";
+            }
+            cout << endl;
+        }
+    }
+
+    // time spent in every stage, summed over all assets (import and decode run in parallel, so their sums may exceed the wall time)
+    void PrintReport() const
+    {
+        double import_ms = 0.0, decode_ms = 0.0, texture_upload_ms = 0.0, mesh_upload_ms = 0.0;
+        size_t cached_models = 0;
+        for (const ModelJob & job : model_jobs)
+        {
+            import_ms += job.import_ms;
+            mesh_upload_ms += job.upload_ms;
+            if (job.from_cache)
+                cached_models++;
+        }
+        for (const unique_ptr<ImageJob> & image : images)
+        {
+            decode_ms += image->decode_ms;
+            texture_upload_ms += image->upload_ms;
+        }
+
+        cout << "ASSET_LOADER:: " << model_jobs.size() << " models (" << cached_models << " from the mesh cache), "
+             << images.size() << " images, " << used_threads << " worker threads"
+             << (use_pixel_buffers ? ", pixel buffer uploads" : "") << endl;
+        cout << "ASSET_LOADER:: import ms = " << import_ms << ", decode ms = " << decode_ms
+             << " (worker threads)" << endl;
+        cout << "ASSET_LOADER:: texture upload ms = " << texture_upload_ms << ", mesh upload ms = " << mesh_upload_ms
+             << " (context thread)" << endl;
+        cout << "ASSET_LOADER:: wall ms = " << wall_ms << endl;
+    }
+
+private:
+
+    // pixel buffers are used round-robin, so a new copy does not wait for the transfer of the previous image
+    static const int PIXEL_BUFFER_COUNT = 4;
+
+    struct ModelJob
+    {
+        string path;
+        MeshRetainPolicy retain = MESH_RELEASE_CPU_DATA;
+        VertexFormat format = VERTEX_FORMAT_FLOAT;
+        unique_ptr<ImportedModel> imported;
+        vector<size_t> images;          // decoded textures the model waits for
+        bool imported_done = false, from_cache = false;
+        unique_ptr<Model> model;
+        double import_ms = 0.0, upload_ms = 0.0;
+    };
+
+    struct ImageJob
+    {
+        string path, key;               // key: texture cache key of a 2D texture
+        DecodedImage image;
+        int cubemap = -1, face = 0;     // face of a cubemap, or a 2D texture when cubemap < 0
+        GLuint texture = 0;
+        bool uploaded = false;
+        double decode_ms = 0.0, upload_ms = 0.0;
+    };
+
+    struct Event
+    {
+        enum Type { IMAGE_DECODED, MODEL_IMPORTED } type;
+        size_t index;
+    };
+
+    unsigned int thread_count, used_threads = 0;
+    unsigned int mesh_optimization = MESH_OPTIMIZE_ALL;
+    bool use_pixel_buffers;
+    GLuint pixel_buffers[PIXEL_BUFFER_COUNT] = {};
+    int next_pixel_buffer = 0;
+
+    vector<ModelJob> model_jobs;
+    vector<vector<string>> cubemap_faces;
+    vector<GLuint> cubemaps;
+    vector<DecodedImage> cubemap_face_images;   // size and format of the uploaded faces (no pixels), for the texture cache
+
+    // shared with the workers, guarded by jobs_mutex
+    mutex jobs_mutex;
+    condition_variable events_changed;
+    vector<unique_ptr<ImageJob>> images;
+    unordered_map<string, size_t> texture_images;   // by texture cache key
+    deque<Event> events;
+
+    double wall_ms = 0.0;
+
+    static double MillisecondsSince(chrono::high_resolution_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void PostEvent(Event::Type type, size_t index)
+    {
+        {
+            lock_guard<mutex> lock(jobs_mutex);
+            events.push_back({ type, index });
+        }
+        events_changed.notify_one();
+    }
+
+    Event WaitEvent()
+    {
+        unique_lock<mutex> lock(jobs_mutex);
+        events_changed.wait(lock, [this]() { return !events.empty(); });
+        Event event = events.front();
+        events.pop_front();
+        return event;
+    }
+
+    ImageJob & GetImage(size_t index)
+    {
+        lock_guard<mutex> lock(jobs_mutex);
+        return *images[index];
+    }
+
+    // queues the decoding of an image, model textures with the same cache key are decoded (and uploaded) only once
+    size_t RequestImage(ThreadPool & pool, const string & path, int cubemap = -1, int face = 0)
+    {
+        ImageJob * image;
+        size_t index;
+        {
+            lock_guard<mutex> lock(jobs_mutex);
+            string key;
+            if (cubemap < 0)
+            {
+                key = TextureCache::Key(path, GL_TEXTURE_2D, TextureSampling());
+                unordered_map<string, size_t>::iterator existing = texture_images.find(key);
+                if (existing != texture_images.end())
+                    return existing->second;
+                texture_images[key] = images.size();
+            }
+            index = images.size();
+            images.push_back(unique_ptr<ImageJob>(new ImageJob()));
+            image = images.back().get();
+            image->path = path;
+            image->key = key;
+            image->cubemap = cubemap;
+            image->face = face;
+        }
+
+        pool.Submit([this, image, index]() {
+            chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+            DecodeImage(image->path, image->image);
+            image->decode_ms = MillisecondsSince(start);
+            PostEvent(Event::IMAGE_DECODED, index);
+        });
+        return index;
+    }
+
+    // worker side: import the model, then queue the decoding of its textures on the same pool
+    void ImportModel(ThreadPool & pool, size_t index)
+    {
+        TRACE_SCOPE("AssetLoader::ImportModel");
+        ModelJob & job = model_jobs[index];
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        job.imported.reset(new ImportedModel());
+        Model::Import(job.path, *job.imported, mesh_optimization);
+        job.import_ms = MillisecondsSince(start);
+        job.from_cache = job.imported->mapping.data != NULL;
+
+        // textures uploaded before this load (an earlier loader, Model(path)) are taken from the cache when the model is created
+        for (const MeshCache::MeshView & view : job.imported->views)
+            for (const Texture & reference : view.textures)
+            {
+                string path = job.imported->directory + '/' + reference.path;
+                if (!TextureCache::Get().Find(TextureCache::Key(path, GL_TEXTURE_2D, TextureSampling())))
+                    job.images.push_back(RequestImage(pool, path));
+            }
+
+        PostEvent(Event::MODEL_IMPORTED, index);
+    }
+
+    // context thread: creates the texture of a decoded image (or fills the cubemap face) and frees the pixels
+    void UploadImage(ImageJob & image)
+    {
+        TRACE_SCOPE("AssetLoader::UploadImage");
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+        // cooked images hold every level of their mip chain in one block
+        bool compressed = image.image.Compressed();
+        const void * pixels = compressed ? (const void *)&image.image.compressed.data[0] : image.image.data;
+        if (use_pixel_buffers && image.image.Loaded())
+        {
+            // the copy into driver memory happens here, the texture transfer itself is done asynchronously by the driver
+            GLsizeiptr size = compressed ? (GLsizeiptr)image.image.compressed.data.size()
+                                         : (GLsizeiptr)image.image.width * image.image.height * image.image.components;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[next_pixel_buffer]);
+            next_pixel_buffer = (next_pixel_buffer + 1) % PIXEL_BUFFER_COUNT;
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            void * mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (mapped)
+            {
+                memcpy(mapped, pixels, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                pixels = NULL; // offset 0 of the pixel buffer
+            }
+            else
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        if (image.cubemap >= 0)
+        {
+            if (image.image.Loaded())
+            {
+                glBindTexture(GL_TEXTURE_CUBE_MAP, cubemaps[image.cubemap]);
+                if (compressed)
+                    UploadCompressedImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.face, image.image.compressed, pixels);
+                else
+                {
+                    GLenum format = ImageFormat(image.image.components);
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + image.face, 0, GL_RGB, image.image.width, image.image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+                    // the faces are stored as GL_RGB whatever the image format
+                    image.image.components = 3;
+                }
+            }
+            else
+                cout << "Cubemap texture failed to load, path = " << image.path << endl;
+        }
+        else
+        {
+            if (!image.image.Loaded())
+                cout << "Texture failed to load at path: " << image.path << endl;
+            image.texture = UploadTexture(image.image, pixels);
+            TextureCache::Get().Insert(image.key, image.path, image.texture, GL_TEXTURE_2D, image.image, TextureSampling().mipmaps);
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        FreeImage(image.image);
+        if (image.cubemap >= 0 && image.image.width > 0)
+            cubemap_face_images[image.cubemap] = image.image;
+        image.uploaded = true;
+        image.upload_ms = MillisecondsSince(start);
+    }
+
+    // context thread: creates the models whose meshes are imported and whose textures are all uploaded
+    size_t CreateReadyModels()
+    {
+        TRACE_SCOPE("AssetLoader::CreateReadyModels");
+        size_t created = 0;
+        for (ModelJob & job : model_jobs)
+        {
+            if (job.model || !job.imported_done)
+                continue;
+
+            bool ready = true;
+            for (size_t image : job.images)
+                ready = ready && GetImage(image).uploaded;
+            if (!ready)
+                continue;
+
+            chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+            job.model.reset(new Model(*job.imported, job.retain, job.format));
+            job.upload_ms = MillisecondsSince(start);
+            // the meshes live in OpenGL buffers now, the mapping and the importer output are not needed anymore
+            job.imported.reset();
+            created++;
+        }
+        return created;
+    }
+};
+
+#endif
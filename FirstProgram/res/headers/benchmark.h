@@ -0,0 +1,386 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "shadow_cache.h"
+
+using namespace std;
+
+// command line settings of the deterministic benchmark mode
+// usage: FirstProgram --headless [--frames N] [--warmup N] [--width W] [--height H] [--csv file.csv] [--screenshot file.ppm]
+// asset loading (also in the windowed mode): [--load-threads N] (0 = one per core) [--no-pixel-buffers]
+//   [--no-cooked-textures] decodes the images even where a cooked .dds exists, [--retain-mesh-data] keeps the meshes on the CPU
+//   [--packed-vertices] uploads every model with packed vertices (otherwise the scene file decides per model)
+//   [--mesh-optimization none|cache|overdraw] reorders imported meshes (stored in the mesh cache, default overdraw)
+// mesh analysis: FirstProgram --analyze-meshes prints the vertex cache and overdraw figures of every model in res/models and exits
+// texture cooking: FirstProgram --cook-textures [--scene file.json] [--load-threads N] writes the .dds files of the scene and exits
+// scene file (also in the windowed mode): [--scene res/scenes/default.json] [--no-instancing] draws every instance on its own
+// state changes: [--no-draw-sort] keeps the batches in scene order, [--no-state-filter] issues redundant state calls too
+// shadows: [--no-shadow-cache] redraws the whole shadow cubemap every frame, [--shadow-path gs|face|layer] selects how it is drawn
+// levels of detail: [--no-lod] draws every mesh in full, [--lod-threshold P] allowed projected error in pixels (default 1),
+//   [--lod-bias-reflection B] [--lod-bias-shadow B] multiply it in the mirror pass (default 2) and the shadow cubemap (default 4)
+// meshlets: [--meshlets] draws only the clusters inside the view frustum (and the shadow faces) that are not back facing,
+//   [--no-meshlet-cones] skips the back facing test (for open surfaces)
+// submission: [--geometry-arena] puts all meshes into shared vertex and index buffers, [--multi-draw] (implies it) submits the
+//   opaque batches with glMultiDrawElementsIndirect, [--no-indirect] replays the commands one by one as on GL 3.3
+// pass timings: [--pass-csv file.csv] writes the cpu and gpu ms of every pass and frame, [--overlay] draws the timings
+//   overlay into the headless frames too (the windowed mode shows it, key O toggles it)
+// mirror: [--reflection-scale S] texels per pixel of the mirror on the screen (default 1), [--reflection-interval N] redraws
+//   it every N frames (default 1), [--reflection-on-change] only when the view or the light moved,
+//   [--no-reflection-culling] draws the whole texture every frame, also while the mirror is out of view or occluded
+// deferred shading: [--deferred] lights the main view from a G-buffer, [--lights N] adds N moving point lights to it
+//   (default 0), [--light-sweep] (implies it) runs --frames frames with 1, 2, 4 ... 1024 point lights each
+// timeline (also in the windowed mode): [--trace file.json] writes the scopes of every thread as a Chrome trace at exit
+struct BenchmarkSettings
+{
+    bool headless = false;
+    int frames = 300;
+    int warmup = 10;
+    GLuint width = 1244, height = 700;
+    string csv_path;
+    string screenshot_path;
+    string scene_path = "res/scenes/default.json";
+    bool instancing = true;
+    bool sort_draws = true;
+    bool state_filtering = true;
+    unsigned int load_threads = 0;
+    bool pixel_buffers = true;
+    bool cooked_textures = true;
+    bool retain_mesh_data = false;
+    bool packed_vertices = false;
+    unsigned int mesh_optimization = MESH_OPTIMIZE_ALL;
+    bool analyze_meshes = false;
+    bool cook_textures = false;
+    bool shadow_cache = true;
+    ShadowPath shadow_path = SHADOW_PATH_GEOMETRY_SHADER;
+    LodSettings lod;
+    bool meshlets = false;
+    bool meshlet_cones = true;
+    bool geometry_arena = false;
+    bool multi_draw = false;
+    bool indirect_draws = true;
+    string pass_csv_path;
+    bool overlay = false;
+    string trace_path;
+    float reflection_scale = 1.0f;
+    int reflection_interval = 1;
+    bool reflection_on_change = false;
+    bool reflection_culling = true;
+    bool deferred = false;
+    unsigned int lights = 0;
+    bool light_sweep = false;
+};
+
+BenchmarkSettings ParseBenchmarkArgs(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0)
+            settings.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && has_value)
+            settings.frames = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+            settings.warmup = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--width") == 0 && has_value)
+            settings.width = (GLuint)max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--height") == 0 && has_value)
+            settings.height = (GLuint)max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--csv") == 0 && has_value)
+            settings.csv_path = argv[++i];
+        else if (strcmp(argv[i], "--screenshot") == 0 && has_value)
+            settings.screenshot_path = argv[++i];
+        else if (strcmp(argv[i], "--scene") == 0 && has_value)
+            settings.scene_path = argv[++i];
+        else if (strcmp(argv[i], "--no-instancing") == 0)
+            settings.instancing = false;
+        else if (strcmp(argv[i], "--no-draw-sort") == 0)
+            settings.sort_draws = false;
+        else if (strcmp(argv[i], "--no-state-filter") == 0)
+            settings.state_filtering = false;
+        else if (strcmp(argv[i], "--load-threads") == 0 && has_value)
+            settings.load_threads = (unsigned int)max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--no-pixel-buffers") == 0)
+            settings.pixel_buffers = false;
+        else if (strcmp(argv[i], "--no-cooked-textures") == 0)
+            settings.cooked_textures = false;
+        else if (strcmp(argv[i], "--retain-mesh-data") == 0)
+            settings.retain_mesh_data = true;
+        else if (strcmp(argv[i], "--packed-vertices") == 0)
+            settings.packed_vertices = true;
+        else if (strcmp(argv[i], "--mesh-optimization") == 0 && has_value)
+        {
+            i++;
+            if (strcmp(argv[i], "none") == 0)
+                settings.mesh_optimization = MESH_OPTIMIZE_NONE;
+            else if (strcmp(argv[i], "cache") == 0)
+                settings.mesh_optimization = MESH_OPTIMIZE_VERTEX_CACHE;
+            else
+                settings.mesh_optimization = MESH_OPTIMIZE_ALL;
+        }
+        else if (strcmp(argv[i], "--analyze-meshes") == 0)
+            settings.analyze_meshes = true;
+        else if (strcmp(argv[i], "--cook-textures") == 0)
+            settings.cook_textures = true;
+        else if (strcmp(argv[i], "--no-shadow-cache") == 0)
+            settings.shadow_cache = false;
+        else if (strcmp(argv[i], "--shadow-path") == 0 && has_value)
+        {
+            i++;
+            if (strcmp(argv[i], "face") == 0)
+                settings.shadow_path = SHADOW_PATH_PER_FACE;
+            else if (strcmp(argv[i], "layer") == 0)
+                settings.shadow_path = SHADOW_PATH_LAYERED;
+            else
+                settings.shadow_path = SHADOW_PATH_GEOMETRY_SHADER;
+        }
+        else if (strcmp(argv[i], "--no-lod") == 0)
+            settings.lod.enabled = false;
+        else if (strcmp(argv[i], "--lod-threshold") == 0 && has_value)
+            settings.lod.threshold = max(0.0f, (float)atof(argv[++i]));
+        else if (strcmp(argv[i], "--lod-bias-reflection") == 0 && has_value)
+            settings.lod.bias[RENDER_PASS_REFLECTION] = max(0.0f, (float)atof(argv[++i]));
+        else if (strcmp(argv[i], "--lod-bias-shadow") == 0 && has_value)
+            settings.lod.bias[RENDER_PASS_SHADOW] = max(0.0f, (float)atof(argv[++i]));
+        else if (strcmp(argv[i], "--meshlets") == 0)
+            settings.meshlets = true;
+        else if (strcmp(argv[i], "--no-meshlet-cones") == 0)
+            settings.meshlet_cones = false;
+        else if (strcmp(argv[i], "--geometry-arena") == 0)
+            settings.geometry_arena = true;
+        else if (strcmp(argv[i], "--multi-draw") == 0)
+            settings.multi_draw = true;
+        else if (strcmp(argv[i], "--no-indirect") == 0)
+            settings.indirect_draws = false;
+        else if (strcmp(argv[i], "--pass-csv") == 0 && has_value)
+            settings.pass_csv_path = argv[++i];
+        else if (strcmp(argv[i], "--overlay") == 0)
+            settings.overlay = true;
+        else if (strcmp(argv[i], "--trace") == 0 && has_value)
+            settings.trace_path = argv[++i];
+        else if (strcmp(argv[i], "--reflection-scale") == 0 && has_value)
+            settings.reflection_scale = glm::clamp((float)atof(argv[++i]), 0.0625f, 4.0f);
+        else if (strcmp(argv[i], "--reflection-interval") == 0 && has_value)
+            settings.reflection_interval = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--reflection-on-change") == 0)
+            settings.reflection_on_change = true;
+        else if (strcmp(argv[i], "--no-reflection-culling") == 0)
+            settings.reflection_culling = false;
+        else if (strcmp(argv[i], "--deferred") == 0)
+            settings.deferred = true;
+        else if (strcmp(argv[i], "--lights") == 0 && has_value)
+            settings.lights = (unsigned int)max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--light-sweep") == 0)
+            settings.deferred = settings.light_sweep = true;
+        else
+            cout << "WARNING::BENCHMARK:: Unknown argument " << argv[i] << endl;
+    }
+    return settings;
+}
+
+// writes the color buffer of the bound framebuffer as a binary ppm (used to compare the last frame between runs)
+void SaveFramebufferPPM(const string & path, GLuint width, GLuint height)
+{
+    vector<unsigned char> pixels(width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    ofstream image(path, ios::binary);
+    if (!image)
+    {
+        cout << "ERROR::BENCHMARK:: Cannot write " << path << endl;
+        return;
+    }
+    image << "P6\n" << width << " " << height << "\n255\n";
+    // OpenGL rows go from bottom to top
+    for (GLuint row = 0; row < height; row++)
+        image.write((const char *)&pixels[(height - 1 - row) * width * 3], width * 3);
+}
+
+
+// scripted camera movement, so every benchmark run renders exactly the same sequence of frames
+class CameraPath
+{
+public:
+
+    struct Key
+    {
+        glm::vec3 position;
+        float yaw, pitch;
+    };
+
+    // default path: a loop around the table that also passes in front of the mirror and the stone wall
+    CameraPath()
+    {
+        keys.push_back({ glm::vec3(0.0f, 10.0f, 15.0f), -90.0f, -20.0f });
+        keys.push_back({ glm::vec3(10.0f, 8.0f, 8.0f), -135.0f, -25.0f });
+        keys.push_back({ glm::vec3(8.0f, 6.0f, -8.0f), -200.0f, -15.0f });
+        keys.push_back({ glm::vec3(-6.0f, 7.0f, -6.0f), -310.0f, -20.0f });
+        keys.push_back({ glm::vec3(-10.0f, 9.0f, 6.0f), -400.0f, -25.0f });
+        keys.push_back({ glm::vec3(0.0f, 10.0f, 15.0f), -450.0f, -20.0f });
+    }
+
+    // t in [0, 1] covers the whole path
+    void Apply(float t, Camera & camera) const
+    {
+        float segment = glm::clamp(t, 0.0f, 1.0f) * (keys.size() - 1);
+        size_t i = min((size_t)segment, keys.size() - 2);
+        float s = segment - i;
+        // smoothstep between keys, so the camera has no velocity jumps
+        s = s * s * (3.0f - 2.0f * s);
+
+        camera.camera_pos = glm::mix(keys[i].position, keys[i + 1].position, s);
+        camera.yaw = glm::mix(keys[i].yaw, keys[i + 1].yaw, s);
+        camera.pitch = glm::mix(keys[i].pitch, keys[i + 1].pitch, s);
+        camera.UpdateVectors();
+    }
+
+private:
+    vector<Key> keys;
+};
+
+
+// collects CPU time (submission) and GPU time (GL_TIME_ELAPSED) of every frame
+// queries are kept in a ring, so results are read back a few frames later and the CPU does not wait for the GPU
+class FrameTimer
+{
+public:
+
+    struct Sample
+    {
+        int frame;
+        double cpu_ms, gpu_ms;
+    };
+
+    FrameTimer()
+    {
+        glGenQueries(RING_SIZE, queries);
+    }
+
+    ~FrameTimer()
+    {
+        glDeleteQueries(RING_SIZE, queries);
+    }
+
+    void BeginFrame(int frame)
+    {
+        int slot = frame % RING_SIZE;
+        // the slot is reused: its result has to be collected first (this only blocks if the GPU is RING_SIZE frames behind)
+        if (pending[slot])
+            Collect(slot);
+
+        frames[slot] = frame;
+        cpu_start = chrono::high_resolution_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+    }
+
+    void EndFrame(int frame)
+    {
+        int slot = frame % RING_SIZE;
+        glEndQuery(GL_TIME_ELAPSED);
+        cpu_ms[slot] = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - cpu_start).count();
+        pending[slot] = true;
+    }
+
+    // wait for all outstanding queries
+    void Finish()
+    {
+        for (int slot = 0; slot < RING_SIZE; slot++)
+            if (pending[slot])
+                Collect(slot);
+        sort(samples.begin(), samples.end(), [](const Sample & a, const Sample & b) { return a.frame < b.frame; });
+    }
+
+    // every collected frame (in frame order after Finish)
+    const vector<Sample> & Samples() const { return samples; }
+
+    // drops the samples of the warmup frames, prints a summary and optionally writes every frame to a csv file
+    void Report(int warmup, const string & csv_path)
+    {
+        vector<Sample> measured;
+        for (const Sample & sample : samples)
+            if (sample.frame >= warmup)
+                measured.push_back(sample);
+
+        if (measured.empty())
+        {
+            cout << "BENCHMARK:: no frames measured" << endl;
+            return;
+        }
+
+        vector<double> cpu, gpu;
+        for (const Sample & sample : measured)
+        {
+            cpu.push_back(sample.cpu_ms);
+            gpu.push_back(sample.gpu_ms);
+        }
+
+        cout << "BENCHMARK:: frames = " << measured.size() << endl;
+        PrintStats("cpu", cpu);
+        PrintStats("gpu", gpu);
+
+        if (!csv_path.empty())
+        {
+            ofstream csv(csv_path);
+            if (!csv)
+            {
+                cout << "ERROR::BENCHMARK:: Cannot write " << csv_path << endl;
+                return;
+            }
+            csv << "frame,cpu_ms,gpu_ms\n";
+            for (const Sample & sample : measured)
+                csv << sample.frame << ',' << sample.cpu_ms << ',' << sample.gpu_ms << '\n';
+            cout << "BENCHMARK:: per-frame timings written to " << csv_path << endl;
+        }
+    }
+
+private:
+
+    static const int RING_SIZE = 8;
+
+    GLuint queries[RING_SIZE];
+    bool pending[RING_SIZE] = {};
+    int frames[RING_SIZE] = {};
+    double cpu_ms[RING_SIZE] = {};
+    chrono::high_resolution_clock::time_point cpu_start;
+    vector<Sample> samples;
+
+    void Collect(int slot)
+    {
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+        samples.push_back({ frames[slot], cpu_ms[slot], elapsed_ns / 1.0e6 });
+        pending[slot] = false;
+    }
+
+    static void PrintStats(const char * name, vector<double> values)
+    {
+        sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        auto percentile = [&values](double p) { return values[min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5))]; };
+
+        cout << "BENCHMARK:: " << name << " ms: avg = " << sum / values.size()
+             << ", min = " << values.front() << ", p50 = " << percentile(0.5)
+             << ", p95 = " << percentile(0.95) << ", p99 = " << percentile(0.99)
+             << ", max = " << values.back() << endl;
+    }
+};
+
+#endif
@@ -61,12 +61,6 @@ public:
 		return glm::lookAt(camera_pos, camera_pos + camera_dir, world_up);
 	}
 
-	glm::mat4 GetMirroredViewMatrix()
-	{
-		glm::vec3 mirrored_camera_pos = glm::vec3(camera_pos.x, camera_pos.y, -30-camera_pos.z), mirrored_camera_dir = glm::vec3(camera_dir.x, camera_dir.y, -camera_dir.z);
-		return glm::lookAt(mirrored_camera_pos, mirrored_camera_pos + mirrored_camera_dir, world_up);
-	}
-
 	void UpdateVectors()
 	{
 		camera_dir.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
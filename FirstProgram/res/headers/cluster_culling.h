@@ -0,0 +1,171 @@
+#ifndef CLUSTER_CULLING_H
+#define CLUSTER_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "culling.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
+
+using namespace std;
+
+// the camera of a pass as cluster culling sees it: a meshlet is kept if its sphere is inside any of the frustums
+// (the shadow paths that send a caster to several cubemap faces at once pass all of them) and, with cones, if it is
+// not back facing from eye as a whole
+//
+// the back facing test assumes closed surfaces whose back faces are hidden anyway (the program does not enable GL_CULL_FACE)
+struct ClusterView
+{
+    RenderPass pass = RENDER_PASS_MAIN;
+    Frustum frustums[6];
+    unsigned int frustum_count = 0;
+    glm::vec3 eye = glm::vec3(0.0f);
+    bool cones = true;
+
+    static ClusterView FromCamera(RenderPass pass, const glm::mat4 & view, const glm::mat4 & projection, bool cones)
+    {
+        ClusterView cluster_view;
+        cluster_view.pass = pass;
+        cluster_view.frustums[0] = Frustum::FromMatrix(projection * view);
+        cluster_view.frustum_count = 1;
+        cluster_view.eye = glm::vec3(glm::inverse(view)[3]);
+        cluster_view.cones = cones;
+        return cluster_view;
+    }
+};
+
+// indices of the visible meshlets of a pass, compacted into one index buffer that the draws use instead of the index
+// buffers of their meshes (Mesh::DrawRange)
+//
+// usage per pass: Begin, Add for every drawn mesh (keeping the returned ranges), Upload, then draw with the ranges
+// meshes without clusters (no meshlets or no indices on the CPU, see MESH_RETAIN_INDICES) and levels of a single meshlet
+// are not culled, their range is the level in their own index buffer
+class ClusterStream
+{
+public:
+
+    void Create()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    GLuint Id() const { return buffer; }
+
+    void Begin(RenderPass pass)
+    {
+        indices.clear();
+        this->pass = pass;
+        stats[pass].passes++;
+    }
+
+    // culls the meshlets of level lod of a mesh placed with transform and appends the indices of the visible ones
+    IndexRange Add(const Mesh & mesh, unsigned int lod, const glm::mat4 & transform, const ClusterView & view)
+    {
+        const MeshLod & level = mesh.Lods()[lod];
+        IndexRange range = mesh.LodRange(lod);
+        if (!mesh.HasClusters() || level.meshlet_count < 2)
+            return range;
+
+        // the planes and the eye go into object space, so the meshlet bounds are tested as they are stored
+        // (a plane p of the world is transpose(transform) * p in object space)
+        glm::mat4 to_object = glm::transpose(transform);
+        glm::vec4 planes[6 * 6];
+        unsigned int plane_count = 6 * view.frustum_count;
+        for (unsigned int f = 0; f < view.frustum_count; f++)
+            for (int p = 0; p < 6; p++)
+            {
+                glm::vec4 plane = to_object * view.frustums[f].planes[p];
+                planes[6 * f + p] = plane / glm::length(glm::vec3(plane));
+            }
+        glm::vec3 eye = glm::vec3(glm::inverse(transform) * glm::vec4(view.eye, 1.0f));
+
+        PassStats & pass_stats = stats[pass];
+        const vector<Meshlet> & meshlets = mesh.Meshlets();
+        const vector<GLuint> & source = mesh.Indices();
+        range.buffer = buffer;
+        range.first_index = (GLuint)indices.size();
+        for (GLuint m = level.first_meshlet; m < level.first_meshlet + level.meshlet_count; m++)
+        {
+            const Meshlet & meshlet = meshlets[m];
+            pass_stats.clusters++;
+            pass_stats.triangles += meshlet.index_count / 3;
+
+            bool inside = false;
+            for (unsigned int p = 0; p < plane_count && !inside; p += 6)
+            {
+                inside = true;
+                for (unsigned int i = p; i < p + 6 && inside; i++)
+                    inside = glm::dot(glm::vec3(planes[i]), meshlet.center) + planes[i].w + meshlet.radius >= 0.0f;
+            }
+            if (!inside)
+            {
+                pass_stats.frustum_culled++;
+                continue;
+            }
+
+            glm::vec3 to_center = meshlet.center - eye;
+            if (view.cones && glm::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius)
+            {
+                pass_stats.cone_culled++;
+                continue;
+            }
+
+            indices.insert(indices.end(), source.begin() + meshlet.first_index, source.begin() + meshlet.first_index + meshlet.index_count);
+            pass_stats.drawn_triangles += meshlet.index_count / 3;
+        }
+        range.index_count = (GLsizei)(indices.size() - range.first_index);
+        return range;
+    }
+
+    // replaces the buffer storage (orphaning it, so the draws of the previous pass are not waited for)
+    // the upload goes through GL_COPY_WRITE_BUFFER, binding GL_ELEMENT_ARRAY_BUFFER would change the bound vertex array
+    void Upload()
+    {
+        if (indices.empty())
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    void PrintReport() const
+    {
+        for (int pass = 0; pass < RENDER_PASS_COUNT; pass++)
+        {
+            const PassStats & pass_stats = stats[pass];
+            if (pass_stats.passes == 0)
+                continue;
+            double per_pass = 1.0 / pass_stats.passes;
+            double percent = pass_stats.clusters ? 100.0 / pass_stats.clusters : 0.0;
+            cout << "MESHLET:: " << RenderPassName((RenderPass)pass) << ": " << pass_stats.clusters * per_pass << " clusters tested per pass, "
+                 << pass_stats.frustum_culled * percent << "% frustum culled, " << pass_stats.cone_culled * percent << "% back facing, "
+                 << pass_stats.drawn_triangles * per_pass << " of " << pass_stats.triangles * per_pass << " triangles drawn ("
+                 << pass_stats.passes << " passes)" << endl;
+        }
+    }
+
+private:
+
+    struct PassStats
+    {
+        unsigned long long passes = 0, clusters = 0, frustum_culled = 0, cone_culled = 0, triangles = 0, drawn_triangles = 0;
+    };
+
+    GLuint buffer = 0;
+    vector<GLuint> indices;
+    RenderPass pass = RENDER_PASS_MAIN;
+    PassStats stats[RENDER_PASS_COUNT];
+};
+
+#endif
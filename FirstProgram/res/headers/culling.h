@@ -0,0 +1,236 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// SSE is part of every x64 target and of the x86 targets built with /arch:SSE or later (the default since VS 2012)
+#if !defined(NO_CULLING_SSE) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "Model.h"
+#include "mesh_lod.h"
+
+using namespace std;
+
+// the six planes of a view frustum, normals point inside and are normalized (so plane distances are world units)
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // planes of the clip volume of a projection * view matrix (Gribb / Hartmann)
+    static Frustum FromMatrix(const glm::mat4 & m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+        for (glm::vec4 & plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+};
+
+// largest axis scale of a transform, scales object space lengths (radii, errors) conservatively into the world
+float TransformScale(const glm::mat4 & transform)
+{
+    return max(glm::length(glm::vec3(transform[0])), max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+}
+
+// bounding spheres in structure of arrays layout, so four of them are tested against a plane with one SSE operation
+// the arrays are padded to a multiple of four with empty spheres
+class SphereArray
+{
+public:
+    vector<float> x, y, z, radius;
+
+    size_t Size() const { return count; }
+
+    void Clear()
+    {
+        count = 0;
+        x.clear(); y.clear(); z.clear(); radius.clear();
+    }
+
+    size_t Add(const glm::vec3 & center, float r)
+    {
+        if (count % 4 == 0)
+        {
+            x.resize(count + 4, 0.0f); y.resize(count + 4, 0.0f); z.resize(count + 4, 0.0f);
+            // padding spheres lie outside of every frustum
+            radius.resize(count + 4, -1.0e30f);
+        }
+        x[count] = center.x; y[count] = center.y; z[count] = center.z; radius[count] = r;
+        return count++;
+    }
+
+    // world space sphere of an object space sphere under transform (non-uniform scale takes the largest axis)
+    size_t Add(const glm::mat4 & transform, const glm::vec3 & center, float r)
+    {
+        return Add(glm::vec3(transform * glm::vec4(center, 1.0f)), r * TransformScale(transform));
+    }
+
+    // visible[i] = 1 if sphere i intersects the frustum (it is not completely behind any plane), 0 otherwise
+    void Cull(const Frustum & frustum, unsigned char * visible) const
+    {
+#ifdef CULLING_SSE
+        __m128 px[6], py[6], pz[6], pw[6];
+        for (int p = 0; p < 6; p++)
+        {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        __m128 zero = _mm_setzero_ps();
+        for (size_t i = 0; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&x[i]), cy = _mm_loadu_ps(&y[i]), cz = _mm_loadu_ps(&z[i]), r = _mm_loadu_ps(&radius[i]);
+            __m128 inside = _mm_cmpge_ps(r, zero);
+            for (int p = 0; p < 6; p++)
+            {
+                // distance + radius >= 0 for all planes
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)), _mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, r), zero));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (size_t lane = 0; lane < 4 && i + lane < count; lane++)
+                visible[i + lane] = (unsigned char)((mask >> lane) & 1);
+        }
+#else
+        for (size_t i = 0; i < count; i++)
+        {
+            bool inside = radius[i] >= 0.0f;
+            for (int p = 0; p < 6 && inside; p++)
+            {
+                const glm::vec4 & plane = frustum.planes[p];
+                inside = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w + radius[i] >= 0.0f;
+            }
+            visible[i] = (unsigned char)inside;
+        }
+#endif
+    }
+
+private:
+    size_t count = 0;
+};
+
+
+// per-mesh visibility of the objects of a frame, for any number of views
+//
+// usage per frame: BeginFrame, AddObject for every object, then before drawing a view Cull(view, projection * view)
+// and skip objects with Visible(object) == false before setting any uniform or texture; SelectLods after Cull picks the
+// levels of detail of the visible meshes
+class SceneCuller
+{
+public:
+
+    // view_names gives the number of views and their names in the report
+    SceneCuller(const vector<string> & view_names) : view_names(view_names), stats(view_names.size()) {}
+
+    void BeginFrame()
+    {
+        spheres.Clear();
+        first_mesh.clear();
+        mesh_count.clear();
+        meshes.clear();
+        mesh_scale.clear();
+    }
+
+    // adds the mesh bounding spheres of a model placed with transform, returns the object index
+    size_t AddObject(const Model & model, const glm::mat4 & transform)
+    {
+        first_mesh.push_back(spheres.Size());
+        mesh_count.push_back(model.MeshCount());
+        float scale = TransformScale(transform);
+        for (size_t i = 0; i < model.MeshCount(); i++)
+        {
+            spheres.Add(transform, model.GetMesh(i).sphere_center, model.GetMesh(i).sphere_radius);
+            meshes.push_back(&model.GetMesh(i));
+            mesh_scale.push_back(scale);
+        }
+        return first_mesh.size() - 1;
+    }
+
+    void Cull(size_t view, const glm::mat4 & view_projection)
+    {
+        mesh_visible.resize(spheres.Size());
+        object_visible.assign(first_mesh.size(), 0);
+        if (!mesh_visible.empty())
+            spheres.Cull(Frustum::FromMatrix(view_projection), &mesh_visible[0]);
+
+        size_t visible = 0;
+        for (size_t object = 0; object < first_mesh.size(); object++)
+            for (size_t i = 0; i < mesh_count[object]; i++)
+                if (mesh_visible[first_mesh[object] + i])
+                {
+                    object_visible[object] = 1;
+                    visible++;
+                }
+
+        stats[view].passes++;
+        stats[view].visible += visible;
+        stats[view].culled += mesh_visible.size() - visible;
+    }
+
+    // level of detail of every visible mesh of the last Cull for the camera of view (see SelectLod)
+    void SelectLods(const LodView & view)
+    {
+        mesh_lod.assign(spheres.Size(), 0);
+        for (size_t i = 0; i < mesh_lod.size(); i++)
+            if (mesh_visible[i])
+                mesh_lod[i] = SelectLod(meshes[i]->Lods(), view, glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i], mesh_scale[i]);
+    }
+
+    // true if at least one mesh of the object is inside the frustum of the last Cull
+    bool Visible(size_t object) const { return object_visible[object] != 0; }
+
+    // visibility of the meshes of an object (for Model::DrawVisible)
+    const unsigned char * MeshVisibility(size_t object) const { return &mesh_visible[first_mesh[object]]; }
+
+    // levels of detail of the meshes of an object from the last SelectLods (for Model::DrawVisible)
+    const unsigned char * MeshLods(size_t object) const { return &mesh_lod[first_mesh[object]]; }
+
+    // visible and culled meshes per pass of a view
+    double AverageVisible(size_t view) const { return stats[view].passes ? (double)stats[view].visible / stats[view].passes : 0.0; }
+    double AverageCulled(size_t view) const { return stats[view].passes ? (double)stats[view].culled / stats[view].passes : 0.0; }
+
+    void PrintReport() const
+    {
+        for (size_t view = 0; view < view_names.size(); view++)
+            cout << "CULLING:: " << view_names[view] << ": visible meshes = " << AverageVisible(view)
+                 << ", culled meshes = " << AverageCulled(view) << " (per pass, " << stats[view].passes << " passes)" << endl;
+    }
+
+private:
+
+    struct ViewStats
+    {
+        unsigned long long passes = 0, visible = 0, culled = 0;
+    };
+
+    vector<string> view_names;
+    vector<ViewStats> stats;
+
+    SphereArray spheres;
+    vector<size_t> first_mesh, mesh_count;
+    vector<unsigned char> mesh_visible, object_visible, mesh_lod;
+    vector<const Mesh *> meshes;
+    vector<float> mesh_scale;
+};
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "benchmark.h"
+#include "culling.h"
+#include "gl_state.h"
+#include "pass_timer.h"
+#include "shader.h"
+
+using namespace std;
+
+// point light of the deferred path: no shadow, its light fades out to nothing at radius
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float padding;
+};
+
+// the scene light (with the shadow cubemap) and any number of point lights, shaded once per pixel from a G-buffer
+//
+// G-buffer, 14 bytes per pixel:
+//   albedo    GL_RGBA8            diffuse color, ambient strength in alpha
+//   normal    GL_RG16             world normal, octahedral encoding mapped to [0, 1]
+//   material  GL_RG8              specular strength, shininess / 255
+//   depth     GL_DEPTH24_STENCIL8 the world position is reconstructed from it
+//
+// usage per frame: BeginGeometry, draw the lit materials with their G-buffer programs (normal and parallax mapping happen
+// there, once per pixel), Light into the target framebuffer (the depth is copied into it, so the materials the
+// G-buffer does not hold, e.g. the environment mapped ones and the skybox, are drawn forward afterwards)
+//
+// Light draws a fullscreen triangle for the scene light, then a sphere per point light (instanced, only the ones in
+// the view frustum) with its back faces and the depth test reversed, so only the pixels in front of the back of a
+// sphere are shaded, also with the camera inside of it
+class DeferredRenderer
+{
+public:
+
+    // Light copies the depth with glBlitFramebuffer, which needs the same depth format on both sides, so the target
+    // has to have a 24 bit fixed point depth and an 8 bit stencil buffer (the window only requests them)
+    static bool CanLightInto(GLuint target)
+    {
+        GLenum depth = target ? GL_DEPTH_ATTACHMENT : GL_DEPTH, stencil = target ? GL_STENCIL_ATTACHMENT : GL_STENCIL;
+        GLint object_type = GL_NONE, depth_bits = 0, stencil_bits = 0, depth_type = GL_NONE;
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &object_type);
+        if (object_type != GL_NONE)
+        {
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depth, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &depth_type);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, stencil, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return depth_bits == 24 && stencil_bits == 8 && depth_type == GL_UNSIGNED_NORMALIZED;
+    }
+
+    void Create(Shader * light_shader, Shader * point_light_shader)
+    {
+        this->light_shader = light_shader;
+        this->point_light_shader = point_light_shader;
+        light_inverse_view_projection = light_shader->uniform<glm::mat4>("inverse_view_projection");
+        point_inverse_view_projection = point_light_shader->uniform<glm::mat4>("inverse_view_projection");
+        point_screen_size = point_light_shader->uniform<glm::vec2>("screen_size");
+
+        glGenFramebuffers(1, &FBO);
+        glGenTextures(GBUFFER_TEXTURES, textures);
+
+        // the fullscreen triangle is made from gl_VertexID, the core profile still wants a vertex array
+        glGenVertexArrays(1, &fullscreen_VAO);
+
+        vector<glm::vec3> vertices;
+        vector<GLuint> indices;
+        LightVolume(vertices, indices);
+        volume_index_count = (GLsizei)indices.size();
+        glGenVertexArrays(1, &volume_VAO);
+        glGenBuffers(1, &volume_VBO);
+        glGenBuffers(1, &volume_EBO);
+        glGenBuffers(1, &light_buffer);
+        GLStateCache::Get().BindVertexArray(volume_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, volume_VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, volume_EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+        // per light: position and radius, color
+        glBindBuffer(GL_ARRAY_BUFFER, light_buffer);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void *)offsetof(PointLight, position));
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void *)offsetof(PointLight, color));
+        glVertexAttribDivisor(2, 1);
+        GLStateCache::Get().BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // count lights scattered over the table, the first ones stay the same when the count changes
+    void SetLightCount(size_t count)
+    {
+        while (base_lights.size() < count)
+        {
+            BaseLight light;
+            light.position = glm::vec3(Random(-10.0f, 12.0f), Random(0.5f, 3.0f), Random(-13.0f, 8.0f));
+            light.radius = Random(2.0f, 4.0f);
+            light.color = Hue(Random(0.0f, 1.0f)) * 1.5f;
+            light.orbit = Random(0.5f, 2.0f);
+            light.speed = Random(-1.5f, 1.5f);
+            light.phase = Random(0.0f, 6.2831853f);
+            base_lights.push_back(light);
+        }
+        light_count = count;
+    }
+
+    size_t LightCount() const { return light_count; }
+
+    // moves the lights on their circles to time (in seconds)
+    void Animate(float time)
+    {
+        lights.resize(light_count);
+        for (size_t i = 0; i < light_count; i++)
+        {
+            const BaseLight & base = base_lights[i];
+            float angle = base.phase + base.speed * time;
+            lights[i].position = base.position + glm::vec3(cos(angle) * base.orbit, 0.25f * sin(2.0f * angle), sin(angle) * base.orbit);
+            lights[i].radius = base.radius;
+            lights[i].color = base.color;
+            lights[i].padding = 0.0f;
+        }
+    }
+
+    // binds the G-buffer (allocated again when the size changed) and clears it
+    void BeginGeometry(GLuint width, GLuint height)
+    {
+        if (width != this->width || height != this->height)
+            Allocate(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // shades the G-buffer into target (its color is replaced where the G-buffer has a surface, its depth everywhere);
+    // the Camera, Light and shadow cubemap of the frame have to be bound already
+    void Light(GLuint target, const glm::mat4 & view_projection, GLuint depth_cubemap)
+    {
+        frames++;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+        GLStateCache & state = GLStateCache::Get();
+        state.BindTexture(GBUFFER_ALBEDO_TEXTURE_UNIT, GL_TEXTURE_2D, textures[ALBEDO]);
+        state.BindTexture(GBUFFER_NORMAL_TEXTURE_UNIT, GL_TEXTURE_2D, textures[NORMAL]);
+        state.BindTexture(GBUFFER_MATERIAL_TEXTURE_UNIT, GL_TEXTURE_2D, textures[MATERIAL]);
+        state.BindTexture(GBUFFER_DEPTH_TEXTURE_UNIT, GL_TEXTURE_2D, textures[DEPTH]);
+        state.BindTexture(SHADOW_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, depth_cubemap);
+        glm::mat4 inverse_view_projection = glm::inverse(view_projection);
+        glDepthMask(GL_FALSE);
+
+        // the scene light writes every pixel with a surface, the background stays for the skybox
+        light_shader->use();
+        light_inverse_view_projection.set(inverse_view_projection);
+        state.BindVertexArray(fullscreen_VAO);
+        glDisable(GL_DEPTH_TEST);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glEnable(GL_DEPTH_TEST);
+
+        // the point lights in the view frustum add up on top of it
+        Frustum frustum = Frustum::FromMatrix(view_projection);
+        visible_lights.clear();
+        for (const PointLight & light : lights)
+        {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++)
+                inside = glm::dot(glm::vec3(frustum.planes[p]), light.position) + frustum.planes[p].w >= -light.radius * volume_scale;
+            if (inside)
+                visible_lights.push_back(light);
+        }
+        drawn_lights += visible_lights.size();
+        if (!visible_lights.empty())
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, light_buffer);
+            glBufferData(GL_ARRAY_BUFFER, visible_lights.size() * sizeof(PointLight), &visible_lights[0], GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            point_light_shader->use();
+            point_inverse_view_projection.set(inverse_view_projection);
+            point_screen_size.set(glm::vec2((float)width, (float)height));
+            state.BindVertexArray(volume_VAO);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
+            state.DepthFunc(GL_GEQUAL);
+            glDrawElementsInstanced(GL_TRIANGLES, volume_index_count, GL_UNSIGNED_INT, 0, (GLsizei)visible_lights.size());
+            state.DepthFunc(GL_LESS);
+            glCullFace(GL_BACK);
+            glDisable(GL_CULL_FACE);
+            glDisable(GL_BLEND);
+        }
+        glDepthMask(GL_TRUE);
+    }
+
+    void PrintReport() const
+    {
+        cout << "DEFERRED:: " << width << "x" << height << " G-buffer (" << width * height * 14 / 1024 << " KB), " << light_count
+             << " point lights, " << (frames ? (double)drawn_lights / frames : 0.0) << " drawn per frame on average (in the view frustum)" << endl;
+    }
+
+    void Destroy()
+    {
+        if (FBO == 0)
+            return;
+        GLStateCache & state = GLStateCache::Get();
+        for (GLuint texture : textures)
+            state.ForgetTexture(texture);
+        state.ForgetVertexArray(fullscreen_VAO);
+        state.ForgetVertexArray(volume_VAO);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(GBUFFER_TEXTURES, textures);
+        glDeleteVertexArrays(1, &fullscreen_VAO);
+        glDeleteVertexArrays(1, &volume_VAO);
+        glDeleteBuffers(1, &volume_VBO);
+        glDeleteBuffers(1, &volume_EBO);
+        glDeleteBuffers(1, &light_buffer);
+        FBO = fullscreen_VAO = volume_VAO = volume_VBO = volume_EBO = light_buffer = 0;
+    }
+
+private:
+
+    enum GBufferTexture { ALBEDO = 0, NORMAL, MATERIAL, DEPTH, GBUFFER_TEXTURES };
+
+    // a light placed by SetLightCount, circling around its position
+    struct BaseLight
+    {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+        float orbit, speed, phase;
+    };
+
+    Shader * light_shader = NULL;
+    Shader * point_light_shader = NULL;
+    Uniform<glm::mat4> light_inverse_view_projection, point_inverse_view_projection;
+    Uniform<glm::vec2> point_screen_size;
+
+    GLuint width = 0, height = 0;
+    GLuint FBO = 0;
+    GLuint textures[GBUFFER_TEXTURES] = {};
+    GLuint fullscreen_VAO = 0, volume_VAO = 0, volume_VBO = 0, volume_EBO = 0, light_buffer = 0;
+    GLsizei volume_index_count = 0;
+    // the volume around the unit sphere reaches up to this far from its center
+    float volume_scale = 1.0f;
+
+    vector<BaseLight> base_lights;
+    vector<PointLight> lights, visible_lights;
+    size_t light_count = 0;
+    unsigned int random_state = 12345;
+    unsigned long long frames = 0, drawn_lights = 0;
+
+    void Allocate(GLuint width, GLuint height)
+    {
+        this->width = width;
+        this->height = height;
+        struct { GLenum internal_format, format, type, attachment; } formats[GBUFFER_TEXTURES] = {
+            { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0 },
+            { GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_COLOR_ATTACHMENT1 },
+            { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT2 },
+            { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT }
+        };
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        for (int i = 0; i < GBUFFER_TEXTURES; i++)
+        {
+            // the G-buffer is read texel by texel, nothing is filtered
+            GLStateCache::Get().BindTexture(GBUFFER_ALBEDO_TEXTURE_UNIT + i, GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i].internal_format, width, height, 0, formats[i].format, formats[i].type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, formats[i].attachment, GL_TEXTURE_2D, textures[i], 0);
+        }
+        GLenum draw_buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, draw_buffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAMEBUFFER:: G-buffer is not complete!" << endl;
+    }
+
+    // icosahedron with every triangle split into four (80 triangles, counter-clockwise seen from outside), its vertices
+    // pushed out so that its faces enclose the unit sphere
+    void LightVolume(vector<glm::vec3> & vertices, vector<GLuint> & indices)
+    {
+        const float t = (1.0f + sqrt(5.0f)) / 2.0f;
+        vertices = {
+            glm::vec3(-1, t, 0), glm::vec3(1, t, 0), glm::vec3(-1, -t, 0), glm::vec3(1, -t, 0),
+            glm::vec3(0, -1, t), glm::vec3(0, 1, t), glm::vec3(0, -1, -t), glm::vec3(0, 1, -t),
+            glm::vec3(t, 0, -1), glm::vec3(t, 0, 1), glm::vec3(-t, 0, -1), glm::vec3(-t, 0, 1)
+        };
+        const GLuint faces[20][3] = {
+            { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 }, { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+            { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 }, { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+        };
+        for (glm::vec3 & vertex : vertices)
+            vertex = glm::normalize(vertex);
+        indices.clear();
+        for (const GLuint * face : faces)
+        {
+            GLuint middle[3];
+            for (int e = 0; e < 3; e++)
+            {
+                middle[e] = (GLuint)vertices.size();
+                vertices.push_back(glm::normalize(vertices[face[e]] + vertices[face[(e + 1) % 3]]));
+            }
+            GLuint split[4][3] = {
+                { face[0], middle[0], middle[2] }, { face[1], middle[1], middle[0] }, { face[2], middle[2], middle[1] }, { middle[0], middle[1], middle[2] }
+            };
+            for (const GLuint * triangle : split)
+                indices.insert(indices.end(), triangle, triangle + 3);
+        }
+
+        // the closest face plane decides how far the vertices have to go out
+        float closest = 1.0f;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 a = vertices[indices[i]], b = vertices[indices[i + 1]], c = vertices[indices[i + 2]];
+            closest = min(closest, glm::dot(glm::normalize(glm::cross(b - a, c - a)), a));
+        }
+        volume_scale = 1.0f / closest;
+        for (glm::vec3 & vertex : vertices)
+            vertex *= volume_scale;
+    }
+
+    // deterministic placement, the same lights in every run
+    float Random(float low, float high)
+    {
+        random_state = random_state * 1664525u + 1013904223u;
+        return low + (high - low) * (random_state >> 8) / 16777216.0f;
+    }
+
+    static glm::vec3 Hue(float hue)
+    {
+        glm::vec3 color = glm::abs(glm::fract(glm::vec3(hue) + glm::vec3(1.0f, 2.0f / 3.0f, 1.0f / 3.0f)) * 6.0f - 3.0f) - 1.0f;
+        return glm::clamp(color, 0.0f, 1.0f);
+    }
+};
+
+// --light-sweep: after the warmup the benchmark runs frames frames with 1 point light, then with 2, 4 ... up to 1024,
+// the camera path starts over in every step, so the steps see the same frames
+struct LightSweep
+{
+    static const int STEPS = 11;
+
+    int warmup = 0, frames = 1;
+
+    int TotalFrames() const { return warmup + STEPS * frames; }
+    int Step(int frame) const { return frame < warmup ? 0 : min(STEPS - 1, (frame - warmup) / frames); }
+    size_t LightCount(int frame) const { return (size_t)1 << Step(frame); }
+
+    // position on the camera path (the warmup runs along it once)
+    float PathTime(int frame) const
+    {
+        int step_frame = frame < warmup ? frame * frames / max(1, warmup) : (frame - warmup) % frames;
+        return (float)step_frame / (float)max(1, frames - 1);
+    }
+
+    // gpu ms of the G-buffer and the lighting (pass timer) and of the whole frame (frame timer, the passes nest) per light count
+    void PrintReport(const PassTimer & timer, const FrameTimer & frame_timer) const
+    {
+        double gbuffer[STEPS] = {}, lighting[STEPS] = {}, total[STEPS] = {};
+        int counts[STEPS] = {}, frame_counts[STEPS] = {};
+        for (const PassTimer::Sample & sample : timer.History())
+        {
+            if (sample.frame < warmup)
+                continue;
+            int step = Step(sample.frame);
+            gbuffer[step] += sample.gpu_ms[TIMED_PASS_GBUFFER];
+            lighting[step] += sample.gpu_ms[TIMED_PASS_LIGHTING];
+            counts[step]++;
+        }
+        for (const FrameTimer::Sample & sample : frame_timer.Samples())
+        {
+            if (sample.frame < warmup)
+                continue;
+            total[Step(sample.frame)] += sample.gpu_ms;
+            frame_counts[Step(sample.frame)]++;
+        }
+        for (int step = 0; step < STEPS; step++)
+        {
+            if (counts[step] == 0)
+                continue;
+            cout << "LIGHT_SWEEP:: " << (1 << step) << " lights: gbuffer gpu ms = " << gbuffer[step] / counts[step] << ", lighting gpu ms = "
+                 << lighting[step] / counts[step] << ", frame gpu ms = " << (frame_counts[step] ? total[step] / frame_counts[step] : 0.0)
+                 << " (" << counts[step] << " frames)" << endl;
+        }
+    }
+};
+
+#endif
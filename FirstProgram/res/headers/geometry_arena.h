@@ -0,0 +1,175 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "gl_state.h"
+#include "vertex_format.h"
+
+using namespace std;
+
+// place of a mesh in the shared buffers of its vertex format
+// the indices stay relative to the first vertex of the mesh, the draws add base_vertex
+struct ArenaAllocation
+{
+    GLuint vertex_array;
+    GLint base_vertex;
+    GLuint first_index;
+};
+
+// one draw of glMultiDrawElementsIndirect (the layout the GL reads from GL_DRAW_INDIRECT_BUFFER), also replayed one by one
+// with glDrawElementsInstancedBaseVertex where the GL has no indirect draws (see MultiDrawList)
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+// the vertex and index buffers of all meshes, one vertex array with one vertex and one index buffer per vertex format,
+// so draws of different meshes of a format share all vertex state (and can be submitted together, see MultiDrawList)
+//
+// meshes are appended and never freed on their own, the buffers grow by doubling (copied on the GPU); the vertex array
+// stays the same, only its buffers are replaced, so meshes keep it but ask for the index buffer (IndexBuffer)
+class GeometryArena
+{
+public:
+
+    static GeometryArena & Get()
+    {
+        static GeometryArena arena;
+        return arena;
+    }
+
+    // meshes created while the arena is enabled are placed in it (see Mesh)
+    void SetEnabled(bool enabled) { this->enabled = enabled; }
+    bool Enabled() const { return enabled; }
+
+    // copies vertex_count vertices of format (vertex_data holds them in that layout) and the indices into the buffers
+    ArenaAllocation Add(VertexFormat format, const void * vertex_data, size_t vertex_count, const GLuint * indices, size_t index_count)
+    {
+        Pool & pool = pools[format];
+        size_t stride = VertexStride(format);
+        Reserve(pool, format, pool.vertex_count + vertex_count, pool.index_count + index_count);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, pool.vertex_count * stride, vertex_count * stride, vertex_data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, pool.index_count * sizeof(GLuint), index_count * sizeof(GLuint), indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        ArenaAllocation allocation = { pool.VAO, (GLint)pool.vertex_count, (GLuint)pool.index_count };
+        pool.vertex_count += vertex_count;
+        pool.index_count += index_count;
+        pool.meshes++;
+        return allocation;
+    }
+
+    GLuint IndexBuffer(VertexFormat format) const { return pools[format].EBO; }
+
+    void PrintReport() const
+    {
+        for (int format = 0; format < FORMAT_COUNT; format++)
+        {
+            const Pool & pool = pools[format];
+            if (pool.VAO == 0)
+                continue;
+            size_t stride = VertexStride((VertexFormat)format);
+            cout << "GEOMETRY_ARENA:: " << VertexFormatName((VertexFormat)format) << " vertices: " << pool.meshes << " meshes, "
+                 << pool.vertex_count << " of " << pool.vertex_capacity << " vertices, " << pool.index_count << " of " << pool.index_capacity
+                 << " indices, " << (pool.vertex_capacity * stride + pool.index_capacity * sizeof(GLuint)) / 1024 << " KiB, "
+                 << pool.grows << " grows" << endl;
+        }
+    }
+
+    // deletes the buffers while the context is still current (after the meshes)
+    void Destroy()
+    {
+        for (Pool & pool : pools)
+        {
+            if (pool.VAO == 0)
+                continue;
+            GLStateCache::Get().ForgetVertexArray(pool.VAO);
+            glDeleteVertexArrays(1, &pool.VAO);
+            glDeleteBuffers(1, &pool.VBO);
+            glDeleteBuffers(1, &pool.EBO);
+            pool = Pool();
+        }
+    }
+
+private:
+
+    static const int FORMAT_COUNT = 2;
+    // first capacity of a pool, in vertices and indices
+    static const size_t INITIAL_CAPACITY = 1 << 16;
+
+    struct Pool
+    {
+        GLuint VAO = 0, VBO = 0, EBO = 0;
+        size_t vertex_count = 0, vertex_capacity = 0;
+        size_t index_count = 0, index_capacity = 0;
+        size_t meshes = 0, grows = 0;
+    };
+
+    bool enabled = false;
+    Pool pools[FORMAT_COUNT];
+
+    GeometryArena() {}
+
+    // grows the buffers of a pool to hold at least vertex_count vertices and index_count indices
+    void Reserve(Pool & pool, VertexFormat format, size_t vertex_count, size_t index_count)
+    {
+        if (pool.VAO != 0 && vertex_count <= pool.vertex_capacity && index_count <= pool.index_capacity)
+            return;
+        if (pool.VAO == 0)
+            glGenVertexArrays(1, &pool.VAO);
+        else
+            pool.grows++;
+
+        size_t stride = VertexStride(format);
+        if (vertex_count > pool.vertex_capacity)
+        {
+            size_t capacity = max(vertex_count, max(2 * pool.vertex_capacity, INITIAL_CAPACITY));
+            pool.VBO = Grow(pool.VBO, pool.vertex_count * stride, capacity * stride);
+            pool.vertex_capacity = capacity;
+        }
+        if (index_count > pool.index_capacity)
+        {
+            size_t capacity = max(index_count, max(2 * pool.index_capacity, INITIAL_CAPACITY));
+            pool.EBO = Grow(pool.EBO, pool.index_count * sizeof(GLuint), capacity * sizeof(GLuint));
+            pool.index_capacity = capacity;
+        }
+
+        // the attribute pointers and the element buffer binding of the vertex array refer to the buffers they were set with
+        GLStateCache::Get().BindVertexArray(pool.VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+        SetVertexAttributes(format);
+        GLStateCache::Get().BindVertexArray(0);
+    }
+
+    // new buffer of capacity bytes holding the first used bytes of buffer (which is deleted)
+    GLuint Grow(GLuint buffer, size_t used, size_t capacity)
+    {
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+        if (buffer != 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return grown;
+    }
+};
+
+#endif
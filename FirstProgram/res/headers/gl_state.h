@@ -0,0 +1,212 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// true if the current context exposes the extension (core profile: glGetStringi)
+bool HasGLExtension(const char * name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    return false;
+}
+
+// shadow copy of the GL state that changes between draws (program, vertex array, textures per unit, depth function,
+// uniform buffer ranges of the bindings that are only bound through it),
+// so calls that would set the value that is already current are dropped
+//
+// the copy is only right while every change of that state goes through this class: Invalidate() forgets it,
+// call it after code that binds objects directly (loading, resizing) and at the start of every frame
+class GLStateCache
+{
+public:
+
+    enum CallType
+    {
+        USE_PROGRAM_CALL = 0,
+        BIND_VERTEX_ARRAY_CALL,
+        ACTIVE_TEXTURE_CALL,
+        BIND_TEXTURE_CALL,
+        DEPTH_FUNC_CALL,
+        BIND_BUFFER_RANGE_CALL,
+        CALL_TYPE_COUNT
+    };
+
+    static const GLuint MAX_TEXTURE_UNITS = 32;
+    static const GLuint MAX_UNIFORM_BINDINGS = 8;
+
+    // the context of the process (the program has a single one)
+    static GLStateCache & Get()
+    {
+        static GLStateCache state;
+        return state;
+    }
+
+    // false issues every call (to measure the calls and frame time without the cache)
+    void SetFiltering(bool enabled)
+    {
+        filtering = enabled;
+        Invalidate();
+    }
+
+    void Invalidate()
+    {
+        program = vertex_array = UNKNOWN;
+        active_unit = UNKNOWN;
+        depth_func = UNKNOWN;
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+            texture_2d[unit] = texture_cube[unit] = UNKNOWN;
+        for (GLuint binding = 0; binding < MAX_UNIFORM_BINDINGS; binding++)
+            uniform_buffer[binding] = UNKNOWN;
+    }
+
+    // counts a frame for the report and forgets the state changed outside of the cache since the last frame
+    void BeginFrame()
+    {
+        frames++;
+        Invalidate();
+    }
+
+    void UseProgram(GLuint id)
+    {
+        if (Request(USE_PROGRAM_CALL, program, id))
+            glUseProgram(id);
+    }
+
+    void BindVertexArray(GLuint id)
+    {
+        if (Request(BIND_VERTEX_ARRAY_CALL, vertex_array, id))
+            glBindVertexArray(id);
+    }
+
+    // binds texture to target of unit, the active unit is only switched when the binding changes
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        GLuint * binding = unit < MAX_TEXTURE_UNITS ? (target == GL_TEXTURE_2D ? &texture_2d[unit] : target == GL_TEXTURE_CUBE_MAP ? &texture_cube[unit] : NULL) : NULL;
+        GLuint untracked = UNKNOWN;
+        if (!binding)
+            binding = &untracked;
+
+        calls[BIND_TEXTURE_CALL].requested++;
+        calls[ACTIVE_TEXTURE_CALL].requested++;
+        if (filtering && *binding == texture)
+            return;
+        *binding = texture;
+
+        if (!filtering || active_unit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            active_unit = unit;
+            calls[ACTIVE_TEXTURE_CALL].issued++;
+        }
+        glBindTexture(target, texture);
+        calls[BIND_TEXTURE_CALL].issued++;
+    }
+
+    // binds a range of buffer to a uniform block binding point, bindings that are also bound directly
+    // (UniformBuffer::Bind) must not use this
+    void BindUniformBufferRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        calls[BIND_BUFFER_RANGE_CALL].requested++;
+        bool tracked = binding < MAX_UNIFORM_BINDINGS;
+        if (filtering && tracked && uniform_buffer[binding] == buffer && uniform_offset[binding] == offset)
+            return;
+        if (tracked)
+        {
+            uniform_buffer[binding] = buffer;
+            uniform_offset[binding] = offset;
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+        calls[BIND_BUFFER_RANGE_CALL].issued++;
+    }
+
+    // glGen* hands out deleted names again, so the bindings of a deleted object must not be kept
+    void ForgetVertexArray(GLuint id)
+    {
+        if (vertex_array == id)
+            vertex_array = UNKNOWN;
+    }
+
+    void ForgetTexture(GLuint id)
+    {
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+        {
+            if (texture_2d[unit] == id)
+                texture_2d[unit] = UNKNOWN;
+            if (texture_cube[unit] == id)
+                texture_cube[unit] = UNKNOWN;
+        }
+    }
+
+    void ForgetUniformBuffer(GLuint id)
+    {
+        for (GLuint binding = 0; binding < MAX_UNIFORM_BINDINGS; binding++)
+            if (uniform_buffer[binding] == id)
+                uniform_buffer[binding] = UNKNOWN;
+    }
+
+    void DepthFunc(GLenum func)
+    {
+        if (Request(DEPTH_FUNC_CALL, depth_func, func))
+            glDepthFunc(func);
+    }
+
+    // calls per frame that were requested (what is issued without the cache) and issued
+    void PrintReport() const
+    {
+        static const char * names[CALL_TYPE_COUNT] = { "glUseProgram", "glBindVertexArray", "glActiveTexture", "glBindTexture", "glDepthFunc", "glBindBufferRange" };
+        double per_frame = frames ? 1.0 / frames : 0.0;
+        unsigned long long requested = 0, issued = 0;
+        for (int type = 0; type < CALL_TYPE_COUNT; type++)
+        {
+            cout << "GL_STATE:: " << names[type] << ": requested = " << calls[type].requested * per_frame
+                 << ", issued = " << calls[type].issued * per_frame << " per frame" << endl;
+            requested += calls[type].requested;
+            issued += calls[type].issued;
+        }
+        cout << "GL_STATE:: state calls per frame: " << requested * per_frame << " requested, " << issued * per_frame << " issued ("
+             << (requested ? 100.0 * (requested - issued) / requested : 0.0) << "% dropped)" << (filtering ? "" : ", filtering off") << endl;
+    }
+
+private:
+
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    struct CallCount
+    {
+        unsigned long long requested = 0, issued = 0;
+    };
+
+    bool filtering = true;
+    unsigned long long frames = 0;
+    CallCount calls[CALL_TYPE_COUNT];
+
+    GLuint program = UNKNOWN, vertex_array = UNKNOWN, active_unit = UNKNOWN;
+    GLenum depth_func = UNKNOWN;
+    GLuint texture_2d[MAX_TEXTURE_UNITS], texture_cube[MAX_TEXTURE_UNITS];
+    GLuint uniform_buffer[MAX_UNIFORM_BINDINGS];
+    GLintptr uniform_offset[MAX_UNIFORM_BINDINGS] = {};
+
+    GLStateCache() { Invalidate(); }
+
+    // counts the call, returns true if it has to be issued
+    bool Request(CallType type, GLuint & current, GLuint value)
+    {
+        calls[type].requested++;
+        if (filtering && current == value)
+            return false;
+        current = value;
+        calls[type].issued++;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <iostream>
+
+// EGL is used for headless rendering on Linux render nodes (works with Mesa llvmpipe, no display or GPU needed).
+// On Windows define HEADLESS_EGL explicitly and link against an EGL implementation (Mesa or ANGLE) to enable it.
+#if !defined(_WIN32) && !defined(NO_HEADLESS_EGL) && !defined(HEADLESS_EGL)
+#define HEADLESS_EGL
+#endif
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#endif
+
+// OpenGL 3.3 core context without any window (EGL surfaceless, or a 1x1 pbuffer when surfaceless is not supported)
+class HeadlessContext
+{
+public:
+
+    ~HeadlessContext() { Destroy(); }
+
+    bool Create()
+    {
+#ifdef HEADLESS_EGL
+        // prefer the surfaceless platform, so no display server and no DRM device is required
+        PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (eglGetPlatformDisplayEXT)
+            display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            std::cout << "ERROR::HEADLESS:: Failed to initialize EGL display" << std::endl;
+            return false;
+        }
+
+        const EGLint config_attribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint config_count = 0;
+        if (!eglChooseConfig(display, config_attribs, &config, 1, &config_count) || config_count == 0)
+        {
+            // the surfaceless platform may expose configs without any surface type
+            const EGLint surfaceless_attribs[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+            if (!eglChooseConfig(display, surfaceless_attribs, &config, 1, &config_count) || config_count == 0)
+            {
+                std::cout << "ERROR::HEADLESS:: No suitable EGL config" << std::endl;
+                return false;
+            }
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint context_attribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+        if (context == EGL_NO_CONTEXT)
+        {
+            std::cout << "ERROR::HEADLESS:: Failed to create OpenGL 3.3 core context" << std::endl;
+            return false;
+        }
+
+        // we render into our own framebuffer object, so the default surface is never used
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+            if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context))
+            {
+                std::cout << "ERROR::HEADLESS:: Failed to make the EGL context current" << std::endl;
+                return false;
+            }
+        }
+        return true;
+#else
+        std::cout << "ERROR::HEADLESS:: Headless rendering is not available in this build (define HEADLESS_EGL)" << std::endl;
+        return false;
+#endif
+    }
+
+    void Destroy()
+    {
+#ifdef HEADLESS_EGL
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(display, surface);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        surface = EGL_NO_SURFACE;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    // loader for glad (gladLoadGLLoader), same role as glfwGetProcAddress in the windowed mode
+    static void* GetProcAddress(const char* name)
+    {
+#ifdef HEADLESS_EGL
+        return (void*)eglGetProcAddress(name);
+#else
+        return NULL;
+#endif
+    }
+
+private:
+
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+
+// framebuffer that replaces the default (window) framebuffer in the headless mode
+class OffscreenTarget
+{
+public:
+    GLuint FBO = 0;
+    GLuint width = 0, height = 0;
+
+    bool Create(GLuint width, GLuint height)
+    {
+        this->width = width;
+        this->height = height;
+
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+        glGenRenderbuffers(1, &color_rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, color_rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rbo);
+
+        glGenRenderbuffers(1, &depth_rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_rbo);
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete)
+            std::cout << "ERROR::FRAMEBUFFER:: Offscreen framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    void Destroy()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &color_rbo);
+        glDeleteRenderbuffers(1, &depth_rbo);
+        FBO = color_rbo = depth_rbo = 0;
+    }
+
+private:
+    GLuint color_rbo = 0, depth_rbo = 0;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "meshlet.h"
+#include "scene.h"
+
+using namespace std;
+
+// layers of the batches of a view, drawn in this order
+enum DrawLayer
+{
+    OPAQUE_LAYER = 0,
+    SKYBOX_LAYER = 1    // not culled, depth test GL_LEQUAL
+};
+
+// drawn instances of a scene grouped by model and material
+// a batch with more than one instance is drawn with one instanced draw call per mesh
+struct DrawBatch
+{
+    DrawLayer layer = OPAQUE_LAYER;
+    unsigned int model, material;
+    uint64_t key = 0;           // sort key, see SortDrawBatches
+    vector<size_t> instances;   // scene instance indices
+    vector<size_t> objects;     // culler object indices (position among the drawn instances)
+
+    // visible instances of the current pass in the InstanceBuffer, one range per mesh and level of detail that has any
+    struct InstanceRange
+    {
+        size_t mesh;
+        unsigned int lod;
+        size_t first;
+        GLsizei count;
+    };
+    vector<InstanceRange> ranges;
+
+    // visible clusters of every mesh of a batch that is not instanced, for the current pass in the ClusterStream
+    vector<IndexRange> cluster_ranges;
+
+    bool Instanced() const { return instances.size() > 1; }
+};
+
+// groups the drawn instances of the scene in the order of their first instance, followed by the skybox
+// without instancing every instance gets its own batch
+inline vector<DrawBatch> BuildDrawBatches(const Scene & scene, bool instancing)
+{
+    vector<DrawBatch> batches;
+    // batch of every (model, material) pair, by model * material count + material
+    vector<int> batch_of(scene.model_names.size() * scene.materials.size(), -1);
+    size_t object = 0;
+    for (size_t i = 0; i < scene.InstanceCount(); i++)
+    {
+        if ((scene.instance_flags[i] & INSTANCE_DRAW) == 0)
+            continue;
+
+        size_t key = scene.instance_model[i] * scene.materials.size() + scene.instance_material[i];
+        if (!instancing || batch_of[key] < 0)
+        {
+            batch_of[key] = (int)batches.size();
+            batches.push_back(DrawBatch());
+            batches.back().model = scene.instance_model[i];
+            batches.back().material = scene.instance_material[i];
+        }
+        batches[batch_of[key]].instances.push_back(i);
+        batches[batch_of[key]].objects.push_back(object++);
+    }
+
+    if (scene.skybox_model >= 0)
+    {
+        batches.push_back(DrawBatch());
+        batches.back().layer = SKYBOX_LAYER;
+        batches.back().model = scene.skybox_model;
+        batches.back().material = scene.skybox_material;
+    }
+    return batches;
+}
+
+// orders the batches by layer, program, material and model (bits 63-56, 55-40, 39-20, 19-0 of the key),
+// so consecutive draws share as much state as possible; material_programs[m] is the program of material m
+inline void SortDrawBatches(vector<DrawBatch> & batches, const vector<GLuint> & material_programs)
+{
+    for (DrawBatch & batch : batches)
+        batch.key = ((uint64_t)batch.layer << 56) | ((uint64_t)(material_programs[batch.material] & 0xFFFF) << 40)
+                  | ((uint64_t)(batch.material & 0xFFFFF) << 20) | (uint64_t)(batch.model & 0xFFFFF);
+    stable_sort(batches.begin(), batches.end(), [](const DrawBatch & a, const DrawBatch & b) { return a.key < b.key; });
+}
+
+// per-instance model matrices of all instanced batches of a pass, streamed into one vertex buffer
+class InstanceBuffer
+{
+public:
+
+    void Create()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    GLuint Id() const { return buffer; }
+    size_t Size() const { return transforms.size(); }
+
+    void Begin() { transforms.clear(); }
+    void Add(const glm::mat4 & transform) { transforms.push_back(transform); }
+
+    // replaces the buffer storage (orphaning it, so the draws of the previous pass are not waited for)
+    void Upload()
+    {
+        if (transforms.empty())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), &transforms[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+private:
+    GLuint buffer = 0;
+    vector<glm::mat4> transforms;
+};
+
+
+// draw calls and drawn instances per pass (one pass = one Render of a view)
+class DrawStats
+{
+public:
+
+    void AddPass() { passes++; }
+    void AddDraws(unsigned long long count) { draw_calls += count; }
+    void AddInstancedDraw(GLsizei instance_count)
+    {
+        draw_calls++;
+        instanced_draw_calls++;
+        instanced_instances += instance_count;
+    }
+
+    // one group of a MultiDrawList, submitted with draws GL calls (1 for an indirect multi-draw)
+    void AddMultiDraw(GLsizei draws, GLsizei commands)
+    {
+        draw_calls += draws;
+        multi_draws++;
+        multi_draw_commands += commands;
+    }
+
+    void PrintReport(const vector<DrawBatch> & batches) const
+    {
+        size_t instanced_batches = 0, instances = 0;
+        for (const DrawBatch & batch : batches)
+        {
+            if (batch.layer == SKYBOX_LAYER)
+                continue;
+            instances += batch.instances.size();
+            instanced_batches += batch.Instanced();
+        }
+        double per_pass = passes ? 1.0 / passes : 0.0;
+        cout << "INSTANCING:: " << instances << " drawn instances in " << batches.size() << " batches (" << instanced_batches << " instanced, skybox included)" << endl;
+        cout << "INSTANCING:: draw calls = " << draw_calls * per_pass << " (" << instanced_draw_calls * per_pass << " instanced, "
+             << instanced_instances * per_pass << " instances) per pass, " << passes << " passes" << endl;
+        if (multi_draws > 0)
+            cout << "INSTANCING:: multi-draw groups = " << multi_draws * per_pass << " with " << multi_draw_commands * per_pass << " commands per pass" << endl;
+    }
+
+private:
+    unsigned long long passes = 0, draw_calls = 0, instanced_draw_calls = 0, instanced_instances = 0, multi_draws = 0, multi_draw_commands = 0;
+};
+
+#endif
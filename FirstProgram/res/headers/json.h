@@ -0,0 +1,292 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// minimal JSON document model and parser (enough for the scene files in res/scenes)
+struct JsonValue
+{
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+    Type type = JSON_NULL;
+    bool boolean = false;
+    double number = 0.0;
+    string text;
+    vector<JsonValue> items;                     // array elements
+    vector<pair<string, JsonValue>> members;     // object members in file order
+
+    bool IsNumber() const { return type == JSON_NUMBER; }
+    bool IsString() const { return type == JSON_STRING; }
+    bool IsArray() const { return type == JSON_ARRAY; }
+    bool IsObject() const { return type == JSON_OBJECT; }
+
+    // member of an object, NULL if missing
+    const JsonValue * Find(const string & name) const
+    {
+        for (const pair<string, JsonValue> & member : members)
+            if (member.first == name)
+                return &member.second;
+        return NULL;
+    }
+
+    double Number(const string & name, double fallback) const
+    {
+        const JsonValue * value = Find(name);
+        return value && value->IsNumber() ? value->number : fallback;
+    }
+
+    bool Bool(const string & name, bool fallback) const
+    {
+        const JsonValue * value = Find(name);
+        return value && value->type == JSON_BOOL ? value->boolean : fallback;
+    }
+
+    string String(const string & name, const string & fallback) const
+    {
+        const JsonValue * value = Find(name);
+        return value && value->IsString() ? value->text : fallback;
+    }
+};
+
+class JsonParser
+{
+public:
+
+    // parses a whole document, on errors prints the line and returns false
+    static bool Parse(const string & text, JsonValue & root, const string & source_name)
+    {
+        JsonParser parser(text);
+        parser.SkipSpace();
+        if (!parser.ParseValue(root, 0))
+        {
+            cout << "ERROR::JSON:: " << source_name << ":" << parser.Line() << ": " << parser.error << endl;
+            return false;
+        }
+        parser.SkipSpace();
+        if (parser.position != text.size())
+        {
+            cout << "ERROR::JSON:: " << source_name << ":" << parser.Line() << ": unexpected data after the document" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    static bool ParseFile(const string & path, JsonValue & root)
+    {
+        ifstream file(path, ios::binary);
+        if (!file)
+        {
+            cout << "ERROR::JSON:: Cannot open " << path << endl;
+            return false;
+        }
+        stringstream buffer;
+        buffer << file.rdbuf();
+        return Parse(buffer.str(), root, path);
+    }
+
+private:
+
+    static const int MAX_DEPTH = 64;
+
+    const string & text;
+    size_t position = 0;
+    string error;
+
+    JsonParser(const string & text) : text(text) {}
+
+    size_t Line() const
+    {
+        size_t line = 1;
+        for (size_t i = 0; i < position && i < text.size(); i++)
+            if (text[i] == '\n')
+                line++;
+        return line;
+    }
+
+    bool Fail(const string & message)
+    {
+        error = message;
+        return false;
+    }
+
+    void SkipSpace()
+    {
+        while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r'))
+            position++;
+    }
+
+    bool Consume(const char * word)
+    {
+        size_t length = char_traits<char>::length(word);
+        if (text.compare(position, length, word) != 0)
+            return false;
+        position += length;
+        return true;
+    }
+
+    bool ParseValue(JsonValue & value, int depth)
+    {
+        if (depth > MAX_DEPTH)
+            return Fail("nesting too deep");
+        if (position >= text.size())
+            return Fail("unexpected end of file");
+
+        char c = text[position];
+        if (c == '{')
+            return ParseObject(value, depth);
+        if (c == '[')
+            return ParseArray(value, depth);
+        if (c == '"')
+        {
+            value.type = JsonValue::JSON_STRING;
+            return ParseString(value.text);
+        }
+        if (Consume("true"))
+        {
+            value.type = JsonValue::JSON_BOOL;
+            value.boolean = true;
+            return true;
+        }
+        if (Consume("false"))
+        {
+            value.type = JsonValue::JSON_BOOL;
+            value.boolean = false;
+            return true;
+        }
+        if (Consume("null"))
+        {
+            value.type = JsonValue::JSON_NULL;
+            return true;
+        }
+
+        const char * start = text.c_str() + position;
+        char * end = NULL;
+        value.number = strtod(start, &end);
+        if (end == start)
+            return Fail(string("unexpected character '") + c + "'");
+        value.type = JsonValue::JSON_NUMBER;
+        position += end - start;
+        return true;
+    }
+
+    bool ParseString(string & out)
+    {
+        position++; // opening quote
+        while (position < text.size() && text[position] != '"')
+        {
+            char c = text[position++];
+            if (c != '\\')
+            {
+                out += c;
+                continue;
+            }
+            if (position >= text.size())
+                break;
+            char escape = text[position++];
+            switch (escape)
+            {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u':
+            {
+                // only code points below 0x80 are kept as they are, others become '?' (scene files are ASCII)
+                if (position + 4 > text.size())
+                    return Fail("bad \\u escape");
+                unsigned long code = strtoul(text.substr(position, 4).c_str(), NULL, 16);
+                out += code < 0x80 ? (char)code : '?';
+                position += 4;
+                break;
+            }
+            default: out += escape; break;
+            }
+        }
+        if (position >= text.size())
+            return Fail("unterminated string");
+        position++; // closing quote
+        return true;
+    }
+
+    bool ParseArray(JsonValue & value, int depth)
+    {
+        value.type = JsonValue::JSON_ARRAY;
+        position++;
+        SkipSpace();
+        if (position < text.size() && text[position] == ']')
+        {
+            position++;
+            return true;
+        }
+        for (;;)
+        {
+            value.items.push_back(JsonValue());
+            SkipSpace();
+            if (!ParseValue(value.items.back(), depth + 1))
+                return false;
+            SkipSpace();
+            if (position < text.size() && text[position] == ',')
+            {
+                position++;
+                continue;
+            }
+            if (position < text.size() && text[position] == ']')
+            {
+                position++;
+                return true;
+            }
+            return Fail("expected ',' or ']'");
+        }
+    }
+
+    bool ParseObject(JsonValue & value, int depth)
+    {
+        value.type = JsonValue::JSON_OBJECT;
+        position++;
+        SkipSpace();
+        if (position < text.size() && text[position] == '}')
+        {
+            position++;
+            return true;
+        }
+        for (;;)
+        {
+            SkipSpace();
+            if (position >= text.size() || text[position] != '"')
+                return Fail("expected a member name");
+            value.members.push_back(pair<string, JsonValue>());
+            if (!ParseString(value.members.back().first))
+                return false;
+            SkipSpace();
+            if (position >= text.size() || text[position] != ':')
+                return Fail("expected ':'");
+            position++;
+            SkipSpace();
+            if (!ParseValue(value.members.back().second, depth + 1))
+                return false;
+            SkipSpace();
+            if (position < text.size() && text[position] == ',')
+            {
+                position++;
+                continue;
+            }
+            if (position < text.size() && text[position] == '}')
+            {
+                position++;
+                return true;
+            }
+            return Fail("expected ',' or '}'");
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    const unsigned char * data = NULL;
+    size_t size = 0;
+
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    bool Open(const string & path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        size = (size_t)file_size.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            Close();
+            return false;
+        }
+        data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+        void * address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+        data = address == MAP_FAILED ? NULL : (const unsigned char *)address;
+#endif
+        if (data == NULL)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void *)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+
+// 64-bit FNV-1a, used to key the caches by the content of their source files
+unsigned long long HashBytes(const unsigned char * data, size_t size, unsigned long long hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// paths of the files below directory (recursively) whose name ends with extension, sorted
+vector<string> ListFiles(const string & directory, const string & extension)
+{
+    vector<string> files, pending(1, directory);
+    while (!pending.empty())
+    {
+        string current = pending.back();
+        pending.pop_back();
+#ifdef _WIN32
+        WIN32_FIND_DATAA entry;
+        HANDLE search = FindFirstFileA((current + "/*").c_str(), &entry);
+        if (search == INVALID_HANDLE_VALUE)
+            continue;
+        do
+        {
+            string name = entry.cFileName;
+            bool is_directory = (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+        DIR * search = opendir(current.c_str());
+        if (!search)
+            continue;
+        while (dirent * entry = readdir(search))
+        {
+            string name = entry->d_name;
+            struct stat info;
+            bool is_directory = stat((current + '/' + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+            if (name == "." || name == "..")
+                continue;
+            if (is_directory)
+                pending.push_back(current + '/' + name);
+            else if (name.size() >= extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+                files.push_back(current + '/' + name);
+#ifdef _WIN32
+        } while (FindNextFileA(search, &entry));
+        FindClose(search);
+#else
+        }
+        closedir(search);
+#endif
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+#include "gl_state.h"
+#include "shader.h"
+#include "texture_cache.h"
+#include "uniform_buffer.h"
+
+using namespace std;
+
+// flag blocks of all materials in one uniform buffer, slot 0 holds the defaults (all flags off)
+class MaterialBuffer
+{
+public:
+
+    static MaterialBuffer & Get()
+    {
+        static MaterialBuffer buffer;
+        return buffer;
+    }
+
+    GLuint Add(const MaterialBlock & block) { return blocks.Add(block); }
+    void Bind(GLuint slot) { blocks.Bind(MATERIAL_BLOCK_BINDING, slot); }
+    void Destroy() { blocks.Destroy(); }
+
+private:
+
+    UniformSlotBuffer<MaterialBlock> blocks;
+
+    MaterialBuffer()
+    {
+        MaterialBlock defaults = {};
+        blocks.Add(defaults);
+    }
+};
+
+struct Texture {
+
+    GLuint id;
+    string type;
+    string path;
+};
+
+// textures of one model material on their fixed units (see TextureUnit), shared by all meshes that use it
+// the programs get their sampler units at link time, so binding a material is only texture binds and its flag block
+// the program is not part of it: the scene file picks it per instance, and the G-buffer and shadow passes draw the same
+// meshes with their own programs, so the caller binds the program of the pass (RenderMaterial in Application.cpp)
+class Material
+{
+public:
+
+    // textures as collected from the material, only the first texture of every type has a sampler in the shaders
+    Material(const vector<Texture> & textures) : textures(textures)
+    {
+        unsigned int used_units = 0;
+        for (const Texture & texture : textures)
+        {
+            GLint unit = TypeTextureUnit(texture.type);
+            if (unit < 0 || (used_units & (1u << unit)))
+                continue;
+            used_units |= 1u << unit;
+            bindings.push_back({ (GLuint)unit, texture.id });
+            // cooked (BC5) normal maps only store x and y, the shaders rebuild z
+            if (unit == NORMAL_TEXTURE_UNIT && TextureCache::Get().Format(texture.id) == BLOCK_BC5)
+                flags.two_channel_normals = 1;
+        }
+        for (const Texture & texture : textures)
+            TextureCache::Get().Acquire(texture.id);
+        // materials without flags share the default slot
+        if (flags.two_channel_normals)
+            flags_slot = MaterialBuffer::Get().Add(flags);
+    }
+
+    // the textures stay alive as long as a material references them
+    ~Material()
+    {
+        for (const Texture & texture : textures)
+            TextureCache::Get().Release(texture.id);
+    }
+
+    Material(const Material &) = delete;
+    Material & operator=(const Material &) = delete;
+
+    void Bind() const
+    {
+        GLStateCache & state = GLStateCache::Get();
+        for (const Binding & binding : bindings)
+            state.BindTexture(binding.unit, GL_TEXTURE_2D, binding.texture);
+        MaterialBuffer::Get().Bind(flags_slot);
+    }
+
+    // true if the material was built from the same textures (meshes of one model material share a Material)
+    bool Uses(const vector<Texture> & other) const
+    {
+        if (other.size() != textures.size())
+            return false;
+        for (size_t i = 0; i < textures.size(); i++)
+            if (other[i].id != textures[i].id || other[i].type != textures[i].type)
+                return false;
+        return true;
+    }
+
+    const vector<Texture> & Textures() const { return textures; }
+
+    // unit of a texture type as named by Model ("diffuse_texture", ...), -1 if no shader samples it
+    static GLint TypeTextureUnit(const string & type)
+    {
+        return SamplerTextureUnit(type + "1");
+    }
+
+private:
+
+    struct Binding
+    {
+        GLuint unit;
+        GLuint texture;
+    };
+
+    vector<Texture> textures;
+    vector<Binding> bindings;
+    MaterialBlock flags = {};
+    GLuint flags_slot = 0;      // MaterialBuffer slot
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef MESH_ANALYZER_H
+#define MESH_ANALYZER_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Model.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+
+using namespace std;
+
+// imports every model below directory as Assimp returns it and prints its vertex cache and overdraw figures
+// (see MeshStatistics) before and after each optimization stage, runs on the CPU only and needs no OpenGL context
+//
+// the stages are run on copies, the mesh caches are not touched
+bool AnalyzeModels(const string & directory)
+{
+    vector<string> paths = ListFiles(directory, ".obj");
+    if (paths.empty())
+    {
+        cout << "ERROR::MESH_ANALYZER:: no .obj files below " << directory << endl;
+        return false;
+    }
+
+    cout << "MESH_ANALYZER:: FIFO cache of " << VERTEX_CACHE_SIZE << " vertices, overdraw from the six axis directions" << endl;
+    bool all_imported = true;
+    for (const string & path : paths)
+    {
+        vector<MeshData> mesh_data;
+        if (!Model::ImportSource(path, mesh_data))
+        {
+            all_imported = false;
+            continue;
+        }
+
+        MeshStatistics source, vertex_cache, overdraw;
+        double ms = 0.0;
+        for (const MeshData & data : mesh_data)
+        {
+            source += AnalyzeMesh(data.vertices, data.indices);
+
+            chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+            vector<Vertex> vertices = data.vertices;
+            vector<GLuint> indices = data.indices;
+            OptimizeMesh(vertices, indices, MESH_OPTIMIZE_VERTEX_CACHE);
+            ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+            vertex_cache += AnalyzeMesh(vertices, indices);
+
+            vertices = data.vertices;
+            indices = data.indices;
+            OptimizeMesh(vertices, indices, MESH_OPTIMIZE_ALL);
+            overdraw += AnalyzeMesh(vertices, indices);
+        }
+
+        cout << "MESH_ANALYZER:: " << path << ": " << mesh_data.size() << " meshes, " << source.triangles << " triangles, "
+             << source.vertices << " -> " << vertex_cache.vertices << " vertices, vertex cache order in " << ms << " ms" << endl;
+        const MeshStatistics * stages[3] = { &source, &vertex_cache, &overdraw };
+        const char * names[3] = { "import order ", "vertex cache ", "+ overdraw   " };
+        for (int stage = 0; stage < 3; stage++)
+            cout << "MESH_ANALYZER::   " << names[stage] << " ACMR = " << stages[stage]->acmr << ", ATVR = " << stages[stage]->atvr
+                 << ", overdraw = " << stages[stage]->overdraw << endl;
+    }
+    return all_imported;
+}
+
+#endif
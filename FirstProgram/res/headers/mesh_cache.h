@@ -0,0 +1,267 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// hash of an .obj file and of the .mtl files it references (materials decide the texture references stored in the cache)
+// returns false if the source file cannot be read
+bool HashModelSource(const string & path, unsigned long long & hash)
+{
+    MappedFile source;
+    if (!source.Open(path))
+        return false;
+    hash = HashBytes(source.data, source.size);
+
+    string directory = path.substr(0, path.find_last_of('/'));
+    const char * text = (const char *)source.data;
+    for (size_t line_start = 0; line_start < source.size; )
+    {
+        size_t line_end = line_start;
+        while (line_end < source.size && text[line_end] != '\n')
+            line_end++;
+        if (line_end - line_start > 7 && strncmp(text + line_start, "mtllib ", 7) == 0)
+        {
+            string library(text + line_start + 7, line_end - line_start - 7);
+            while (!library.empty() && (library.back() == '\r' || library.back() == ' '))
+                library.pop_back();
+            MappedFile material;
+            if (material.Open(directory + '/' + library))
+                hash = HashBytes(material.data, material.size, hash);
+        }
+        line_start = line_end + 1;
+    }
+    return true;
+}
+
+
+// binary cache of the imported meshes, stored next to the asset as <model file>.meshcache
+//
+// layout (all offsets from the start of the file, arrays 16-byte aligned so they can be used straight from the mapping):
+//   MeshCacheHeader
+//   MeshCacheEntry[mesh_count]
+//   MeshCacheTexture[] (texture references of all meshes)
+//   per mesh: Vertex[vertex_count], GLuint[index_count] (every level of detail), MeshLod[lod_count], Meshlet[meshlet_count]
+namespace MeshCache
+{
+    const char MAGIC[4] = { 'M', 'S', 'H', 'C' };
+    // bump whenever Vertex, the layout below, the import post-processing, the mesh optimizer, the simplifier or the
+    // meshlet builder changes
+    const unsigned int VERSION = 7;
+
+    struct MeshCacheHeader
+    {
+        char magic[4];
+        unsigned int version;
+        unsigned long long source_hash;
+        unsigned int import_flags;
+        unsigned int optimization;      // MeshOptimization flags the arrays were reordered with
+        unsigned int vertex_size;
+        unsigned int mesh_count;
+        unsigned int texture_count;
+    };
+
+    struct MeshCacheEntry
+    {
+        unsigned long long vertex_offset;
+        unsigned long long index_offset;
+        unsigned long long lod_offset;
+        unsigned long long meshlet_offset;
+        unsigned int vertex_count;
+        unsigned int index_count;
+        unsigned int lod_count;
+        unsigned int meshlet_count;
+        unsigned int first_texture;
+        unsigned int texture_count;
+    };
+
+    struct MeshCacheTexture
+    {
+        char type[32];
+        char path[224];
+    };
+
+    // mesh as stored in (or read from) the cache, the arrays point either to the importer output or into the mapping
+    struct MeshView
+    {
+        const Vertex * vertices;
+        unsigned int vertex_count;
+        const GLuint * indices;
+        unsigned int index_count;
+        const MeshLod * lods;
+        unsigned int lod_count;
+        const Meshlet * meshlets;
+        unsigned int meshlet_count;
+        vector<Texture> textures; // only type and path are meaningful here
+    };
+
+    string CachePath(const string & model_path)
+    {
+        return model_path + ".meshcache";
+    }
+
+    size_t Align(size_t offset)
+    {
+        return (offset + 15) & ~(size_t)15;
+    }
+
+    // maps the cache and checks it against the current source hash, import flags and optimization
+    // on success the views point into the mapping, which has to stay open while they are used
+    bool Read(const string & cache_path, unsigned long long source_hash, unsigned int import_flags, unsigned int optimization,
+              MappedFile & mapping, vector<MeshView> & meshes)
+    {
+        if (!mapping.Open(cache_path) || mapping.size < sizeof(MeshCacheHeader))
+            return false;
+
+        const MeshCacheHeader * header = (const MeshCacheHeader *)mapping.data;
+        if (memcmp(header->magic, MAGIC, 4) != 0 || header->version != VERSION || header->source_hash != source_hash ||
+            header->import_flags != import_flags || header->optimization != optimization || header->vertex_size != sizeof(Vertex))
+            return false;
+
+        size_t tables_end = sizeof(MeshCacheHeader) + header->mesh_count * sizeof(MeshCacheEntry) + header->texture_count * sizeof(MeshCacheTexture);
+        if (tables_end > mapping.size)
+            return false;
+
+        const MeshCacheEntry * entries = (const MeshCacheEntry *)(mapping.data + sizeof(MeshCacheHeader));
+        const MeshCacheTexture * textures = (const MeshCacheTexture *)(entries + header->mesh_count);
+
+        meshes.clear();
+        for (unsigned int i = 0; i < header->mesh_count; i++)
+        {
+            const MeshCacheEntry & entry = entries[i];
+            if (entry.vertex_offset + (unsigned long long)entry.vertex_count * sizeof(Vertex) > mapping.size ||
+                entry.index_offset + (unsigned long long)entry.index_count * sizeof(GLuint) > mapping.size ||
+                entry.lod_offset + (unsigned long long)entry.lod_count * sizeof(MeshLod) > mapping.size || entry.lod_count > MESH_MAX_LODS ||
+                entry.meshlet_offset + (unsigned long long)entry.meshlet_count * sizeof(Meshlet) > mapping.size ||
+                entry.first_texture + entry.texture_count > header->texture_count)
+                return false;
+
+            MeshView view;
+            view.vertices = (const Vertex *)(mapping.data + entry.vertex_offset);
+            view.vertex_count = entry.vertex_count;
+            view.indices = (const GLuint *)(mapping.data + entry.index_offset);
+            view.index_count = entry.index_count;
+            view.lods = (const MeshLod *)(mapping.data + entry.lod_offset);
+            view.lod_count = entry.lod_count;
+            view.meshlets = (const Meshlet *)(mapping.data + entry.meshlet_offset);
+            view.meshlet_count = entry.meshlet_count;
+            for (unsigned int l = 0; l < entry.lod_count; l++)
+                if ((unsigned long long)view.lods[l].first_index + view.lods[l].index_count > entry.index_count ||
+                    (unsigned long long)view.lods[l].first_meshlet + view.lods[l].meshlet_count > entry.meshlet_count)
+                    return false;
+            for (unsigned int m = 0; m < entry.meshlet_count; m++)
+                if ((unsigned long long)view.meshlets[m].first_index + view.meshlets[m].index_count > entry.index_count)
+                    return false;
+            for (unsigned int t = 0; t < entry.texture_count; t++)
+            {
+                Texture texture;
+                texture.id = 0;
+                texture.type = textures[entry.first_texture + t].type;
+                texture.path = textures[entry.first_texture + t].path;
+                view.textures.push_back(texture);
+            }
+            meshes.push_back(view);
+        }
+        return true;
+    }
+
+    // writes to a temporary file first, so an interrupted write never leaves a cache that looks valid
+    bool Write(const string & cache_path, unsigned long long source_hash, unsigned int import_flags, unsigned int optimization,
+               const vector<MeshView> & meshes)
+    {
+        MeshCacheHeader header;
+        memcpy(header.magic, MAGIC, 4);
+        header.version = VERSION;
+        header.source_hash = source_hash;
+        header.import_flags = import_flags;
+        header.optimization = optimization;
+        header.vertex_size = sizeof(Vertex);
+        header.mesh_count = (unsigned int)meshes.size();
+        header.texture_count = 0;
+
+        vector<MeshCacheEntry> entries(meshes.size());
+        vector<MeshCacheTexture> textures;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            entries[i].first_texture = (unsigned int)textures.size();
+            entries[i].texture_count = (unsigned int)meshes[i].textures.size();
+            for (const Texture & texture : meshes[i].textures)
+            {
+                MeshCacheTexture reference;
+                memset(&reference, 0, sizeof(reference));
+                if (texture.type.size() >= sizeof(reference.type) || texture.path.size() >= sizeof(reference.path))
+                {
+                    cout << "WARNING::MESH_CACHE:: texture reference too long, not caching " << cache_path << endl;
+                    return false;
+                }
+                memcpy(reference.type, texture.type.c_str(), texture.type.size());
+                memcpy(reference.path, texture.path.c_str(), texture.path.size());
+                textures.push_back(reference);
+            }
+        }
+        header.texture_count = (unsigned int)textures.size();
+
+        size_t offset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) + textures.size() * sizeof(MeshCacheTexture);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            entries[i].vertex_count = meshes[i].vertex_count;
+            entries[i].index_count = meshes[i].index_count;
+            entries[i].lod_count = meshes[i].lod_count;
+            entries[i].meshlet_count = meshes[i].meshlet_count;
+            offset = Align(offset);
+            entries[i].vertex_offset = offset;
+            offset += meshes[i].vertex_count * sizeof(Vertex);
+            offset = Align(offset);
+            entries[i].index_offset = offset;
+            offset += meshes[i].index_count * sizeof(GLuint);
+            offset = Align(offset);
+            entries[i].lod_offset = offset;
+            offset += meshes[i].lod_count * sizeof(MeshLod);
+            offset = Align(offset);
+            entries[i].meshlet_offset = offset;
+            offset += meshes[i].meshlet_count * sizeof(Meshlet);
+        }
+
+        string temp_path = cache_path + ".tmp";
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            if (!file)
+                return false;
+
+            const char zeros[16] = {};
+            file.write((const char *)&header, sizeof(header));
+            if (!entries.empty())
+                file.write((const char *)&entries[0], entries.size() * sizeof(MeshCacheEntry));
+            if (!textures.empty())
+                file.write((const char *)&textures[0], textures.size() * sizeof(MeshCacheTexture));
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                file.write(zeros, entries[i].vertex_offset - (size_t)file.tellp());
+                file.write((const char *)meshes[i].vertices, meshes[i].vertex_count * sizeof(Vertex));
+                file.write(zeros, entries[i].index_offset - (size_t)file.tellp());
+                file.write((const char *)meshes[i].indices, meshes[i].index_count * sizeof(GLuint));
+                file.write(zeros, entries[i].lod_offset - (size_t)file.tellp());
+                file.write((const char *)meshes[i].lods, meshes[i].lod_count * sizeof(MeshLod));
+                file.write(zeros, entries[i].meshlet_offset - (size_t)file.tellp());
+                file.write((const char *)meshes[i].meshlets, meshes[i].meshlet_count * sizeof(Meshlet));
+            }
+            if (!file)
+                return false;
+        }
+
+        remove(cache_path.c_str());
+        return rename(temp_path.c_str(), cache_path.c_str()) == 0;
+    }
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// at most this many levels of detail per mesh, LOD 0 included
+const unsigned int MESH_MAX_LODS = 5;
+
+// range of the index buffer of a mesh that draws one level of detail
+// error is the object space distance the level may deviate from the full mesh (0 for LOD 0)
+struct MeshLod
+{
+    GLuint first_index;
+    GLuint index_count;
+    float error;
+    GLuint first_meshlet;   // meshlets of the level in the meshlets of the mesh (see BuildMeshlets)
+    GLuint meshlet_count;
+};
+
+// passes of a frame, each selects its LODs with its own bias and gets its own triangle count
+enum RenderPass
+{
+    RENDER_PASS_MAIN = 0,
+    RENDER_PASS_REFLECTION = 1,
+    RENDER_PASS_SHADOW = 2,
+    RENDER_PASS_COUNT = 3
+};
+
+const char * RenderPassName(RenderPass pass)
+{
+    static const char * names[RENDER_PASS_COUNT] = { "main view", "reflection", "shadow cubemap" };
+    return names[pass];
+}
+
+// how far the LODs may go: threshold is the projected error in pixels a mesh may show in the main view,
+// the other passes multiply it with their bias (their detail is seen mirrored, blurred or only as a shadow outline)
+struct LodSettings
+{
+    bool enabled = true;
+    float threshold = 1.0f;
+    float bias[RENDER_PASS_COUNT] = { 1.0f, 2.0f, 4.0f };
+
+    // allowed projected error of a pass in pixels, 0 keeps every mesh at LOD 0
+    float MaxError(RenderPass pass) const { return enabled ? threshold * bias[pass] : 0.0f; }
+};
+
+// the camera of a pass as the LOD selection sees it
+struct LodView
+{
+    glm::vec3 eye = glm::vec3(0.0f);
+    float pixels_per_unit = 0.0f;   // pixels one world unit covers at distance one
+    float max_error = 0.0f;         // allowed projected error in pixels
+
+    // view matrix, perspective projection and the height of the viewport in pixels
+    static LodView FromCamera(const glm::mat4 & view, const glm::mat4 & projection, GLuint viewport_height, float max_error)
+    {
+        LodView lod_view;
+        lod_view.eye = glm::vec3(glm::inverse(view)[3]);
+        lod_view.pixels_per_unit = projection[1][1] * viewport_height * 0.5f;
+        lod_view.max_error = max_error;
+        return lod_view;
+    }
+};
+
+// coarsest level whose error, scaled into the world and projected from the nearest point of the bounding sphere,
+// stays within the allowed pixels (levels are ordered by growing error)
+unsigned char SelectLod(const vector<MeshLod> & lods, const LodView & view, const glm::vec3 & center, float radius, float scale)
+{
+    if (view.max_error <= 0.0f || lods.size() < 2)
+        return 0;
+    float distance = glm::max(glm::length(center - view.eye) - radius, 1.0e-3f);
+    float max_error = view.max_error * distance / (view.pixels_per_unit * scale);
+    unsigned char lod = 0;
+    while (lod + 1u < lods.size() && lods[lod + 1].error <= max_error)
+        lod++;
+    return lod;
+}
+
+
+// triangles drawn per pass and frame, against the triangles the same draws have at LOD 0
+// Mesh::Draw counts every draw into the pass set with BeginPass
+class TriangleStats
+{
+public:
+
+    static TriangleStats & Get()
+    {
+        static TriangleStats stats;
+        return stats;
+    }
+
+    void BeginFrame()
+    {
+        frames++;
+        pass = RENDER_PASS_MAIN;
+    }
+
+    void BeginPass(RenderPass pass) { this->pass = pass; }
+
+    void AddDraw(size_t triangles, size_t full_triangles, GLsizei instance_count, unsigned int lod)
+    {
+        PassStats & stats = passes[pass];
+        stats.triangles += (unsigned long long)triangles * instance_count;
+        stats.full_triangles += (unsigned long long)full_triangles * instance_count;
+        stats.lod_draws[lod] += instance_count;
+    }
+
+    void PrintReport() const
+    {
+        double per_frame = frames ? 1.0 / frames : 0.0;
+        for (int pass = 0; pass < RENDER_PASS_COUNT; pass++)
+        {
+            const PassStats & stats = passes[pass];
+            cout << "LOD:: " << RenderPassName((RenderPass)pass) << ": " << stats.triangles * per_frame << " triangles per frame ("
+                 << stats.full_triangles * per_frame << " at LOD 0, " << (stats.full_triangles ? 100.0 * stats.triangles / stats.full_triangles : 100.0)
+                 << "%), meshes per LOD";
+            for (unsigned int lod = 0; lod < MESH_MAX_LODS; lod++)
+                cout << (lod ? " / " : " ") << stats.lod_draws[lod] * per_frame;
+            cout << endl;
+        }
+    }
+
+private:
+
+    struct PassStats
+    {
+        unsigned long long triangles = 0, full_triangles = 0;
+        unsigned long long lod_draws[MESH_MAX_LODS] = {};
+    };
+
+    PassStats passes[RENDER_PASS_COUNT];
+    RenderPass pass = RENDER_PASS_MAIN;
+    unsigned long long frames = 0;
+
+    TriangleStats() {}
+};
+
+#endif
@@ -0,0 +1,453 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "vertex_format.h"
+
+using namespace std;
+
+// import-time reordering of the vertex and index arrays of a mesh, part of the mesh cache key
+enum MeshOptimization
+{
+    MESH_OPTIMIZE_NONE = 0,
+    MESH_OPTIMIZE_VERTEX_CACHE = 1,     // welds equal corners, Tipsify triangle order, vertices in first-use order
+    MESH_OPTIMIZE_OVERDRAW = 2,         // with the vertex cache order: clusters that face outwards are drawn first
+    MESH_OPTIMIZE_ALL = MESH_OPTIMIZE_VERTEX_CACHE | MESH_OPTIMIZE_OVERDRAW
+};
+
+// FIFO post-transform cache the triangle order is made for (and the analyzer simulates)
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// clusters may have this much more cache misses per triangle than the vertex cache order (see OptimizeOverdraw)
+const float OVERDRAW_CACHE_THRESHOLD = 1.05f;
+
+
+// FIFO cache simulation with timestamps: a vertex is cached while fewer than cache_size misses happened since it was loaded
+class VertexCacheSimulator
+{
+public:
+
+    VertexCacheSimulator(size_t vertex_count, unsigned int cache_size)
+        : cache_size(cache_size), loaded(vertex_count, 0), timestamp(cache_size + 1) {}
+
+    // misses of a triangle
+    unsigned int Triangle(const GLuint * triangle)
+    {
+        unsigned int misses = 0;
+        for (int c = 0; c < 3; c++)
+            if (timestamp - loaded[triangle[c]] > cache_size)
+            {
+                loaded[triangle[c]] = timestamp++;
+                misses++;
+            }
+        return misses;
+    }
+
+    void Reset() { timestamp += cache_size + 1; }
+
+private:
+    unsigned int cache_size;
+    vector<unsigned int> loaded;
+    unsigned int timestamp;
+};
+
+
+// corners with the same position, normal and uv (within the tolerances of the simplifier) get one index, the importer
+// emits every triangle corner on its own with the tangent frame of its triangle, so the merged corners get the average
+// of their frames; the vertices keep the order of their first occurrence
+void WeldVertices(vector<Vertex> & vertices, vector<GLuint> & indices)
+{
+    vector<GLuint> order(vertices.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = (GLuint)i;
+    stable_sort(order.begin(), order.end(), [&vertices](GLuint a, GLuint b)
+    {
+        const glm::vec3 & pa = vertices[a].Position, & pb = vertices[b].Position;
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    });
+
+    // every vertex -> first vertex at its position with the same normal and uv (stable_sort keeps the first one in front)
+    vector<GLuint> first(vertices.size());
+    vector<GLuint> classes;
+    for (size_t i = 0; i < order.size(); )
+    {
+        size_t end = i + 1;
+        while (end < order.size() && vertices[order[end]].Position == vertices[order[i]].Position)
+            end++;
+        classes.clear();
+        for (size_t j = i; j < end; j++)
+        {
+            const Vertex & vertex = vertices[order[j]];
+            size_t c = 0;
+            for (; c < classes.size(); c++)
+            {
+                const Vertex & other = vertices[classes[c]];
+                glm::vec3 normal = glm::abs(vertex.Normal - other.Normal);
+                glm::vec2 uv = glm::abs(vertex.TexCoords - other.TexCoords);
+                if (max(normal.x, max(normal.y, normal.z)) < 1.0e-3f && max(uv.x, uv.y) < 1.0e-5f)
+                    break;
+            }
+            if (c == classes.size())
+                classes.push_back(order[j]);
+            first[order[j]] = classes[c];
+        }
+        i = end;
+    }
+
+    vector<GLuint> remap(vertices.size(), 0xFFFFFFFFu);
+    vector<Vertex> welded;
+    for (size_t i = 0; i < vertices.size(); i++)
+        if (first[i] == i)
+        {
+            remap[i] = (GLuint)welded.size();
+            welded.push_back(vertices[i]);
+            welded.back().Tangent = glm::vec3(0.0f);
+            welded.back().Bitangent = glm::vec3(0.0f);
+        }
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        Vertex & vertex = welded[remap[first[i]]];
+        vertex.Tangent += vertices[i].Tangent;
+        vertex.Bitangent += vertices[i].Bitangent;
+    }
+    // the summed frame, made orthogonal to the normal again (the frame of the first corner where the corners cancel out)
+    for (size_t i = 0; i < vertices.size(); i++)
+        if (first[i] == i)
+        {
+            Vertex & vertex = welded[remap[i]];
+            glm::vec3 tangent = vertex.Tangent - vertex.Normal * glm::dot(vertex.Normal, vertex.Tangent);
+            glm::vec3 bitangent = vertex.Bitangent - vertex.Normal * glm::dot(vertex.Normal, vertex.Bitangent);
+            vertex.Tangent = glm::dot(tangent, tangent) > 1.0e-12f ? glm::normalize(tangent) : vertices[i].Tangent;
+            vertex.Bitangent = glm::dot(bitangent, bitangent) > 1.0e-12f ? glm::normalize(bitangent) : vertices[i].Bitangent;
+        }
+    for (GLuint & index : indices)
+        index = remap[first[index]];
+    vertices.swap(welded);
+}
+
+// Tipsify (Sander, Nehab, Barczak: Fast Triangle Reordering for Vertex Locality and Reduced Overdraw, 2007):
+// fans around a vertex, the next fan vertex is the candidate that stays in the cache the longest,
+// at dead ends the most recent vertex with live triangles (or the next one in index order) is taken
+void OptimizeVertexCache(vector<GLuint> & indices, size_t vertex_count, unsigned int cache_size = VERTEX_CACHE_SIZE)
+{
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    // triangles of every vertex
+    vector<unsigned int> live(vertex_count, 0), first_triangle(vertex_count + 1, 0);
+    for (GLuint index : indices)
+        live[index]++;
+    for (size_t v = 0; v < vertex_count; v++)
+        first_triangle[v + 1] = first_triangle[v] + live[v];
+    vector<unsigned int> adjacency(indices.size()), filled(first_triangle.begin(), first_triangle.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[filled[indices[i]]++] = (unsigned int)(i / 3);
+
+    vector<unsigned int> loaded(vertex_count, 0);
+    unsigned int timestamp = cache_size + 1;
+    vector<bool> emitted(triangle_count, false);
+    vector<GLuint> dead_ends, candidates, result;
+    result.reserve(indices.size());
+    size_t cursor = 0;
+
+    long long fan = indices[0];
+    while (fan >= 0)
+    {
+        candidates.clear();
+        for (unsigned int k = first_triangle[fan]; k < first_triangle[fan + 1]; k++)
+        {
+            unsigned int triangle = adjacency[k];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint v = indices[triangle * 3 + c];
+                result.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (timestamp - loaded[v] > cache_size)
+                    loaded[v] = timestamp++;
+            }
+        }
+
+        // candidate that is still in the cache after its remaining triangles were drawn, the oldest of them first;
+        // the other candidates with live triangles have priority 0 and still win over the dead-end stack
+        fan = -1;
+        long long best_priority = -1;
+        for (GLuint v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+            long long priority = 0;
+            if (timestamp - loaded[v] + 2 * live[v] <= cache_size)
+                priority = timestamp - loaded[v];
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                fan = v;
+            }
+        }
+        if (fan >= 0)
+            continue;
+
+        while (!dead_ends.empty() && fan < 0)
+        {
+            GLuint v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live[v] > 0)
+                fan = v;
+        }
+        while (cursor < vertex_count && fan < 0)
+        {
+            if (live[cursor] > 0)
+                fan = (long long)cursor;
+            cursor++;
+        }
+    }
+    indices.swap(result);
+}
+
+// splits the vertex cache order into clusters and draws the clusters that face away from the mesh center first,
+// so they cover the inner ones early (Sander et al.); a cluster ends where the triangles since its start reach the cache
+// efficiency of their whole run times threshold, runs start where the cache order jumped (a triangle with three misses)
+void OptimizeOverdraw(vector<GLuint> & indices, const vector<Vertex> & vertices, float threshold = OVERDRAW_CACHE_THRESHOLD,
+                      unsigned int cache_size = VERTEX_CACHE_SIZE)
+{
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    VertexCacheSimulator cache(vertices.size(), cache_size);
+    vector<size_t> runs;
+    for (size_t t = 0; t < triangle_count; t++)
+        if (cache.Triangle(&indices[t * 3]) == 3 || t == 0)
+            runs.push_back(t);
+
+    vector<size_t> clusters;
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        size_t start = runs[r], end = r + 1 < runs.size() ? runs[r + 1] : triangle_count;
+        cache.Reset();
+        unsigned int run_misses = 0;
+        for (size_t t = start; t < end; t++)
+            run_misses += cache.Triangle(&indices[t * 3]);
+        float target = threshold * run_misses / (float)(end - start);
+
+        clusters.push_back(start);
+        cache.Reset();
+        unsigned int misses = 0, faces = 0;
+        for (size_t t = start; t < end; t++)
+        {
+            misses += cache.Triangle(&indices[t * 3]);
+            faces++;
+            if ((float)misses / faces <= target)
+            {
+                clusters.push_back(t + 1);
+                cache.Reset();
+                misses = faces = 0;
+            }
+        }
+        // the rest after the last cut is short and has a poor hit rate on its own, it joins the cluster before it
+        // (this also removes a cut at end)
+        if (clusters.back() != start)
+            clusters.pop_back();
+    }
+
+    glm::vec3 mesh_centroid(0.0f);
+    for (GLuint index : indices)
+        mesh_centroid += vertices[index].Position;
+    mesh_centroid /= (float)indices.size();
+
+    // area weighted centroid and normal of every cluster
+    vector<float> facing(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c]; t < end; t++)
+        {
+            const glm::vec3 & p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3 & p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 & p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+            float triangle_area = glm::length(cross);
+            centroid += (p0 + p1 + p2) * (triangle_area / 3.0f);
+            normal += cross;
+            area += triangle_area;
+        }
+        centroid = area > 0.0f ? centroid / area : mesh_centroid;
+        float normal_length = glm::length(normal);
+        facing[c] = normal_length > 0.0f ? glm::dot(centroid - mesh_centroid, normal / normal_length) : 0.0f;
+    }
+
+    vector<size_t> order(clusters.size());
+    for (size_t c = 0; c < order.size(); c++)
+        order[c] = c;
+    stable_sort(order.begin(), order.end(), [&facing](size_t a, size_t b) { return facing[a] > facing[b]; });
+
+    vector<GLuint> result;
+    result.reserve(indices.size());
+    for (size_t c : order)
+    {
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(result);
+}
+
+// vertices in the order the triangles first use them, so the vertex fetch walks the buffer forward;
+// unused vertices are dropped
+void OptimizeVertexFetch(vector<Vertex> & vertices, vector<GLuint> & indices)
+{
+    vector<GLuint> remap(vertices.size(), 0xFFFFFFFFu);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (GLuint & index : indices)
+    {
+        if (remap[index] == 0xFFFFFFFFu)
+        {
+            remap[index] = (GLuint)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+// runs the stages of optimization (MeshOptimization flags) on an imported mesh
+void OptimizeMesh(vector<Vertex> & vertices, vector<GLuint> & indices, unsigned int optimization)
+{
+    if (!(optimization & MESH_OPTIMIZE_VERTEX_CACHE))
+        return;
+    WeldVertices(vertices, indices);
+    OptimizeVertexCache(indices, vertices.size());
+    if (optimization & MESH_OPTIMIZE_OVERDRAW)
+        OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+}
+
+
+// figures of an index order:
+//   ACMR (average cache miss ratio) = vertex shader runs per triangle with a FIFO cache of VERTEX_CACHE_SIZE, 0.5 - 3
+//   ATVR (average transformed vertex ratio) = vertex shader runs per vertex, 1 is optimal
+//   overdraw = shaded / covered pixels, averaged over orthographic views from the six axis directions (back faces culled)
+struct MeshStatistics
+{
+    size_t vertices = 0, triangles = 0;
+    double acmr = 0.0, atvr = 0.0, overdraw = 0.0;
+    unsigned long long misses = 0, covered = 0, shaded = 0;
+
+    MeshStatistics & operator+=(const MeshStatistics & other)
+    {
+        vertices += other.vertices;
+        triangles += other.triangles;
+        misses += other.misses;
+        covered += other.covered;
+        shaded += other.shaded;
+        UpdateRatios();
+        return *this;
+    }
+
+    void UpdateRatios()
+    {
+        acmr = triangles ? (double)misses / triangles : 0.0;
+        atvr = vertices ? (double)misses / vertices : 0.0;
+        overdraw = covered ? (double)shaded / covered : 0.0;
+    }
+};
+
+// depth tested rasterization of the triangles in index order into one view, counts covered and shaded pixels
+// view: 0 - 2 looks along -x, -y, -z, 3 - 5 along +x, +y, +z
+void RasterizeOverdraw(const vector<Vertex> & vertices, const vector<GLuint> & indices, int view, int resolution,
+                       unsigned long long & covered, unsigned long long & shaded)
+{
+    // (u, v, depth) keep the handedness of (x, y, z) for every axis, the views along + mirror u
+    int axis = view % 3;
+    float direction = view < 3 ? 1.0f : -1.0f;
+    glm::vec3 bounds_min = vertices[0].Position, bounds_max = vertices[0].Position;
+    for (const Vertex & vertex : vertices)
+    {
+        bounds_min = glm::min(bounds_min, vertex.Position);
+        bounds_max = glm::max(bounds_max, vertex.Position);
+    }
+    glm::vec3 extent = bounds_max - bounds_min;
+    float scale = (resolution - 1) / max(max(extent.x, extent.y), max(extent.z, 1e-20f));
+
+    vector<glm::vec3> projected(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        glm::vec3 p = (vertices[i].Position - bounds_min) * scale;
+        glm::vec3 rotated(p[(axis + 1) % 3], p[(axis + 2) % 3], p[axis]);
+        projected[i] = glm::vec3(direction > 0.0f ? rotated.x : (resolution - 1) - rotated.x, rotated.y, -direction * rotated.z);
+    }
+
+    vector<float> depth((size_t)resolution * resolution, numeric_limits<float>::max());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        const glm::vec3 & a = projected[indices[t]];
+        const glm::vec3 & b = projected[indices[t + 1]];
+        const glm::vec3 & c = projected[indices[t + 2]];
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (area <= 0.0f)
+            continue;
+
+        int x0 = max(0, (int)floor(min(a.x, min(b.x, c.x)))), x1 = min(resolution - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+        int y0 = max(0, (int)floor(min(a.y, min(b.y, c.y)))), y1 = min(resolution - 1, (int)ceil(max(a.y, max(b.y, c.y))));
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = x + 0.5f, py = y + 0.5f;
+                float wa = (b.x - px) * (c.y - py) - (b.y - py) * (c.x - px);
+                float wb = (c.x - px) * (a.y - py) - (c.y - py) * (a.x - px);
+                float wc = (a.x - px) * (b.y - py) - (a.y - py) * (b.x - px);
+                if (wa < 0.0f || wb < 0.0f || wc < 0.0f)
+                    continue;
+                float z = (wa * a.z + wb * b.z + wc * c.z) / area;
+                float & stored = depth[(size_t)y * resolution + x];
+                if (z < stored)
+                {
+                    if (stored == numeric_limits<float>::max())
+                        covered++;
+                    stored = z;
+                    shaded++;
+                }
+            }
+    }
+}
+
+MeshStatistics AnalyzeMesh(const vector<Vertex> & vertices, const vector<GLuint> & indices, int overdraw_resolution = 256)
+{
+    MeshStatistics statistics;
+    statistics.triangles = indices.size() / 3;
+    vector<bool> used(vertices.size(), false);
+    for (GLuint index : indices)
+        if (!used[index])
+        {
+            used[index] = true;
+            statistics.vertices++;
+        }
+
+    VertexCacheSimulator cache(vertices.size(), VERTEX_CACHE_SIZE);
+    for (size_t t = 0; t < statistics.triangles; t++)
+        statistics.misses += cache.Triangle(&indices[t * 3]);
+
+    if (!vertices.empty())
+        for (int view = 0; view < 6; view++)
+            RasterizeOverdraw(vertices, indices, view, overdraw_resolution, statistics.covered, statistics.shaded);
+
+    statistics.UpdateRatios();
+    return statistics;
+}
+
+#endif
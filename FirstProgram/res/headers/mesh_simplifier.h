@@ -0,0 +1,467 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+
+using namespace std;
+
+// every level targets this fraction of the triangles of the level before it
+const float MESH_LOD_REDUCTION = 0.5f;
+// no level below this many triangles
+const size_t MESH_LOD_MIN_TRIANGLES = 64;
+// weight of the planes that hold open borders in place, per squared border edge length (faces weigh their area)
+const double BORDER_PLANE_WEIGHT = 10.0;
+
+
+// sum of squared distances to a set of planes, weighted by the area of the triangles they come from
+// (Garland, Heckbert: Surface Simplification Using Quadric Error Metrics, 1997)
+struct Quadric
+{
+    double a2 = 0.0, b2 = 0.0, c2 = 0.0, ab = 0.0, ac = 0.0, bc = 0.0, ad = 0.0, bd = 0.0, cd = 0.0, d2 = 0.0;
+    double weight = 0.0;
+
+    // plane dot(n, p) + d = 0 with a unit normal
+    void AddPlane(const glm::dvec3 & n, double d, double w)
+    {
+        a2 += w * n.x * n.x; b2 += w * n.y * n.y; c2 += w * n.z * n.z;
+        ab += w * n.x * n.y; ac += w * n.x * n.z; bc += w * n.y * n.z;
+        ad += w * n.x * d; bd += w * n.y * d; cd += w * n.z * d;
+        d2 += w * d * d;
+        weight += w;
+    }
+
+    Quadric & operator+=(const Quadric & other)
+    {
+        a2 += other.a2; b2 += other.b2; c2 += other.c2;
+        ab += other.ab; ac += other.ac; bc += other.bc;
+        ad += other.ad; bd += other.bd; cd += other.cd;
+        d2 += other.d2;
+        weight += other.weight;
+        return *this;
+    }
+
+    // weighted mean of the squared distances of p to the planes
+    double Error(const glm::dvec3 & p) const
+    {
+        double error = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z + 2.0 * (ab * p.x * p.y + ac * p.x * p.z + bc * p.y * p.z)
+                     + 2.0 * (ad * p.x + bd * p.y + cd * p.z) + d2;
+        return weight > 0.0 ? max(error, 0.0) / weight : 0.0;
+    }
+};
+
+
+// distance of p to the triangle abc (closest point by the voronoi regions of the triangle, Ericson: Real-Time Collision Detection, 5.1.5)
+double PointTriangleDistance(const glm::dvec3 & p, const glm::dvec3 & a, const glm::dvec3 & b, const glm::dvec3 & c)
+{
+    glm::dvec3 ab = b - a, ac = c - a, ap = p - a;
+    double d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0 && d2 <= 0.0)
+        return glm::length(ap);
+    glm::dvec3 bp = p - b;
+    double d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0 && d4 <= d3)
+        return glm::length(bp);
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+        return glm::length(ap - ab * (d1 / (d1 - d3)));
+    glm::dvec3 cp = p - c;
+    double d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0 && d5 <= d6)
+        return glm::length(cp);
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+        return glm::length(ap - ac * (d2 / (d2 - d6)));
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+        return glm::length(bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    double denominator = 1.0 / (va + vb + vc);
+    return glm::length(ap - ab * (vb * denominator) - ac * (vc * denominator));
+}
+
+// edge collapse simplification of a triangle list (Garland-Heckbert quadrics), collapses the cheapest edges until at most
+// target_index_count indices are left or no edge can be collapsed any more
+// edges collapse onto one of their ends, so the result only references vertices of the input: vertices are never moved
+// or created, and every level of a mesh shares its vertex buffer
+//
+// the topology is the one of the positions: vertices at one position with other normals or uvs (seams, hard edges) move
+// together, a seam only collapses along itself, open borders only along the border and positions on edges with more
+// than two triangles stay; collapses that would flip a triangle or pinch the surface are skipped
+// error receives the largest distance of a removed position to the triangles around the position it was collapsed into
+// and around their corners, an object space estimate of how far the result strays from the input (the quadrics only order
+// the collapses, their mean error says little about the largest one)
+vector<GLuint> SimplifyMesh(const vector<Vertex> & vertices, const vector<GLuint> & indices, size_t target_index_count, float & error)
+{
+    error = 0.0f;
+    size_t vertex_count = vertices.size(), triangle_count = indices.size() / 3;
+
+    // positions, and the attribute classes (same normal and uv) of the vertices at each position
+    vector<GLuint> order(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++)
+        order[i] = (GLuint)i;
+    auto position_less = [&vertices](GLuint a, GLuint b)
+    {
+        const glm::vec3 & pa = vertices[a].Position, & pb = vertices[b].Position;
+        return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+    };
+    sort(order.begin(), order.end(), position_less);
+
+    vector<GLuint> position_of(vertex_count), class_of(vertex_count);
+    vector<glm::dvec3> positions;
+    vector<GLuint> class_vertex;            // representative vertex of every class
+    for (size_t i = 0; i < vertex_count; )
+    {
+        size_t end = i + 1;
+        while (end < vertex_count && vertices[order[end]].Position == vertices[order[i]].Position)
+            end++;
+        GLuint position = (GLuint)positions.size();
+        GLuint first_class = (GLuint)class_vertex.size();
+        positions.push_back(glm::dvec3(vertices[order[i]].Position));
+        for (size_t j = i; j < end; j++)
+        {
+            const Vertex & vertex = vertices[order[j]];
+            GLuint c = first_class;
+            for (; c < class_vertex.size(); c++)
+            {
+                const Vertex & other = vertices[class_vertex[c]];
+                glm::vec3 normal = glm::abs(vertex.Normal - other.Normal);
+                glm::vec2 uv = glm::abs(vertex.TexCoords - other.TexCoords);
+                if (max(normal.x, max(normal.y, normal.z)) < 1.0e-3f && max(uv.x, uv.y) < 1.0e-5f)
+                    break;
+            }
+            if (c == class_vertex.size())
+                class_vertex.push_back(order[j]);
+            position_of[order[j]] = position;
+            class_of[order[j]] = c;
+        }
+        i = end;
+    }
+    size_t position_count = positions.size();
+
+    // live triangles and the triangles around every position
+    vector<GLuint> triangles(indices.begin(), indices.begin() + triangle_count * 3);
+    vector<unsigned char> alive(triangle_count, 1);
+    vector<vector<GLuint>> position_triangles(position_count);
+    vector<Quadric> quadrics(position_count);
+    size_t live_triangles = 0;
+    for (size_t t = 0; t < triangle_count; t++)
+    {
+        GLuint p0 = position_of[triangles[3 * t]], p1 = position_of[triangles[3 * t + 1]], p2 = position_of[triangles[3 * t + 2]];
+        glm::dvec3 normal = glm::cross(positions[p1] - positions[p0], positions[p2] - positions[p0]);
+        double length = glm::length(normal);
+        if (p0 == p1 || p1 == p2 || p0 == p2 || length == 0.0)
+        {
+            alive[t] = 0;
+            continue;
+        }
+        normal /= length;
+        double d = -glm::dot(normal, positions[p0]);
+        for (GLuint p : { p0, p1, p2 })
+        {
+            quadrics[p].AddPlane(normal, d, length * 0.5);
+            position_triangles[p].push_back((GLuint)t);
+        }
+        live_triangles++;
+    }
+
+    // edges by the positions of their ends (smaller one in the high bits), counted over the live triangles
+    auto edge_key = [](GLuint a, GLuint b) { return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a; };
+    vector<pair<uint64_t, GLuint>> edges;
+    auto collect_edges = [&]()
+    {
+        edges.clear();
+        for (size_t t = 0; t < triangle_count; t++)
+            if (alive[t])
+                for (int c = 0; c < 3; c++)
+                    edges.push_back(make_pair(edge_key(position_of[triangles[3 * t + c]], position_of[triangles[3 * t + (c + 1) % 3]]), (GLuint)t));
+        sort(edges.begin(), edges.end());
+    };
+
+    // borders get planes through the border edge, perpendicular to its triangle, so they keep their outline
+    enum { POSITION_FREE = 0, POSITION_BORDER = 1, POSITION_LOCKED = 2 };
+    vector<unsigned char> kind(position_count, POSITION_FREE);
+    collect_edges();
+    for (size_t i = 0; i < edges.size(); )
+    {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end].first == edges[i].first)
+            end++;
+        GLuint a = (GLuint)(edges[i].first >> 32), b = (GLuint)(edges[i].first & 0xFFFFFFFFu);
+        if (end - i > 2)
+            kind[a] = kind[b] = POSITION_LOCKED;
+        else if (end - i == 1)
+        {
+            const GLuint * triangle = &triangles[3 * edges[i].second];
+            glm::dvec3 face = glm::cross(positions[position_of[triangle[1]]] - positions[position_of[triangle[0]]],
+                                         positions[position_of[triangle[2]]] - positions[position_of[triangle[0]]]);
+            glm::dvec3 edge = positions[b] - positions[a];
+            glm::dvec3 normal = glm::cross(edge, face);
+            double length = glm::length(normal);
+            if (length > 0.0)
+            {
+                normal /= length;
+                double weight = glm::dot(edge, edge) * BORDER_PLANE_WEIGHT;
+                quadrics[a].AddPlane(normal, -glm::dot(normal, positions[a]), weight);
+                quadrics[b].AddPlane(normal, -glm::dot(normal, positions[b]), weight);
+            }
+            for (GLuint p : { a, b })
+                if (kind[p] == POSITION_FREE)
+                    kind[p] = POSITION_BORDER;
+        }
+        i = end;
+    }
+
+    // scratch of the collapse checks
+    vector<unsigned int> mark(position_count, 0);
+    vector<GLuint> collapsed_into(position_count, 0xFFFFFFFFu);
+    unsigned int stamp = 0;
+    vector<pair<GLuint, GLuint>> class_map;
+
+    // moves position from onto position to, false if the collapse is not allowed (nothing is changed then)
+    auto collapse = [&](GLuint from, GLuint to) -> bool
+    {
+        vector<GLuint> & around = position_triangles[from];
+        size_t write = 0;
+        for (GLuint t : around)
+            if (alive[t])
+                around[write++] = t;
+        around.resize(write);
+
+        // the neighbours both ends share must be the third corners of the triangles on the edge, otherwise the
+        // surface would be pinched
+        stamp++;
+        for (GLuint t : position_triangles[to])
+            if (alive[t])
+                for (int c = 0; c < 3; c++)
+                    mark[position_of[triangles[3 * t + c]]] = stamp;
+        size_t shared = 0, common = 0;
+        stamp++;
+        for (GLuint t : around)
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint p = position_of[triangles[3 * t + c]];
+                if (p == to)
+                    shared++;
+                else if (p != from && mark[p] == stamp - 1)
+                {
+                    mark[p] = stamp;
+                    common++;
+                }
+            }
+        if (shared == 0 || common > shared)
+            return false;
+
+        // every class of from goes to the class of to it shares a triangle with: a class without a triangle on the edge
+        // (the other side of a seam that is left) or two classes ending up in one would tear the seam
+        class_map.clear();
+        for (GLuint t : around)
+        {
+            GLuint from_class = 0xFFFFFFFFu, to_class = 0xFFFFFFFFu;
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint p = position_of[triangles[3 * t + c]];
+                if (p == from)
+                    from_class = class_of[triangles[3 * t + c]];
+                else if (p == to)
+                    to_class = class_of[triangles[3 * t + c]];
+            }
+            if (to_class == 0xFFFFFFFFu)
+                continue;
+            for (const pair<GLuint, GLuint> & mapping : class_map)
+                if ((mapping.first == from_class) != (mapping.second == to_class))
+                    return false;
+            class_map.push_back(make_pair(from_class, to_class));
+        }
+        for (GLuint t : around)
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint v = triangles[3 * t + c];
+                if (position_of[v] != from)
+                    continue;
+                bool mapped = false;
+                for (const pair<GLuint, GLuint> & mapping : class_map)
+                    mapped = mapped || mapping.first == class_of[v];
+                if (!mapped)
+                    return false;
+            }
+
+        // no triangle that stays may turn over
+        for (GLuint t : around)
+        {
+            glm::dvec3 before[3], after[3];
+            bool on_edge = false;
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint p = position_of[triangles[3 * t + c]];
+                on_edge = on_edge || p == to;
+                before[c] = positions[p];
+                after[c] = p == from ? positions[to] : positions[p];
+            }
+            if (on_edge)
+                continue;
+            glm::dvec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::dvec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(normal_before, normal_after) <= 0.0)
+                return false;
+        }
+
+        for (GLuint t : around)
+        {
+            bool on_edge = false;
+            for (int c = 0; c < 3; c++)
+                on_edge = on_edge || position_of[triangles[3 * t + c]] == to;
+            if (on_edge)
+            {
+                alive[t] = 0;
+                live_triangles--;
+                continue;
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint & v = triangles[3 * t + c];
+                if (position_of[v] != from)
+                    continue;
+                for (const pair<GLuint, GLuint> & mapping : class_map)
+                    if (mapping.first == class_of[v])
+                    {
+                        v = class_vertex[mapping.second];
+                        break;
+                    }
+            }
+            position_triangles[to].push_back(t);
+        }
+        quadrics[to] += quadrics[from];
+        kind[from] = POSITION_LOCKED;
+        collapsed_into[from] = to;
+        vector<GLuint>().swap(around);
+        return true;
+    };
+
+    struct Collapse
+    {
+        GLuint from, to;
+        double cost;
+    };
+    vector<Collapse> collapses;
+    vector<unsigned char> touched(position_count);
+    size_t target_triangles = target_index_count / 3;
+
+    // passes over all edges: the cheapest collapses go first, every position takes part in one collapse per pass
+    while (live_triangles > target_triangles)
+    {
+        collect_edges();
+        collapses.clear();
+        for (size_t i = 0; i < edges.size(); )
+        {
+            size_t end = i + 1;
+            while (end < edges.size() && edges[end].first == edges[i].first)
+                end++;
+            GLuint a = (GLuint)(edges[i].first >> 32), b = (GLuint)(edges[i].first & 0xFFFFFFFFu);
+            bool border_edge = end - i == 1;
+            i = end;
+
+            Quadric quadric = quadrics[a];
+            quadric += quadrics[b];
+            Collapse best = { 0, 0, -1.0 };
+            for (int direction = 0; direction < 2; direction++)
+            {
+                GLuint from = direction ? b : a, to = direction ? a : b;
+                if (kind[from] == POSITION_LOCKED || (kind[from] == POSITION_BORDER && !border_edge))
+                    continue;
+                double cost = quadric.Error(positions[to]);
+                if (best.cost < 0.0 || cost < best.cost)
+                    best = { from, to, cost };
+            }
+            if (best.cost >= 0.0)
+                collapses.push_back(best);
+        }
+        if (collapses.empty())
+            break;
+        sort(collapses.begin(), collapses.end(), [](const Collapse & x, const Collapse & y) { return x.cost < y.cost; });
+
+        // a collapse removes about two triangles, the pass takes the cheapest ones up to half again the needed number
+        size_t goal = (live_triangles - target_triangles + 1) / 2;
+        double cost_limit = collapses[min(collapses.size() - 1, goal + goal / 2)].cost;
+        fill(touched.begin(), touched.end(), 0);
+        size_t collapsed = 0;
+        for (const Collapse & candidate : collapses)
+        {
+            if (live_triangles <= target_triangles || candidate.cost > cost_limit)
+                break;
+            if (touched[candidate.from] || touched[candidate.to] || !collapse(candidate.from, candidate.to))
+                continue;
+            touched[candidate.from] = touched[candidate.to] = 1;
+            collapsed++;
+        }
+        if (collapsed == 0)
+            break;
+    }
+
+    vector<GLuint> result;
+    result.reserve(live_triangles * 3);
+    for (size_t t = 0; t < triangle_count; t++)
+        if (alive[t])
+            result.insert(result.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+
+    double max_distance = 0.0;
+    for (GLuint p = 0; p < position_count; p++)
+    {
+        GLuint to = p;
+        while (collapsed_into[to] != 0xFFFFFFFFu)
+            to = collapsed_into[to];
+        if (to == p)
+            continue;
+        double distance = -1.0;
+        for (GLuint around : position_triangles[to])
+            if (alive[around])
+                for (int c = 0; c < 3; c++)
+                    for (GLuint t : position_triangles[position_of[triangles[3 * around + c]]])
+                        if (alive[t])
+                        {
+                            const GLuint * triangle = &triangles[3 * t];
+                            double d = PointTriangleDistance(positions[p], positions[position_of[triangle[0]]], positions[position_of[triangle[1]]],
+                                                             positions[position_of[triangle[2]]]);
+                            distance = distance < 0.0 ? d : min(distance, d);
+                        }
+        max_distance = max(max_distance, distance);
+    }
+    error = (float)max_distance;
+    return result;
+}
+
+// appends the coarser levels of a mesh to its index buffer, lods receives every level with LOD 0 (the indices as they
+// were) first; every level is simplified from LOD 0, so its error is measured against the full mesh, and is put into
+// vertex cache order, the levels end at MESH_LOD_MIN_TRIANGLES or when a level hardly removes anything
+void BuildMeshLods(const vector<Vertex> & vertices, vector<GLuint> & indices, vector<MeshLod> & lods)
+{
+    MeshLod full = { 0, (GLuint)indices.size(), 0.0f, 0, 0 };
+    lods.assign(1, full);
+
+    vector<GLuint> source(indices);
+    size_t target = source.size() / 3;
+    while (lods.size() < MESH_MAX_LODS)
+    {
+        target = (size_t)(target * MESH_LOD_REDUCTION);
+        if (target < MESH_LOD_MIN_TRIANGLES)
+            break;
+        float error = 0.0f;
+        vector<GLuint> level = SimplifyMesh(vertices, source, target * 3, error);
+        if (level.size() * 10 > lods.back().index_count * 9)
+            break;
+
+        OptimizeVertexCache(level, vertices.size());
+        MeshLod lod = { (GLuint)indices.size(), (GLuint)level.size(), max(error, lods.back().error), 0, 0 };
+        lods.push_back(lod);
+        indices.insert(indices.end(), level.begin(), level.end());
+    }
+}
+
+#endif
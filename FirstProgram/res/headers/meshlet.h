@@ -0,0 +1,131 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "mesh_lod.h"
+#include "vertex_format.h"
+
+using namespace std;
+
+// limits of a meshlet (the sizes mesh shading hardware is built for, here they keep the bounds tight)
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// cluster of a mesh: a run of triangles of one level of detail in the index buffer, with the bounds cluster culling tests
+struct Meshlet
+{
+    GLuint first_index;
+    GLuint index_count;
+    glm::vec3 center;       // object space bounding sphere
+    float radius;
+    glm::vec3 cone_axis;    // average normal of the triangles
+    float cone_cutoff;      // sine of the half angle of the normal cone, 1 if the cluster cannot be back facing as a whole
+};
+
+// part of an index buffer a draw uses, buffer 0 is the index buffer of the mesh itself
+struct IndexRange
+{
+    GLuint buffer;
+    GLuint first_index;
+    GLsizei index_count;
+};
+
+// bounding sphere (around the box center) and normal cone of the triangles indices[first_index, first_index + index_count)
+// the cone test (see ClusterStream) is the one of meshoptimizer: a cluster is back facing from eye if
+// dot(center - eye, cone_axis) >= cone_cutoff * length(center - eye) + radius
+Meshlet MeshletBounds(const vector<Vertex> & vertices, const GLuint * indices, GLuint first_index, GLuint index_count)
+{
+    Meshlet meshlet;
+    meshlet.first_index = first_index;
+    meshlet.index_count = index_count;
+
+    const GLuint * triangles = indices + first_index;
+    glm::vec3 aabb_min = vertices[triangles[0]].Position, aabb_max = aabb_min;
+    for (GLuint i = 1; i < index_count; i++)
+    {
+        aabb_min = glm::min(aabb_min, vertices[triangles[i]].Position);
+        aabb_max = glm::max(aabb_max, vertices[triangles[i]].Position);
+    }
+    meshlet.center = (aabb_min + aabb_max) * 0.5f;
+    float radius2 = 0.0f;
+    for (GLuint i = 0; i < index_count; i++)
+    {
+        glm::vec3 offset = vertices[triangles[i]].Position - meshlet.center;
+        radius2 = max(radius2, glm::dot(offset, offset));
+    }
+    meshlet.radius = sqrt(radius2);
+
+    // counter-clockwise triangles face their normal (the OpenGL default front face)
+    vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (GLuint i = 0; i < index_count; i += 3)
+    {
+        const glm::vec3 & a = vertices[triangles[i]].Position, & b = vertices[triangles[i + 1]].Position, & c = vertices[triangles[i + 2]].Position;
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+        normals.push_back(normal / length);
+        axis += normals.back();
+    }
+    float axis_length = glm::length(axis);
+    meshlet.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f, 0.0f, 1.0f);
+    float min_dot = axis_length > 0.0f ? 1.0f : -1.0f;
+    for (const glm::vec3 & normal : normals)
+        min_dot = min(min_dot, glm::dot(meshlet.cone_axis, normal));
+    // cones wider than about 84 degrees are not worth testing
+    meshlet.cone_cutoff = min_dot <= 0.1f ? 1.0f : sqrt(1.0f - min_dot * min_dot);
+    return meshlet;
+}
+
+// cuts every level of detail into meshlets of consecutive triangles (so the levels keep their vertex cache order and the
+// meshlets are plain ranges of the index buffer), a meshlet ends when the next triangle would exceed one of the limits
+// fills first_meshlet and meshlet_count of the levels
+void BuildMeshlets(const vector<Vertex> & vertices, const vector<GLuint> & indices, vector<MeshLod> & lods, vector<Meshlet> & meshlets)
+{
+    meshlets.clear();
+    vector<unsigned int> seen(vertices.size(), 0);
+    unsigned int stamp = 0;
+    for (MeshLod & lod : lods)
+    {
+        lod.first_meshlet = (GLuint)meshlets.size();
+        GLuint start = lod.first_index, end = lod.first_index + lod.index_count;
+        unsigned int meshlet_vertices = 0;
+        stamp++;
+        for (GLuint i = start; i < end; i += 3)
+        {
+            // vertices the triangle adds (a corner may repeat in a degenerate triangle)
+            unsigned int added = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                GLuint v = indices[i + c];
+                if (seen[v] != stamp && (c == 0 || v != indices[i]) && (c < 2 || v != indices[i + 1]))
+                    added++;
+            }
+            if (meshlet_vertices + added > MESHLET_MAX_VERTICES || (i - start) / 3 == MESHLET_MAX_TRIANGLES)
+            {
+                meshlets.push_back(MeshletBounds(vertices, indices.data(), start, i - start));
+                start = i;
+                meshlet_vertices = 0;
+                stamp++;
+            }
+            for (int c = 0; c < 3; c++)
+                if (seen[indices[i + c]] != stamp)
+                {
+                    seen[indices[i + c]] = stamp;
+                    meshlet_vertices++;
+                }
+        }
+        if (end > start)
+            meshlets.push_back(MeshletBounds(vertices, indices.data(), start, end - start));
+        lod.meshlet_count = (GLuint)meshlets.size() - lod.first_meshlet;
+    }
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "gl_state.h"
+#include "geometry_arena.h"
+#include "meshlet.h"
+
+using namespace std;
+
+// not part of the OpenGL 3.3 headers
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void * indirect, GLsizei drawcount, GLsizei stride);
+
+// commands of consecutive draws that need the same state: material (index of the caller), mesh draw state
+// (Mesh::SharesDrawState, mesh is the first of them) and index buffer
+struct MultiDrawGroup
+{
+    unsigned int material;
+    const Mesh * mesh;
+    GLuint index_buffer;
+    size_t first_command;
+    GLsizei command_count;
+};
+
+// draws of a pass collected as indirect commands and submitted with one glMultiDrawElementsIndirect per group
+// the model matrices come from an instance buffer: the base instance of a command offsets the instance_model attribute
+// (per-instance attributes honour it since GL 4.2), so the programs read them as in any instanced draw
+//
+// glMultiDrawElementsIndirect (GL 4.3 or ARB_multi_draw_indirect with ARB_base_instance) is not part of the 3.3 loader and
+// is loaded at runtime; without it the commands are replayed with glDrawElementsInstancedBaseVertex, pointing the
+// instance attribute at the base instance of each one
+//
+// usage per pass: Begin, Add the draws in submission order, Upload, then for each of Groups() set the material and Submit
+class MultiDrawList
+{
+public:
+
+    // load is the loader given to glad, indirect = false keeps the GL 3.3 replay even where indirect draws are available
+    void Create(GLADloadproc load, bool indirect)
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool supported = major > 4 || (major == 4 && minor >= 3) ||
+                         (HasGLExtension("GL_ARB_multi_draw_indirect") && HasGLExtension("GL_ARB_base_instance"));
+        if (supported)
+            multi_draw = (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect");
+        if (!multi_draw)
+            cout << "WARNING::MULTI_DRAW:: glMultiDrawElementsIndirect is not available, replaying the commands one by one" << endl;
+        if (!indirect)
+            multi_draw = NULL;
+        if (multi_draw)
+            glGenBuffers(1, &buffer);
+        enabled = true;
+    }
+
+    bool Enabled() const { return enabled; }
+    bool Indirect() const { return multi_draw != NULL; }
+
+    void Begin()
+    {
+        commands.clear();
+        groups.clear();
+        run.clear();
+    }
+
+    // a draw of range (of level lod) of mesh with the material of the caller, instance_count instances whose model
+    // matrices start at base_instance; draws of one material are grouped by their state in the order they first appear
+    void Add(unsigned int material, const Mesh & mesh, const IndexRange & range, unsigned int lod, GLuint instance_count, GLuint base_instance)
+    {
+        if (!run.empty() && run.back().material != material)
+            FlushRun();
+        RunDraw draw = { material, &mesh, range.buffer ? range.buffer : mesh.IndexBuffer(),
+                         mesh.IndirectCommand(range, lod, instance_count, base_instance) };
+        run.push_back(draw);
+    }
+
+    // closes the groups and uploads the commands (orphaning the buffer, like the other streamed buffers)
+    void Upload()
+    {
+        FlushRun();
+        if (!multi_draw || commands.empty())
+            return;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_STREAM_DRAW);
+    }
+
+    const vector<MultiDrawGroup> & Groups() const { return groups; }
+
+    // draws a group with the program of its material in use, returns the number of GL draw calls
+    GLsizei Submit(const MultiDrawGroup & group, GLuint instance_buffer)
+    {
+        group.mesh->BindDrawState();
+        GLuint own_index_buffer = group.mesh->IndexBuffer();
+        if (group.index_buffer != own_index_buffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, group.index_buffer);
+
+        GLsizei draws = group.command_count;
+        if (multi_draw)
+        {
+            Mesh::PointInstanceAttributes(instance_buffer, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+            multi_draw(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *)(group.first_command * sizeof(DrawElementsIndirectCommand)), group.command_count, 0);
+            draws = 1;
+        }
+        else
+            for (size_t i = group.first_command; i < group.first_command + group.command_count; i++)
+            {
+                const DrawElementsIndirectCommand & command = commands[i];
+                Mesh::PointInstanceAttributes(instance_buffer, command.base_instance);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, (const void *)(command.first_index * sizeof(GLuint)),
+                                                  command.instance_count, command.base_vertex);
+            }
+        Mesh::DisableInstanceAttributes();
+
+        if (group.index_buffer != own_index_buffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, own_index_buffer);
+        return draws;
+    }
+
+    void Destroy()
+    {
+        if (buffer)
+            glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+private:
+
+    struct RunDraw
+    {
+        unsigned int material;
+        const Mesh * mesh;
+        GLuint index_buffer;
+        DrawElementsIndirectCommand command;
+    };
+
+    bool enabled = false;
+    MultiDrawElementsIndirectProc multi_draw = NULL;
+    GLuint buffer = 0;
+    vector<DrawElementsIndirectCommand> commands;
+    vector<MultiDrawGroup> groups;
+    // draws of the current material, not yet grouped
+    vector<RunDraw> run;
+
+    // sorts the draws of the current material into groups (a linear search, a material has few distinct states)
+    void FlushRun()
+    {
+        size_t first_group = groups.size();
+        vector<size_t> group_of(run.size());
+        for (size_t i = 0; i < run.size(); i++)
+        {
+            size_t group = first_group;
+            while (group < groups.size() && !(groups[group].index_buffer == run[i].index_buffer && groups[group].mesh->SharesDrawState(*run[i].mesh)))
+                group++;
+            if (group == groups.size())
+            {
+                MultiDrawGroup new_group = { run[i].material, run[i].mesh, run[i].index_buffer, 0, 0 };
+                groups.push_back(new_group);
+            }
+            groups[group].command_count++;
+            group_of[i] = group;
+        }
+
+        // the commands of a group are consecutive, in the order they were added
+        size_t first_command = commands.size();
+        for (size_t group = first_group; group < groups.size(); group++)
+        {
+            groups[group].first_command = first_command;
+            first_command += groups[group].command_count;
+        }
+        commands.resize(first_command);
+        vector<size_t> next(groups.size() - first_group, 0);
+        for (size_t i = 0; i < run.size(); i++)
+        {
+            MultiDrawGroup & group = groups[group_of[i]];
+            commands[group.first_command + next[group_of[i] - first_group]++] = run[i].command;
+        }
+        run.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gl_state.h"
+#include "pass_timer.h"
+#include "shader.h"
+
+using namespace std;
+
+// text and boxes drawn over the finished frame in screen pixels (origin in the top left corner) with a built-in
+// 5x7 font, characters 0x20 - 0x5f (lower case letters are drawn as upper case, others as '?')
+//
+// usage per frame: Begin, Text / Box, Draw; the quads are built on the CPU and uploaded with a single orphaning upload
+class TextOverlay
+{
+public:
+
+    // size of a character cell in font pixels (the glyphs are 5x7 with a column and a row of spacing)
+    static const int CELL_WIDTH = 6;
+    static const int CELL_HEIGHT = 8;
+
+    void Create(Shader * shader)
+    {
+        this->shader = shader;
+        screen_size = shader->uniform<glm::vec2>("screen_size");
+
+        // one cell per glyph in a row, the extra cell at the end is solid (the boxes sample it)
+        const int glyph_count = FONT_GLYPHS + 1;
+        vector<unsigned char> pixels(glyph_count * CELL_WIDTH * CELL_HEIGHT, 0);
+        int atlas_width = glyph_count * CELL_WIDTH;
+        for (int glyph = 0; glyph < glyph_count; glyph++)
+            for (int column = 0; column < CELL_WIDTH; column++)
+                for (int row = 0; row < CELL_HEIGHT; row++)
+                {
+                    // columns of the font are bytes with the top row in the lowest bit
+                    bool set = glyph == FONT_GLYPHS || (column < 5 && (FONT[glyph][column] >> row) & 1);
+                    pixels[row * atlas_width + glyph * CELL_WIDTH + column] = set ? 255 : 0;
+                }
+        glGenTextures(1, &font_texture);
+        GLStateCache::Get().BindTexture(OVERLAY_TEXTURE_UNIT, GL_TEXTURE_2D, font_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas_width, CELL_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        GLStateCache::Get().BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, tex_coords));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void *)offsetof(OverlayVertex, color));
+        GLStateCache::Get().BindVertexArray(0);
+    }
+
+    void Begin()
+    {
+        vertices.clear();
+    }
+
+    // a line of text with its top left corner at (x, y), scale screen pixels per font pixel
+    void Text(float x, float y, const string & text, const glm::vec4 & color, float scale)
+    {
+        for (char c : text)
+        {
+            if (c >= 'a' && c <= 'z')
+                c = c - 'a' + 'A';
+            int glyph = c >= FIRST_CHARACTER && c < FIRST_CHARACTER + FONT_GLYPHS ? c - FIRST_CHARACTER : '?' - FIRST_CHARACTER;
+            if (glyph != 0)
+                Quad(x, y, CELL_WIDTH * scale, CELL_HEIGHT * scale, glyph, color);
+            x += CELL_WIDTH * scale;
+        }
+    }
+
+    void Box(float x, float y, float width, float height, const glm::vec4 & color)
+    {
+        Quad(x, y, width, height, FONT_GLYPHS, color);
+    }
+
+    // draws the quads blended over the bound framebuffer of width x height pixels
+    void Draw(GLuint width, GLuint height)
+    {
+        if (vertices.empty())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(OverlayVertex), &vertices[0], GL_STREAM_DRAW);
+
+        GLStateCache & state = GLStateCache::Get();
+        shader->use();
+        screen_size.set(glm::vec2((float)width, (float)height));
+        state.BindTexture(OVERLAY_TEXTURE_UNIT, GL_TEXTURE_2D, font_texture);
+        state.BindVertexArray(VAO);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void Destroy()
+    {
+        if (VAO == 0)
+            return;
+        GLStateCache::Get().ForgetVertexArray(VAO);
+        GLStateCache::Get().ForgetTexture(font_texture);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteTextures(1, &font_texture);
+        VAO = VBO = font_texture = 0;
+    }
+
+private:
+
+    static const int FIRST_CHARACTER = 0x20;
+    static const int FONT_GLYPHS = 64;
+    // the classic 5x7 LCD font, 5 column bytes per character from 0x20 to 0x5f
+    static const unsigned char FONT[FONT_GLYPHS][5];
+
+    struct OverlayVertex
+    {
+        glm::vec2 position;
+        glm::vec2 tex_coords;
+        glm::vec4 color;
+    };
+
+    Shader * shader = NULL;
+    Uniform<glm::vec2> screen_size;
+    GLuint font_texture = 0, VAO = 0, VBO = 0;
+    vector<OverlayVertex> vertices;
+
+    void Quad(float x, float y, float width, float height, int glyph, const glm::vec4 & color)
+    {
+        float u0 = (float)glyph / (FONT_GLYPHS + 1), u1 = (float)(glyph + 1) / (FONT_GLYPHS + 1);
+        OverlayVertex corners[4] = {
+            { glm::vec2(x, y), glm::vec2(u0, 0.0f), color },
+            { glm::vec2(x + width, y), glm::vec2(u1, 0.0f), color },
+            { glm::vec2(x + width, y + height), glm::vec2(u1, 1.0f), color },
+            { glm::vec2(x, y + height), glm::vec2(u0, 1.0f), color }
+        };
+        static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int corner : order)
+            vertices.push_back(corners[corner]);
+    }
+};
+
+const unsigned char TextOverlay::FONT[TextOverlay::FONT_GLYPHS][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 },  //  !"#
+    { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 }, { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },  // $%&'
+    { 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x14, 0x08, 0x3E, 0x08, 0x14 }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },  // ()*+
+    { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },  // ,-./
+    { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 }, { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 },  // 0123
+    { 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },  // 4567
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },  // 89:;
+    { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 }, { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },  // <=>?
+    { 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },  // @ABC
+    { 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x01, 0x01 }, { 0x3E, 0x41, 0x41, 0x51, 0x32 },  // DEFG
+    { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 }, { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 },  // HIJK
+    { 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x04, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },  // LMNO
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 },  // PQRS
+    { 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F }, { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x7F, 0x20, 0x18, 0x20, 0x7F },  // TUVW
+    { 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x03, 0x04, 0x78, 0x04, 0x03 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },  // XYZ[
+    { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 }   // \]^_
+};
+
+
+// table of the rolling pass timings (PassTimer::Rolling) in the top left corner: cpu average and gpu average,
+// median, 95th percentile and maximum of every pass in ms
+void AddPassTimings(TextOverlay & overlay, const PassTimer & timer, float scale)
+{
+    const float margin = 4.0f * scale, line_height = (TextOverlay::CELL_HEIGHT + 2) * scale;
+    const glm::vec4 text_color(1.0f, 1.0f, 1.0f, 1.0f), header_color(1.0f, 0.85f, 0.4f, 1.0f);
+    const int columns = 46;
+
+    overlay.Box(0.0f, 0.0f, 2.0f * margin + columns * TextOverlay::CELL_WIDTH * scale, 2.0f * margin + (TIMED_PASS_COUNT + 2) * line_height,
+                glm::vec4(0.0f, 0.0f, 0.0f, 0.6f));
+
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %6s %6s %6s %6s %6s", "PASS MS", "CPU", "GPU", "P50", "P95", "MAX");
+    overlay.Text(margin, margin, line, header_color, scale);
+    for (int pass = 0; pass < TIMED_PASS_COUNT; pass++)
+    {
+        PassTimeStats cpu = timer.Rolling((TimedPass)pass, false), gpu = timer.Rolling((TimedPass)pass, true);
+        snprintf(line, sizeof(line), "%-10s %6.2f %6.2f %6.2f %6.2f %6.2f", TimedPassName((TimedPass)pass), cpu.avg, gpu.avg, gpu.p50, gpu.p95, gpu.max);
+        overlay.Text(margin, margin + (pass + 1) * line_height, line, text_color, scale);
+    }
+    snprintf(line, sizeof(line), "%u FRAMES, %llu DROPPED", (unsigned int)timer.RollingFrames(), timer.DroppedFrames());
+    overlay.Text(margin, margin + (TIMED_PASS_COUNT + 1) * line_height, line, header_color, scale);
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef PASS_TIMER_H
+#define PASS_TIMER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// render passes of a frame that are timed on their own, a pass may run several times per frame (the skybox is drawn
+// inside the reflection and the main pass), its times are summed
+enum TimedPass
+{
+    TIMED_PASS_SHADOW = 0,
+    TIMED_PASS_REFLECTION,
+    TIMED_PASS_GBUFFER,         // --deferred: culling and the lit materials into the G-buffer
+    TIMED_PASS_LIGHTING,        // --deferred: the scene light and the point lights
+    TIMED_PASS_FORWARD,         // --deferred: the materials the G-buffer does not hold (instead of the main pass)
+    TIMED_PASS_MAIN,
+    TIMED_PASS_MIRROR,
+    TIMED_PASS_SKYBOX,
+    TIMED_PASS_COUNT
+};
+
+const char * TimedPassName(TimedPass pass)
+{
+    static const char * names[TIMED_PASS_COUNT] = { "shadow", "reflection", "gbuffer", "lighting", "forward", "main", "mirror", "skybox" };
+    return names[pass];
+}
+
+// average and percentiles of the times of a pass over some frames, in ms
+struct PassTimeStats
+{
+    double avg = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+
+    static PassTimeStats FromValues(vector<double> values)
+    {
+        PassTimeStats stats;
+        if (values.empty())
+            return stats;
+        sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        auto percentile = [&values](double p) { return values[min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5))]; };
+        stats.avg = sum / values.size();
+        stats.p50 = percentile(0.5);
+        stats.p95 = percentile(0.95);
+        stats.p99 = percentile(0.99);
+        stats.max = values.back();
+        return stats;
+    }
+};
+
+// CPU and GPU time of every pass of a frame, Begin / End around a pass
+//
+// the GPU side writes a GL_TIMESTAMP before and after each scope (not GL_TIME_ELAPSED: scopes nest, and the headless
+// FrameTimer keeps its GL_TIME_ELAPSED query open over the whole frame), the queries of a frame are read back
+// RING_SIZE - 1 frames later at most and only once they are available, so the CPU never waits for the GPU:
+// a frame whose results are still not there when its queries are needed again is dropped (counted in the report)
+//
+// the last WINDOW_SIZE frames feed the rolling statistics (the overlay), with history every frame is kept for the
+// report and the csv file of the headless mode
+class PassTimer
+{
+public:
+
+    struct Sample
+    {
+        int frame;
+        double cpu_ms[TIMED_PASS_COUNT];
+        double gpu_ms[TIMED_PASS_COUNT];
+    };
+
+    static PassTimer & Get()
+    {
+        static PassTimer timer;
+        return timer;
+    }
+
+    void Create(bool history)
+    {
+        glGenQueries(2 * RING_SIZE * MAX_SCOPES, queries);
+        keep_history = history;
+        enabled = true;
+    }
+
+    bool Enabled() const { return enabled; }
+
+    // collects the frames the GPU has finished and starts the scopes of frame
+    void BeginFrame(int frame)
+    {
+        if (!enabled)
+            return;
+        slot = frame % RING_SIZE;
+        // the oldest frames first, the GPU finishes them in order
+        for (int i = 1; i <= RING_SIZE; i++)
+        {
+            int pending_slot = (slot + i) % RING_SIZE;
+            if (!frames[pending_slot].pending)
+                continue;
+            if (!Available(pending_slot))
+                break;
+            Collect(pending_slot);
+        }
+        if (frames[slot].pending)
+        {
+            frames[slot].pending = false;
+            dropped++;
+        }
+
+        FrameSlot & frame_slot = frames[slot];
+        frame_slot.frame = frame;
+        frame_slot.scope_count = 0;
+        fill(frame_slot.cpu_ms, frame_slot.cpu_ms + TIMED_PASS_COUNT, 0.0);
+        open_scopes.clear();
+    }
+
+    void Begin(TimedPass pass)
+    {
+        if (!enabled)
+            return;
+        FrameSlot & frame_slot = frames[slot];
+        OpenScope scope = { pass, -1, chrono::high_resolution_clock::now() };
+        // scopes beyond MAX_SCOPES keep their CPU time only
+        if (frame_slot.scope_count < MAX_SCOPES)
+        {
+            scope.index = frame_slot.scope_count++;
+            frame_slot.scope_passes[scope.index] = pass;
+            glQueryCounter(queries[2 * (slot * MAX_SCOPES + scope.index)], GL_TIMESTAMP);
+        }
+        open_scopes.push_back(scope);
+    }
+
+    // closes the innermost open scope (which has to be the one of pass)
+    void End(TimedPass pass)
+    {
+        if (!enabled || open_scopes.empty() || open_scopes.back().pass != pass)
+            return;
+        OpenScope scope = open_scopes.back();
+        open_scopes.pop_back();
+        if (scope.index >= 0)
+            glQueryCounter(queries[2 * (slot * MAX_SCOPES + scope.index) + 1], GL_TIMESTAMP);
+        frames[slot].cpu_ms[pass] += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - scope.cpu_start).count();
+    }
+
+    void EndFrame()
+    {
+        if (enabled)
+            frames[slot].pending = frames[slot].scope_count > 0;
+    }
+
+    // waits for all outstanding queries (at exit)
+    void Finish()
+    {
+        if (!enabled)
+            return;
+        for (int i = 1; i <= RING_SIZE; i++)
+        {
+            int pending_slot = (slot + i) % RING_SIZE;
+            if (frames[pending_slot].pending)
+                Collect(pending_slot);
+        }
+    }
+
+    // statistics of a pass over the last WINDOW_SIZE collected frames
+    PassTimeStats Rolling(TimedPass pass, bool gpu) const
+    {
+        vector<double> values;
+        for (const Sample & sample : recent)
+            values.push_back(gpu ? sample.gpu_ms[pass] : sample.cpu_ms[pass]);
+        return PassTimeStats::FromValues(values);
+    }
+
+    size_t RollingFrames() const { return recent.size(); }
+    // every collected frame, only kept with history
+    const vector<Sample> & History() const { return history; }
+    unsigned long long DroppedFrames() const { return dropped; }
+
+    // statistics of every pass over the recorded frames after the warmup
+    void PrintReport(int warmup) const
+    {
+        if (!enabled)
+            return;
+        vector<Sample> measured = Measured(warmup);
+        cout << "PASS_TIMER:: " << measured.size() << " frames measured, " << dropped << " dropped (results not ready in "
+             << RING_SIZE << " frames)" << endl;
+        if (measured.empty())
+            return;
+        for (int pass = 0; pass < TIMED_PASS_COUNT; pass++)
+        {
+            vector<double> cpu, gpu;
+            for (const Sample & sample : measured)
+            {
+                cpu.push_back(sample.cpu_ms[pass]);
+                gpu.push_back(sample.gpu_ms[pass]);
+            }
+            PassTimeStats cpu_stats = PassTimeStats::FromValues(cpu), gpu_stats = PassTimeStats::FromValues(gpu);
+            cout << "PASS_TIMER:: " << TimedPassName((TimedPass)pass) << ": cpu ms avg = " << cpu_stats.avg << ", p95 = " << cpu_stats.p95
+                 << "; gpu ms avg = " << gpu_stats.avg << ", p50 = " << gpu_stats.p50 << ", p95 = " << gpu_stats.p95
+                 << ", p99 = " << gpu_stats.p99 << ", max = " << gpu_stats.max << endl;
+        }
+    }
+
+    // one row per recorded frame after the warmup, cpu and gpu ms of every pass
+    void WriteCsv(const string & path, int warmup) const
+    {
+        ofstream csv(path);
+        if (!csv)
+        {
+            cout << "ERROR::PASS_TIMER:: Cannot write " << path << endl;
+            return;
+        }
+        csv << "frame";
+        for (int pass = 0; pass < TIMED_PASS_COUNT; pass++)
+            csv << ',' << TimedPassName((TimedPass)pass) << "_cpu_ms," << TimedPassName((TimedPass)pass) << "_gpu_ms";
+        csv << '\n';
+        for (const Sample & sample : Measured(warmup))
+        {
+            csv << sample.frame;
+            for (int pass = 0; pass < TIMED_PASS_COUNT; pass++)
+                csv << ',' << sample.cpu_ms[pass] << ',' << sample.gpu_ms[pass];
+            csv << '\n';
+        }
+        cout << "PASS_TIMER:: per-pass timings written to " << path << endl;
+    }
+
+    void Destroy()
+    {
+        if (enabled)
+            glDeleteQueries(2 * RING_SIZE * MAX_SCOPES, queries);
+        enabled = false;
+    }
+
+private:
+
+    static const int RING_SIZE = 8;
+    static const int MAX_SCOPES = 16;
+    static const size_t WINDOW_SIZE = 240;
+
+    struct FrameSlot
+    {
+        int frame = 0;
+        bool pending = false;
+        int scope_count = 0;
+        TimedPass scope_passes[MAX_SCOPES];
+        double cpu_ms[TIMED_PASS_COUNT] = {};
+    };
+
+    struct OpenScope
+    {
+        TimedPass pass;
+        int index;
+        chrono::high_resolution_clock::time_point cpu_start;
+    };
+
+    bool enabled = false;
+    bool keep_history = false;
+    // a start and an end timestamp per scope, MAX_SCOPES scopes per frame of the ring
+    GLuint queries[2 * RING_SIZE * MAX_SCOPES];
+    FrameSlot frames[RING_SIZE];
+    int slot = 0;
+    vector<OpenScope> open_scopes;
+    deque<Sample> recent;
+    vector<Sample> history;
+    unsigned long long dropped = 0;
+
+    PassTimer() {}
+
+    // the end of the last scope is the last query of the frame
+    bool Available(int frame_slot) const
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[2 * (frame_slot * MAX_SCOPES + frames[frame_slot].scope_count - 1) + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        return available != 0;
+    }
+
+    void Collect(int frame_slot)
+    {
+        FrameSlot & frame = frames[frame_slot];
+        Sample sample;
+        sample.frame = frame.frame;
+        for (int pass = 0; pass < TIMED_PASS_COUNT; pass++)
+        {
+            sample.cpu_ms[pass] = frame.cpu_ms[pass];
+            sample.gpu_ms[pass] = 0.0;
+        }
+        for (int scope = 0; scope < frame.scope_count; scope++)
+        {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries[2 * (frame_slot * MAX_SCOPES + scope)], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[2 * (frame_slot * MAX_SCOPES + scope) + 1], GL_QUERY_RESULT, &end);
+            sample.gpu_ms[frame.scope_passes[scope]] += (end - start) / 1.0e6;
+        }
+        frame.pending = false;
+
+        recent.push_back(sample);
+        if (recent.size() > WINDOW_SIZE)
+            recent.pop_front();
+        if (keep_history)
+            history.push_back(sample);
+    }
+
+    vector<Sample> Measured(int warmup) const
+    {
+        vector<Sample> measured;
+        for (const Sample & sample : history)
+            if (sample.frame >= warmup)
+                measured.push_back(sample);
+        return measured;
+    }
+};
+
+#endif
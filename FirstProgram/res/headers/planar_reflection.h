@@ -0,0 +1,372 @@
+#ifndef PLANAR_REFLECTION_H
+#define PLANAR_REFLECTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "gl_state.h"
+#include "shader.h"
+
+using namespace std;
+
+// reflection about the plane dot(plane.xyz, p) + plane.w = 0 (plane.xyz normalized)
+glm::mat4 ReflectionMatrix(const glm::vec4 & plane)
+{
+    glm::vec3 n = glm::vec3(plane);
+    glm::mat4 reflection(1.0f);
+    for (int column = 0; column < 3; column++)
+        for (int row = 0; row < 3; row++)
+            reflection[column][row] -= 2.0f * n[row] * n[column];
+    for (int row = 0; row < 3; row++)
+        reflection[3][row] = -2.0f * plane.w * n[row];
+    return reflection;
+}
+
+// replaces the near plane of a perspective projection with the view space plane clip_plane (the camera on its negative
+// side), so the clipping happens against it at no cost and the depth range stays in use (Lengyel, "Oblique View Frustum
+// Depth Projection and Clipping"); the far plane is tilted with it
+glm::mat4 ObliqueProjection(glm::mat4 projection, const glm::vec4 & clip_plane)
+{
+    // clip_plane transformed into the corner of the clip volume opposite to it
+    glm::vec4 q;
+    q.x = ((clip_plane.x > 0.0f ? 1.0f : clip_plane.x < 0.0f ? -1.0f : 0.0f) + projection[2][0]) / projection[0][0];
+    q.y = ((clip_plane.y > 0.0f ? 1.0f : clip_plane.y < 0.0f ? -1.0f : 0.0f) + projection[2][1]) / projection[1][1];
+    q.z = -1.0f;
+    q.w = (1.0f + projection[2][2]) / projection[3][2];
+    glm::vec4 c = clip_plane * (2.0f / glm::dot(clip_plane, q));
+    // third row = c - fourth row
+    projection[0][2] = c.x - projection[0][3];
+    projection[1][2] = c.y - projection[1][3];
+    projection[2][2] = c.z - projection[2][3];
+    projection[3][2] = c.w - projection[3][3];
+    return projection;
+}
+
+// the mirror as a render pass: a planar reflection rendered into a texture the mirror surface samples with projective
+// texture coordinates (the view projection the texture was rendered with, see Matrix)
+//
+// the mirror is a rectangle: the quad [-1, 1] x [-1, 1] in the xz plane of its model transform, facing its local +y
+// the reflected camera is the view camera mirrored at its plane, with the plane as oblique near plane, so everything
+// behind the mirror is clipped; its projection is cropped to the rectangle of the mirror on the screen, so the frustum
+// used for culling covers the mirror only, and it is drawn into a scissored corner of the texture with as many texels as
+// the rectangle has pixels (times the scale), a small or distant mirror costs a small pass
+//
+// the pass is skipped while the mirror cannot be seen: its back faces the camera, it lies outside the view frustum, or
+// the occlusion query around the mirror surface of an earlier frame found none of its pixels (read only once available,
+// the CPU never waits for it); a mirror coming out from behind an occluder shows the old texture for a frame or two
+//
+// the texture is redrawn every interval frames, with on_change only when the view or the light moved since the last
+// redraw; between redraws the mirror keeps sampling the last one through its own matrix, so it stays in place
+class PlanarReflection
+{
+public:
+
+    // texture of the screen size x scale: a mirror filling the screen gets all of it (if the window grows later, the
+    // drawn rectangle is clamped to the texture)
+    void Create(GLuint screen_width, GLuint screen_height, float scale)
+    {
+        this->scale = scale;
+        width = max(1u, (GLuint)lround(screen_width * scale));
+        height = max(1u, (GLuint)lround(screen_height * scale));
+        viewport_width = width;
+        viewport_height = height;
+
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+
+        // depth and stencil are not sampled, a renderbuffer is enough
+        glGenRenderbuffers(1, &RBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, RBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, RBO);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    // redraw every interval frames (at least 1), on_change skips the redraws in which nothing moved
+    void SetUpdateRate(int interval, bool on_change)
+    {
+        this->interval = max(1, interval);
+        this->on_change = on_change;
+    }
+
+    // without culling the texture is drawn whole, whether the mirror is visible or not
+    void SetCulling(bool culling)
+    {
+        this->culling = culling;
+    }
+
+    // places the mirror rectangle, see the class comment
+    void SetMirror(const glm::mat4 & transform)
+    {
+        glm::vec3 normal = glm::normalize(glm::vec3(glm::transpose(glm::inverse(transform)) * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f)));
+        glm::vec3 center = glm::vec3(transform[3]);
+        plane = glm::vec4(normal, -glm::dot(normal, center));
+        reflection = ReflectionMatrix(plane);
+        static const glm::vec4 local_corners[4] = {
+            glm::vec4(-1.0f, 0.0f, -1.0f, 1.0f), glm::vec4(1.0f, 0.0f, -1.0f, 1.0f), glm::vec4(1.0f, 0.0f, 1.0f, 1.0f), glm::vec4(-1.0f, 0.0f, 1.0f, 1.0f)
+        };
+        for (int i = 0; i < 4; i++)
+            corners[i] = glm::vec3(transform * local_corners[i]);
+    }
+
+    // the reflected camera of a view: view * reflection, and the projection with the mirror as near plane cropped to the
+    // screen rectangle of the mirror; the eye is the reflected eye, its side of the plane flips (see ObliqueProjection)
+    // also decides whether the mirror is in view and the size of the rectangle drawn for a screen of that size
+    void Reflect(const glm::mat4 & view, const glm::mat4 & projection, GLuint screen_width, GLuint screen_height,
+                 glm::mat4 & reflected_view, glm::mat4 & reflected_projection)
+    {
+        glm::mat4 view_projection = projection * view;
+        glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+        in_view = glm::dot(glm::vec3(plane), eye) + plane.w > 0.0f && InFrustum(view_projection);
+
+        reflected_view = view * reflection;
+        glm::vec4 view_plane = glm::transpose(glm::inverse(reflected_view)) * plane;
+        glm::vec2 extent;
+        reflected_projection = Crop(view_projection, extent) * ObliqueProjection(projection, view_plane);
+
+        pending_width = width;
+        pending_height = height;
+        if (culling)
+        {
+            pending_width = glm::clamp((GLuint)ceil(extent.x * 0.5f * screen_width * scale), 1u, width);
+            pending_height = glm::clamp((GLuint)ceil(extent.y * 0.5f * screen_height * scale), 1u, height);
+        }
+    }
+
+    // true if the texture has to be redrawn in frame for the reflected camera view_projection and the light
+    bool NeedsUpdate(int frame, const glm::mat4 & view_projection, const glm::vec3 & light_pos)
+    {
+        frames++;
+        CollectQueries(frame);
+        if (culling && !in_view)
+        {
+            skipped_outside++;
+            return false;
+        }
+        if (culling && Occluded(frame))
+        {
+            skipped_occluded++;
+            return false;
+        }
+        if (updates > 0 && frame - last_update < interval)
+            return false;
+        if (updates > 0 && on_change && view_projection == last_view_projection && light_pos == last_light_pos &&
+            pending_width == viewport_width && pending_height == viewport_height)
+            return false;
+        last_update = frame;
+        last_view_projection = view_projection;
+        last_light_pos = light_pos;
+        viewport_width = pending_width;
+        viewport_height = pending_height;
+        updates++;
+        drawn_texels += (unsigned long long)viewport_width * viewport_height;
+        return true;
+    }
+
+    // binds the framebuffer, the viewport and scissor rectangle of the drawn corner (the clear stays inside it)
+    void BeginRender() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, viewport_width, viewport_height);
+        glScissor(0, 0, viewport_width, viewport_height);
+        glEnable(GL_SCISSOR_TEST);
+    }
+
+    void EndRender() const
+    {
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    // wrap the draw of the mirror surface in the main pass (after the occluders), the result decides about the pass of
+    // a later frame; nothing is queried while the mirror is out of view, the frustum test covers that
+    void BeginOcclusionQuery(int frame)
+    {
+        query_open = culling && in_view;
+        if (!query_open)
+            return;
+        int index = frame % QUERY_COUNT;
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[index]);
+        query_frames[index] = frame;
+    }
+
+    void EndOcclusionQuery()
+    {
+        if (query_open)
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+        query_open = false;
+    }
+
+    GLuint Texture() const { return texture; }
+    GLuint Width() const { return width; }
+    GLuint Height() const { return height; }
+    // the corner of the texture the last redraw went to
+    GLuint ViewportWidth() const { return viewport_width; }
+    GLuint ViewportHeight() const { return viewport_height; }
+
+    // world to texture clip space of the current texture (the mirror shader projects its surface with it): the view
+    // projection of the last redraw, its clip volume squeezed into the drawn corner
+    glm::mat4 Matrix() const
+    {
+        float x = (float)viewport_width / width, y = (float)viewport_height / height;
+        glm::mat4 corner(1.0f);
+        corner[0][0] = x;
+        corner[1][1] = y;
+        corner[3][0] = x - 1.0f;
+        corner[3][1] = y - 1.0f;
+        return corner * last_view_projection;
+    }
+
+    void PrintReport() const
+    {
+        cout << "REFLECTION:: " << width << "x" << height << " texture, redrawn in " << updates << " of " << frames << " frames (every "
+             << interval << (on_change ? " frames, on change)" : " frames)") << endl;
+        if (culling)
+            cout << "REFLECTION:: skipped in " << skipped_outside << " frames outside the view and " << skipped_occluded
+                 << " occluded, " << (updates > 0 ? 100.0 * drawn_texels / ((double)updates * width * height) : 0.0)
+                 << "% of the texture drawn on average" << endl;
+    }
+
+    void Destroy()
+    {
+        GLStateCache::Get().ForgetTexture(texture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(1, &texture);
+        glDeleteRenderbuffers(1, &RBO);
+        if (texture)
+            glDeleteQueries(QUERY_COUNT, queries);
+        FBO = texture = RBO = 0;
+    }
+
+private:
+
+    // queries in flight, a result older than that is not trusted any more
+    static const int QUERY_COUNT = 4;
+
+    float scale = 1.0f;
+    GLuint width = 0, height = 0;
+    GLuint FBO = 0, texture = 0, RBO = 0;
+    glm::vec4 plane = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    glm::mat4 reflection = glm::mat4(1.0f);
+    glm::vec3 corners[4];
+
+    int interval = 1;
+    bool on_change = false;
+    int last_update = 0;
+    glm::mat4 last_view_projection = glm::mat4(1.0f);
+    glm::vec3 last_light_pos = glm::vec3(0.0f);
+    unsigned long long updates = 0, frames = 0;
+
+    // visibility of the current frame and the size of the corner it would be drawn into
+    bool culling = true;
+    bool in_view = true;
+    GLuint pending_width = 0, pending_height = 0;
+    GLuint viewport_width = 0, viewport_height = 0;
+    unsigned long long skipped_outside = 0, skipped_occluded = 0, drawn_texels = 0;
+
+    // occlusion queries by frame % QUERY_COUNT (-1 = none pending), the newest result read
+    GLuint queries[QUERY_COUNT];
+    int query_frames[QUERY_COUNT] = { -1, -1, -1, -1 };
+    bool query_open = false;
+    int result_frame = -1;
+    bool result_visible = true;
+
+    // the corners in clip space of the view: outside if all of them are beyond one of the six planes
+    bool InFrustum(const glm::mat4 & view_projection) const
+    {
+        glm::vec4 clip[4];
+        for (int i = 0; i < 4; i++)
+            clip[i] = view_projection * glm::vec4(corners[i], 1.0f);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            bool below = true, above = true;
+            for (const glm::vec4 & corner : clip)
+            {
+                below = below && corner[axis] < -corner.w;
+                above = above && corner[axis] > corner.w;
+            }
+            if (below || above)
+                return false;
+        }
+        return true;
+    }
+
+    // reads the queries whose results are there, oldest first, without waiting for the others
+    void CollectQueries(int frame)
+    {
+        for (int i = 1; i <= QUERY_COUNT; i++)
+        {
+            int index = (frame + i) % QUERY_COUNT;
+            if (query_frames[index] < 0)
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint samples = 0;
+            glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT, &samples);
+            if (query_frames[index] > result_frame)
+            {
+                result_frame = query_frames[index];
+                result_visible = samples != 0;
+            }
+            query_frames[index] = -1;
+        }
+    }
+
+    // hidden by the depth of the last frames: a missing or old result counts as visible
+    bool Occluded(int frame) const
+    {
+        return result_frame >= 0 && frame - result_frame <= QUERY_COUNT && !result_visible;
+    }
+
+    // maps the screen rectangle of the mirror to the whole clip volume (x and y only), extent is its size in NDC; the
+    // corners lie on the plane, so they are at the same place in the view and its reflection; if one is behind the eye
+    // the rectangle is the screen
+    glm::mat4 Crop(const glm::mat4 & view_projection, glm::vec2 & extent) const
+    {
+        extent = glm::vec2(2.0f);
+        glm::vec2 low(1.0f), high(-1.0f);
+        for (const glm::vec3 & corner : corners)
+        {
+            glm::vec4 clip = view_projection * glm::vec4(corner, 1.0f);
+            if (clip.w <= 1.0e-4f)
+                return glm::mat4(1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            low = glm::min(low, ndc);
+            high = glm::max(high, ndc);
+        }
+        low = glm::max(low, glm::vec2(-1.0f));
+        high = glm::min(high, glm::vec2(1.0f));
+        // off screen (or a sliver): nothing to crop to
+        if (high.x - low.x < 1.0e-3f || high.y - low.y < 1.0e-3f)
+            return glm::mat4(1.0f);
+
+        extent = high - low;
+        glm::mat4 crop(1.0f);
+        crop[0][0] = 2.0f / (high.x - low.x);
+        crop[1][1] = 2.0f / (high.y - low.y);
+        crop[3][0] = -(high.x + low.x) / (high.x - low.x);
+        crop[3][1] = -(high.y + low.y) / (high.y - low.y);
+        return crop;
+    }
+};
+
+#endif
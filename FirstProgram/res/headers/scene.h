@@ -0,0 +1,287 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json.h"
+
+using namespace std;
+
+// textures owned by the renderer that a material binds (each on its fixed unit, see TextureUnit)
+enum SceneTextureSource
+{
+    SHADOW_CUBEMAP_SOURCE = 0,
+    SKYBOX_CUBEMAP_SOURCE = 1
+};
+
+struct SceneMaterial
+{
+    string name;
+    string shader;                                   // program name, resolved by the renderer
+    bool has_object_color = false, has_color = false;
+    glm::vec3 object_color = glm::vec3(1.0f), color = glm::vec3(1.0f);
+    int mode = -1;                                   // environment mapping mode (0 = refraction, 1 = reflection), -1 = not set
+    vector<SceneTextureSource> textures;
+};
+
+enum InstanceFlags
+{
+    INSTANCE_DRAW = 1,           // drawn in the camera views
+    INSTANCE_SHADOW_CASTER = 2,  // drawn into the shadow cubemap
+    INSTANCE_FOLLOW_LIGHT = 4    // transform is relative to the light position
+};
+
+// scene file (res/scenes/*.json):
+// {
+//   "models":    { "<name>": "<path to .obj>" | { "path": "<path to .obj>", "vertex_format": "float" | "packed" }, ... },
+//   "materials": { "<name>": { "shader": "<program>", "object_color": [r, g, b], "color": [r, g, b], "mode": 0,
+//                              "textures": [ "shadow" | "skybox", ... ] }, ... },
+//   "skybox":    { "model": "<name>", "material": "<name>", "faces": [ "+x", "-x", "+y", "-y", "+z", "-z" image paths ] },
+//   "instances": [ { "model": "<name>", "material": "<name>", <transform>,
+//                    "draw": true, "shadow": false, "follow_light": false }, ... ],
+//   "grids":     [ { "model": ..., "material": ..., "count": [nx, ny, nz], "spacing": [dx, dy, dz], "origin": [x, y, z],
+//                    <transform of every instance>, "draw": true, "shadow": false }, ... ]
+// }
+// <transform> is either "matrix": [16 numbers, column-major] or any of "position": [x, y, z],
+// "rotate": [ [ax, ay, az, degrees], ... ] and "scale": s or [sx, sy, sz], applied as translate * rotate... * scale
+// instances are drawn in file order, followed by the grids
+class Scene
+{
+public:
+    vector<string> model_names, model_paths;
+    vector<bool> model_packed_vertices;              // "vertex_format": "packed" (see VertexFormat)
+    vector<SceneMaterial> materials;
+    vector<string> skybox_faces;
+    int skybox_model = -1, skybox_material = -1;
+
+    // flat instance arrays
+    vector<glm::mat4> transforms;
+    vector<unsigned int> instance_model, instance_material;
+    vector<unsigned char> instance_flags;
+
+    size_t InstanceCount() const { return transforms.size(); }
+
+    glm::mat4 WorldTransform(size_t instance, const glm::vec3 & light_pos) const
+    {
+        if (instance_flags[instance] & INSTANCE_FOLLOW_LIGHT)
+            return glm::translate(glm::mat4(1.0f), light_pos) * transforms[instance];
+        return transforms[instance];
+    }
+
+    bool Load(const string & path)
+    {
+        JsonValue root;
+        if (!JsonParser::ParseFile(path, root))
+            return false;
+        if (!root.IsObject())
+            return Fail(path, "the document is not an object");
+
+        const JsonValue * models = root.Find("models");
+        if (models && models->IsObject())
+            for (const pair<string, JsonValue> & model : models->members)
+            {
+                model_names.push_back(model.first);
+                if (!model.second.IsObject())
+                {
+                    model_paths.push_back(model.second.text);
+                    model_packed_vertices.push_back(false);
+                    continue;
+                }
+                model_paths.push_back(model.second.String("path", ""));
+                string format = model.second.String("vertex_format", "float");
+                if (format != "float" && format != "packed")
+                    return Fail(path, "model " + model.first + ": unknown vertex format '" + format + "'");
+                model_packed_vertices.push_back(format == "packed");
+            }
+
+        const JsonValue * material_list = root.Find("materials");
+        if (material_list && material_list->IsObject())
+            for (const pair<string, JsonValue> & entry : material_list->members)
+                if (!ParseMaterial(entry.first, entry.second, path))
+                    return false;
+
+        const JsonValue * skybox = root.Find("skybox");
+        if (skybox && skybox->IsObject())
+        {
+            skybox_model = FindIndex(model_names, skybox->String("model", ""));
+            skybox_material = FindMaterial(skybox->String("material", ""));
+            const JsonValue * faces = skybox->Find("faces");
+            if (faces && faces->IsArray())
+                for (const JsonValue & face : faces->items)
+                    skybox_faces.push_back(face.text);
+            if (skybox_model < 0 || skybox_material < 0 || skybox_faces.size() != 6)
+                return Fail(path, "the skybox needs a known model, a known material and six faces");
+        }
+
+        const JsonValue * instances = root.Find("instances");
+        if (instances && instances->IsArray())
+            for (const JsonValue & instance : instances->items)
+            {
+                unsigned int model, material;
+                unsigned char flags;
+                if (!ParseInstanceCommon(instance, path, model, material, flags))
+                    return false;
+                Add(model, material, flags, ParseTransform(instance));
+            }
+
+        const JsonValue * grids = root.Find("grids");
+        if (grids && grids->IsArray())
+            for (const JsonValue & grid : grids->items)
+            {
+                unsigned int model, material;
+                unsigned char flags;
+                if (!ParseInstanceCommon(grid, path, model, material, flags))
+                    return false;
+                glm::vec3 count = Vec3(grid.Find("count"), glm::vec3(1.0f));
+                glm::vec3 spacing = Vec3(grid.Find("spacing"), glm::vec3(1.0f));
+                glm::vec3 origin = Vec3(grid.Find("origin"), glm::vec3(0.0f));
+                glm::mat4 local = ParseTransform(grid);
+
+                transforms.reserve(transforms.size() + (size_t)(count.x * count.y * count.z));
+                for (int x = 0; x < (int)count.x; x++)
+                    for (int y = 0; y < (int)count.y; y++)
+                        for (int z = 0; z < (int)count.z; z++)
+                        {
+                            glm::vec3 position = origin + spacing * glm::vec3((float)x, (float)y, (float)z);
+                            Add(model, material, flags, glm::translate(glm::mat4(1.0f), position) * local);
+                        }
+            }
+
+        cout << "SCENE:: " << path << ": " << model_names.size() << " models, " << materials.size() << " materials, "
+             << InstanceCount() << " instances" << endl;
+        return true;
+    }
+
+private:
+
+    static bool Fail(const string & path, const string & message)
+    {
+        cout << "ERROR::SCENE:: " << path << ": " << message << endl;
+        return false;
+    }
+
+    static int FindIndex(const vector<string> & names, const string & name)
+    {
+        for (size_t i = 0; i < names.size(); i++)
+            if (names[i] == name)
+                return (int)i;
+        return -1;
+    }
+
+    int FindMaterial(const string & name) const
+    {
+        for (size_t i = 0; i < materials.size(); i++)
+            if (materials[i].name == name)
+                return (int)i;
+        return -1;
+    }
+
+    static glm::vec3 Vec3(const JsonValue * value, const glm::vec3 & fallback)
+    {
+        if (value && value->IsNumber())
+            return glm::vec3((float)value->number);
+        if (!value || !value->IsArray() || value->items.size() != 3)
+            return fallback;
+        return glm::vec3((float)value->items[0].number, (float)value->items[1].number, (float)value->items[2].number);
+    }
+
+    void Add(unsigned int model, unsigned int material, unsigned char flags, const glm::mat4 & transform)
+    {
+        transforms.push_back(transform);
+        instance_model.push_back(model);
+        instance_material.push_back(material);
+        instance_flags.push_back(flags);
+    }
+
+    bool ParseMaterial(const string & name, const JsonValue & value, const string & path)
+    {
+        SceneMaterial material;
+        material.name = name;
+        material.shader = value.String("shader", "");
+        if (material.shader.empty())
+            return Fail(path, "material " + name + " has no shader");
+
+        if (value.Find("object_color"))
+        {
+            material.has_object_color = true;
+            material.object_color = Vec3(value.Find("object_color"), glm::vec3(1.0f));
+        }
+        if (value.Find("color"))
+        {
+            material.has_color = true;
+            material.color = Vec3(value.Find("color"), glm::vec3(1.0f));
+        }
+        material.mode = (int)value.Number("mode", -1.0);
+
+        const JsonValue * textures = value.Find("textures");
+        if (textures && textures->IsArray())
+            for (const JsonValue & texture : textures->items)
+            {
+                if (texture.text != "shadow" && texture.text != "skybox")
+                    return Fail(path, "material " + name + ": unknown texture source '" + texture.text + "'");
+                material.textures.push_back(texture.text == "shadow" ? SHADOW_CUBEMAP_SOURCE : SKYBOX_CUBEMAP_SOURCE);
+            }
+
+        materials.push_back(material);
+        return true;
+    }
+
+    bool ParseInstanceCommon(const JsonValue & value, const string & path, unsigned int & model, unsigned int & material, unsigned char & flags) const
+    {
+        int model_index = FindIndex(model_names, value.String("model", ""));
+        int material_index = FindMaterial(value.String("material", ""));
+        if (model_index < 0)
+            return Fail(path, "unknown model '" + value.String("model", "") + "'");
+        if (material_index < 0)
+            return Fail(path, "unknown material '" + value.String("material", "") + "'");
+
+        model = (unsigned int)model_index;
+        material = (unsigned int)material_index;
+        flags = 0;
+        if (value.Bool("draw", true))
+            flags |= INSTANCE_DRAW;
+        if (value.Bool("shadow", false))
+            flags |= INSTANCE_SHADOW_CASTER;
+        if (value.Bool("follow_light", false))
+            flags |= INSTANCE_FOLLOW_LIGHT;
+        return true;
+    }
+
+    static glm::mat4 ParseTransform(const JsonValue & value)
+    {
+        const JsonValue * matrix = value.Find("matrix");
+        if (matrix && matrix->IsArray() && matrix->items.size() == 16)
+        {
+            glm::mat4 transform;
+            for (int i = 0; i < 16; i++)
+                transform[i / 4][i % 4] = (float)matrix->items[i].number;
+            return transform;
+        }
+
+        glm::mat4 transform = glm::mat4(1.0f);
+        const JsonValue * position = value.Find("position");
+        if (position)
+            transform = glm::translate(transform, Vec3(position, glm::vec3(0.0f)));
+        const JsonValue * rotations = value.Find("rotate");
+        if (rotations && rotations->IsArray())
+            for (const JsonValue & rotation : rotations->items)
+                if (rotation.IsArray() && rotation.items.size() == 4)
+                {
+                    glm::vec3 axis((float)rotation.items[0].number, (float)rotation.items[1].number, (float)rotation.items[2].number);
+                    transform = glm::rotate(transform, glm::radians((float)rotation.items[3].number), axis);
+                }
+        const JsonValue * scale = value.Find("scale");
+        if (scale)
+            transform = glm::scale(transform, Vec3(scale, glm::vec3(1.0f)));
+        return transform;
+    }
+};
+
+#endif
@@ -2,10 +2,65 @@
 #define shader_h
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+
+#include "gl_state.h"
+
+// pre-resolved uniform location, setting it needs neither a string nor a glGetUniformLocation call
+// the program has to be in use (Shader::use) when set is called
+template <typename T>
+struct Uniform
+{
+    GLint location = -1;
+
+    void set(const T & value) const;
+    // uploads an array uniform starting at this location (e.g. shadowMatrices[6])
+    void set(const T * values, GLsizei count) const;
+};
+
+template <> inline void Uniform<bool>::set(const bool & value) const { glUniform1i(location, (int)value); }
+template <> inline void Uniform<int>::set(const int & value) const { glUniform1i(location, value); }
+template <> inline void Uniform<int>::set(const int * values, GLsizei count) const { glUniform1iv(location, count, values); }
+template <> inline void Uniform<float>::set(const float & value) const { glUniform1f(location, value); }
+template <> inline void Uniform<glm::vec2>::set(const glm::vec2 & value) const { glUniform2fv(location, 1, &value[0]); }
+template <> inline void Uniform<glm::vec3>::set(const glm::vec3 & value) const { glUniform3fv(location, 1, &value[0]); }
+template <> inline void Uniform<glm::mat4>::set(const glm::mat4 & value) const { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+template <> inline void Uniform<glm::mat4>::set(const glm::mat4 * values, GLsizei count) const { glUniformMatrix4fv(location, count, GL_FALSE, &values[0][0][0]); }
+
+// fixed texture unit of every sampler name used by the shaders, so the sampler uniforms are set once after linking
+// and drawing only binds textures; mesh textures take the units of their type, the renderer textures the ones above
+enum TextureUnit
+{
+    DIFFUSE_TEXTURE_UNIT = 0,   // diffuse_texture1
+    NORMAL_TEXTURE_UNIT,        // normal_texture1
+    SPECULAR_TEXTURE_UNIT,      // specular_texture1
+    HEIGHT_TEXTURE_UNIT,        // height_texture1
+    SHADOW_TEXTURE_UNIT,        // depthMap (shadow cubemap)
+    ENVIRONMENT_TEXTURE_UNIT,   // skybox (environment cubemap)
+    REFLECTION_TEXTURE_UNIT,    // mirrorTexture
+    OVERLAY_TEXTURE_UNIT,       // font (text overlay)
+    GBUFFER_ALBEDO_TEXTURE_UNIT,    // gbuffer_albedo (deferred.h, in the order of the G-buffer textures)
+    GBUFFER_NORMAL_TEXTURE_UNIT,    // gbuffer_normal
+    GBUFFER_MATERIAL_TEXTURE_UNIT,  // gbuffer_material
+    GBUFFER_DEPTH_TEXTURE_UNIT,     // gbuffer_depth
+    TEXTURE_UNIT_COUNT
+};
+
+// unit of a sampler uniform, -1 for names without a fixed unit
+inline GLint SamplerTextureUnit(const std::string & name)
+{
+    static const char * names[TEXTURE_UNIT_COUNT] = { "diffuse_texture1", "normal_texture1", "specular_texture1", "height_texture1", "depthMap", "skybox", "mirrorTexture", "font",
+                                                          "gbuffer_albedo", "gbuffer_normal", "gbuffer_material", "gbuffer_depth" };
+    for (GLint unit = 0; unit < TEXTURE_UNIT_COUNT; unit++)
+        if (name == names[unit])
+            return unit;
+    return -1;
+}
 
 class Shader
 {
@@ -37,8 +92,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            vertexCode = withCommonSource(vShaderStream.str());
+            fragmentCode = withCommonSource(fShaderStream.str());
             // if geometry shader path is present, also load a geometry shader
             if (geometryPath != nullptr)
             {
@@ -46,7 +101,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = withCommonSource(gShaderStream.str());
             }
         }
         catch (std::ifstream::failure& e)
@@ -88,6 +143,8 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        cacheUniformLocations();
+        assignSamplerUnits();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -96,36 +153,142 @@ public:
 
     }
     void use() const {
-        glUseProgram(ID);
+        GLStateCache::Get().UseProgram(ID);
+    }
+
+    // location from the cache filled at link time, -1 for names that are not active uniforms of the program
+    GLint location(const std::string &name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = uniform_locations.find(name);
+        return it != uniform_locations.end() ? it->second : -1;
+    }
+
+    // connect a uniform block of the program to a binding point, does nothing if the program has no such block
+    void bindUniformBlock(const char * block_name, GLuint binding) const
+    {
+        GLuint block_index = glGetUniformBlockIndex(ID, block_name);
+        if (block_index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, block_index, binding);
+    }
+
+    // resolve a uniform once (at startup) and keep the handle for the per-frame updates
+    template <typename T>
+    Uniform<T> uniform(const std::string &name) const
+    {
+        Uniform<T> handle;
+        handle.location = location(name);
+        return handle;
     }
     
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
 private:
+    // name -> location of every active uniform; array elements are stored both as "name[i]" and the plain "name" (element 0)
+    std::unordered_map<std::string, GLint> uniform_locations;
+
+    // points the samplers with a fixed unit (SamplerTextureUnit) at it, once for the lifetime of the program
+    void assignSamplerUnits()
+    {
+        use();
+        for (const std::pair<const std::string, GLint> & uniform : uniform_locations)
+        {
+            GLint unit = SamplerTextureUnit(uniform.first);
+            if (unit >= 0)
+                glUniform1i(uniform.second, unit);
+        }
+    }
+
+    // query all active uniforms once after linking, so no glGetUniformLocation is needed while rendering
+    void cacheUniformLocations()
+    {
+        GLint count = 0, max_length = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+        std::string name(max_length, '\0');
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, max_length, &length, &size, &type, &name[0]);
+            std::string uniform_name(name.c_str(), length);
+
+            // members of uniform blocks have no location
+            GLint uniform_location = glGetUniformLocation(ID, uniform_name.c_str());
+            if (uniform_location < 0)
+                continue;
+
+            // arrays are reported as "name[0]" with their size
+            std::string::size_type bracket = uniform_name.find('[');
+            if (bracket == std::string::npos)
+            {
+                uniform_locations[uniform_name] = uniform_location;
+                continue;
+            }
+            std::string base_name = uniform_name.substr(0, bracket);
+            uniform_locations[base_name] = uniform_location;
+            for (GLint element = 0; element < size; element++)
+            {
+                std::string element_name = base_name + "[" + std::to_string(element) + "]";
+                uniform_locations[element_name] = glGetUniformLocation(ID, element_name.c_str());
+            }
+        }
+    }
+
+    // inserts res/shaders/common.glsl after the directives at the top of a stage (#version, #extension), which have
+    // to come first; #line keeps the line numbers of compile errors the ones of the file
+    static std::string withCommonSource(const std::string & code)
+    {
+        static const std::string common = readCommonSource();
+        size_t end = 0;
+        int lines = 0;
+        while (end < code.size() && code[end] == '#')
+        {
+            size_t next = code.find('\n', end);
+            end = next == std::string::npos ? code.size() : next + 1;
+            lines++;
+        }
+        return code.substr(0, end) + common + "\n#line " + std::to_string(lines + 1) + "\n" + code.substr(end);
+    }
+
+    static std::string readCommonSource()
+    {
+        std::ifstream file("res/shaders/common.glsl");
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: res/shaders/common.glsl" << std::endl;
+            return std::string();
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        return stream.str();
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,465 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "Model.h"
+#include "cluster_culling.h"
+#include "culling.h"
+#include "gl_state.h"
+#include "shader.h"
+#include "trace.h"
+
+using namespace std;
+
+// object drawn into the point light shadow cubemap
+struct ShadowCaster
+{
+    Model * model;
+    glm::mat4 transform;
+};
+
+// ways of rendering the six faces of the cubemap
+enum ShadowPath
+{
+    SHADOW_PATH_GEOMETRY_SHADER = 0,  // one draw per caster, the geometry shader emits every triangle into each face (gl_Layer)
+    SHADOW_PATH_PER_FACE = 1,         // one pass per face, each caster is only drawn into the faces it touches
+    SHADOW_PATH_LAYERED = 2,          // one instanced draw per caster, one instance per touched face, gl_Layer written by the
+                                      // vertex shader (needs ARB_shader_viewport_layer_array)
+    SHADOW_PATH_COUNT = 3
+};
+
+const char * ShadowPathName(ShadowPath path)
+{
+    static const char * names[SHADOW_PATH_COUNT] = { "geometry shader", "per-face", "layered instancing" };
+    return names[path];
+}
+
+// point light shadow cubemap that keeps its content between frames
+// every frame the light and the casters are compared with the state of the last update:
+//   - a moved light (or a different far plane) invalidates all six faces
+//   - a moved caster only invalidates the faces its old and its new bounding sphere touch (tested against the face frustums)
+// only the invalidated faces are cleared and redrawn, and each caster is only sent to the faces it touches
+// the casters are drawn at the level of detail their distance to the light allows (see SetLodError), and with a cluster
+// stream (see SetClusterStream) only with the meshlets inside the faces they are drawn into
+//
+// the faces are rendered with one of the ShadowPath programs (selectable at any time with SetPath), the GPU time of every
+// redraw is measured with timestamp queries, so the paths can be compared by their triangle throughput
+class ShadowCubemap
+{
+public:
+    GLuint depth_cubemap = 0;
+
+    static const unsigned int ALL_FACES = 0x3F;
+
+    ShadowCubemap() {}
+
+    ShadowCubemap(const ShadowCubemap &) = delete;
+    ShadowCubemap & operator=(const ShadowCubemap &) = delete;
+
+    // registers the program of a path (shadow_mapping_geometry.glsl, shadow_mapping_face_vertex.glsl or shadow_mapping_layer_vertex.glsl)
+    void SetProgram(ShadowPath path, Shader * shader)
+    {
+        ShadowProgram & program = programs[path];
+        program.shader = shader;
+        program.model = shader->uniform<glm::mat4>("model");
+        program.face_mask = shader->uniform<int>("face_mask");
+        program.face = shader->uniform<int>("face");
+        program.faces = shader->uniform<int>("faces");
+    }
+
+    // paths without a program fall back to the per-face path
+    void SetPath(ShadowPath path)
+    {
+        if (programs[path].shader == NULL)
+        {
+            cout << "WARNING::SHADOW_CACHE:: " << ShadowPathName(path) << " path is not available, using per-face" << endl;
+            path = SHADOW_PATH_PER_FACE;
+        }
+        if (path != this->path)
+            Collect(true);
+        this->path = path;
+    }
+
+    ShadowPath Path() const { return path; }
+
+    // allowed projected error of the caster LODs in shadow map texels (0 draws LOD 0), a change redraws every face
+    void SetLodError(float max_error)
+    {
+        if (max_error != lod_error)
+            valid = false;
+        lod_error = max_error;
+    }
+
+    // culls the meshlets of the casters against the face frustums (and, with cones, the ones facing away from the light)
+    // before they are drawn, NULL draws the whole meshes
+    void SetClusterStream(ClusterStream * stream, bool cones)
+    {
+        cluster_stream = stream;
+        cluster_cones = cones;
+    }
+
+    // caching = false redraws all faces every frame (the behaviour without the cache, for comparisons)
+    void Create(GLuint size, bool caching = true)
+    {
+        this->size = size;
+        this->caching = caching;
+
+        glGenTextures(1, &depth_cubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, depth_cubemap);
+        for (GLuint i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        // layered attachment, the geometry shader selects the face with gl_Layer
+        glGenFramebuffers(1, &layered_FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, layered_FBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_cubemap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // single face attachment, used to clear only some of the faces
+        glGenFramebuffers(1, &face_FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, face_FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, depth_cubemap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenQueries(2 * QUERY_RING_SIZE, queries);
+    }
+
+    // compares the light and the casters with the last update and returns the bit mask (bit i = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i)
+    // of the faces that have to be redrawn, face_matrices are the projection * view matrices of the faces (the Shadow block)
+    unsigned int Update(const glm::vec3 & light_pos, float far_plane, const glm::mat4 face_matrices[6], const vector<ShadowCaster> & casters)
+    {
+        TRACE_SCOPE("ShadowCubemap::Update");
+        for (int face = 0; face < 6; face++)
+            face_frustums[face] = Frustum::FromMatrix(face_matrices[face]);
+
+        SphereArray spheres;
+        for (const ShadowCaster & caster : casters)
+            spheres.Add(caster.transform, caster.model->BoundsCenter(), caster.model->BoundsRadius());
+        FacesTouched(spheres, caster_faces);
+
+        // a face covers 90 degrees, so one unit at distance one is half the face size in texels
+        LodView lod_view;
+        lod_view.eye = light_pos;
+        lod_view.pixels_per_unit = size * 0.5f;
+        lod_view.max_error = lod_error;
+        caster_first_lod.clear();
+        caster_lods.clear();
+        for (const ShadowCaster & caster : casters)
+        {
+            caster_first_lod.push_back(caster_lods.size());
+            float scale = TransformScale(caster.transform);
+            for (size_t i = 0; i < caster.model->MeshCount(); i++)
+            {
+                const Mesh & mesh = caster.model->GetMesh(i);
+                glm::vec3 center = glm::vec3(caster.transform * glm::vec4(mesh.sphere_center, 1.0f));
+                caster_lods.push_back(SelectLod(mesh.Lods(), lod_view, center, mesh.sphere_radius * scale, scale));
+            }
+        }
+
+        unsigned int dirty = 0;
+        if (!caching || !valid || light_pos != last_light_pos || far_plane != last_far_plane || casters.size() != last_casters.size())
+            dirty = ALL_FACES;
+        else
+        {
+            // the old spheres are tested against the current frustums, which are the old ones as the light did not move
+            vector<unsigned int> last_faces;
+            FacesTouched(last_spheres, last_faces);
+            for (size_t i = 0; i < casters.size() && dirty != ALL_FACES; i++)
+                if (casters[i].model != last_casters[i].model || casters[i].transform != last_casters[i].transform)
+                    dirty |= last_faces[i] | caster_faces[i];
+        }
+
+        valid = true;
+        last_light_pos = light_pos;
+        last_far_plane = far_plane;
+        last_casters = casters;
+        last_spheres = spheres;
+
+        frames++;
+        return dirty;
+    }
+
+    // clears the dirty faces and draws the casters into them, does nothing when no face is dirty
+    void Render(const vector<ShadowCaster> & casters, unsigned int dirty)
+    {
+        TRACE_SCOPE("ShadowCubemap::Render");
+        if (dirty == 0)
+            return;
+
+        int slot = next_query;
+        next_query = (next_query + 1) % QUERY_RING_SIZE;
+        if (query_faces[slot] > 0)
+            CollectSlot(slot);
+
+        for (int face = 0; face < 6; face++)
+            if (dirty & (1u << face))
+                for (size_t i = 0; i < casters.size(); i++)
+                {
+                    if (caster_faces[i] & (1u << face))
+                        face_visible[face]++;
+                    else
+                        face_culled[face]++;
+                }
+
+        glQueryCounter(queries[2 * slot], GL_TIMESTAMP);
+        glViewport(0, 0, size, size);
+
+        if (cluster_stream)
+            StreamClusters(casters, dirty);
+
+        const ShadowProgram & program = programs[path];
+        program.shader->use();
+        size_t triangles = 0;
+
+        if (path == SHADOW_PATH_PER_FACE)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, face_FBO);
+            for (int face = 0; face < 6; face++)
+            {
+                if ((dirty & (1u << face)) == 0)
+                    continue;
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, depth_cubemap, 0);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                program.face.set(face);
+                for (size_t i = 0; i < casters.size(); i++)
+                {
+                    if ((caster_faces[i] & (1u << face)) == 0)
+                        continue;
+                    program.model.set(casters[i].transform);
+                    triangles += casters[i].model->Draw(1, CasterLods(i), CasterRanges(face, i));
+                }
+            }
+        }
+        else
+        {
+            ClearFaces(dirty);
+            for (size_t i = 0; i < casters.size(); i++)
+            {
+                unsigned int faces = dirty & caster_faces[i];
+                if (faces == 0)
+                    continue;
+
+                int face_list[6], face_count = 0;
+                for (int face = 0; face < 6; face++)
+                    if (faces & (1u << face))
+                        face_list[face_count++] = face;
+
+                program.model.set(casters[i].transform);
+                if (path == SHADOW_PATH_LAYERED)
+                {
+                    program.faces.set(face_list, face_count);
+                    triangles += casters[i].model->Draw(face_count, CasterLods(i), CasterRanges(0, i)) * face_count;
+                }
+                else
+                {
+                    program.face_mask.set((int)faces);
+                    triangles += casters[i].model->Draw(1, CasterLods(i), CasterRanges(0, i)) * face_count;
+                }
+            }
+        }
+
+        glQueryCounter(queries[2 * slot + 1], GL_TIMESTAMP);
+        query_triangles[slot] = triangles;
+        query_faces[slot] = 0;
+        for (int face = 0; face < 6; face++)
+            if (dirty & (1u << face))
+                query_faces[slot]++;
+    }
+
+    // waits for the outstanding timer queries and prints the statistics of the current path
+    void PrintReport()
+    {
+        Collect(false);
+        cout << "SHADOW_CACHE:: " << ShadowPathName(path) << " path: " << rendered_faces << " of " << frames * 6 << " cubemap faces redrawn"
+             << (caching ? "" : " (caching disabled)") << endl;
+        if (rendered_faces > 0)
+            cout << "SHADOW_CACHE:: " << triangles << " triangles in " << gpu_ms << " gpu ms, throughput = "
+                 << triangles / (gpu_ms * 1000.0) << " Mtri/s, " << gpu_ms / rendered_faces << " ms per face" << endl;
+
+        static const char * face_names[6] = { "+x", "-x", "+y", "-y", "+z", "-z" };
+        cout << "CULLING:: shadow faces, visible / culled casters over all redraws:";
+        for (int face = 0; face < 6; face++)
+            cout << " " << face_names[face] << " " << face_visible[face] << " / " << face_culled[face];
+        cout << endl;
+    }
+
+    void Destroy()
+    {
+        GLStateCache::Get().ForgetTexture(depth_cubemap);
+        glDeleteFramebuffers(1, &layered_FBO);
+        glDeleteFramebuffers(1, &face_FBO);
+        glDeleteTextures(1, &depth_cubemap);
+        if (depth_cubemap)
+            glDeleteQueries(2 * QUERY_RING_SIZE, queries);
+        layered_FBO = face_FBO = depth_cubemap = 0;
+    }
+
+private:
+
+    struct ShadowProgram
+    {
+        Shader * shader = NULL;
+        Uniform<glm::mat4> model;
+        Uniform<int> face_mask, face, faces;
+    };
+
+    static const int QUERY_RING_SIZE = 4;
+
+    GLuint size = 0;
+    bool caching = true;
+    GLuint layered_FBO = 0, face_FBO = 0;
+    ShadowProgram programs[SHADOW_PATH_COUNT];
+    ShadowPath path = SHADOW_PATH_GEOMETRY_SHADER;
+
+    // state of the last update
+    bool valid = false;
+    glm::vec3 last_light_pos;
+    float last_far_plane = 0.0f;
+    vector<ShadowCaster> last_casters;
+    SphereArray last_spheres;
+    Frustum face_frustums[6];
+    // faces every caster of the last update touches
+    vector<unsigned int> caster_faces;
+    // levels of detail of the meshes of every caster of the last update
+    float lod_error = 0.0f;
+    vector<size_t> caster_first_lod;
+    vector<unsigned char> caster_lods;
+    // visible clusters of the meshes of every caster of the last Render, per face for the per-face path
+    ClusterStream * cluster_stream = NULL;
+    bool cluster_cones = true;
+    vector<IndexRange> cluster_ranges;
+
+    // timestamp pairs of the last redraws, read back a few redraws later so the CPU does not wait for the GPU
+    GLuint queries[2 * QUERY_RING_SIZE];
+    size_t query_triangles[QUERY_RING_SIZE] = {};
+    int query_faces[QUERY_RING_SIZE] = {};
+    int next_query = 0;
+
+    // statistics of the current path
+    unsigned long long rendered_faces = 0, frames = 0, triangles = 0;
+    unsigned long long face_visible[6] = {}, face_culled[6] = {};
+    double gpu_ms = 0.0;
+
+    const unsigned char * CasterLods(size_t caster) const { return caster_lods.data() + caster_first_lod[caster]; }
+
+    const IndexRange * CasterRanges(int face, size_t caster) const
+    {
+        return cluster_stream ? cluster_ranges.data() + face * caster_lods.size() + caster_first_lod[caster] : NULL;
+    }
+
+    // the per-face path culls every caster against each face it is drawn into, the other paths draw a caster into all
+    // its faces at once and cull it against the union of them
+    void StreamClusters(const vector<ShadowCaster> & casters, unsigned int dirty)
+    {
+        ClusterView view;
+        view.pass = RENDER_PASS_SHADOW;
+        view.eye = last_light_pos;
+        view.cones = cluster_cones;
+        cluster_stream->Begin(RENDER_PASS_SHADOW);
+        cluster_ranges.assign((path == SHADOW_PATH_PER_FACE ? 6 : 1) * caster_lods.size(), IndexRange());
+        for (size_t i = 0; i < casters.size(); i++)
+        {
+            unsigned int faces = dirty & caster_faces[i];
+            for (int face = 0; face < 6; face++)
+            {
+                if ((faces & (1u << face)) == 0)
+                    continue;
+                if (path == SHADOW_PATH_PER_FACE)
+                    view.frustum_count = 0;
+                view.frustums[view.frustum_count++] = face_frustums[face];
+                if (path == SHADOW_PATH_PER_FACE)
+                    AddCaster(casters[i], i, face, view);
+            }
+            if (path != SHADOW_PATH_PER_FACE && view.frustum_count > 0)
+                AddCaster(casters[i], i, 0, view);
+            view.frustum_count = 0;
+        }
+        cluster_stream->Upload();
+    }
+
+    void AddCaster(const ShadowCaster & caster, size_t caster_index, int face, const ClusterView & view)
+    {
+        IndexRange * ranges = cluster_ranges.data() + face * caster_lods.size() + caster_first_lod[caster_index];
+        const unsigned char * lods = CasterLods(caster_index);
+        for (size_t mesh = 0; mesh < caster.model->MeshCount(); mesh++)
+            ranges[mesh] = cluster_stream->Add(caster.model->GetMesh(mesh), lods[mesh], caster.transform, view);
+    }
+
+    // clears the dirty faces of the layered framebuffer (all at once when the whole cubemap is redrawn)
+    void ClearFaces(unsigned int dirty)
+    {
+        if (dirty != ALL_FACES)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, face_FBO);
+            for (int face = 0; face < 6; face++)
+                if (dirty & (1u << face))
+                {
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, depth_cubemap, 0);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, layered_FBO);
+        if (dirty == ALL_FACES)
+            glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void CollectSlot(int slot)
+    {
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(queries[2 * slot], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(queries[2 * slot + 1], GL_QUERY_RESULT, &end);
+        gpu_ms += (end - start) / 1.0e6;
+        triangles += query_triangles[slot];
+        rendered_faces += query_faces[slot];
+        query_triangles[slot] = 0;
+        query_faces[slot] = 0;
+    }
+
+    // collects all outstanding queries, reset = true starts the statistics of a new path
+    void Collect(bool reset)
+    {
+        for (int slot = 0; slot < QUERY_RING_SIZE; slot++)
+            if (query_faces[slot] > 0)
+                CollectSlot(slot);
+        if (reset)
+        {
+            rendered_faces = frames = triangles = 0;
+            gpu_ms = 0.0;
+        }
+    }
+
+    // bit mask of the face frustums every sphere intersects
+    void FacesTouched(const SphereArray & spheres, vector<unsigned int> & faces) const
+    {
+        faces.assign(spheres.Size(), 0);
+        vector<unsigned char> visible(spheres.Size());
+        if (visible.empty())
+            return;
+        for (int face = 0; face < 6; face++)
+        {
+            spheres.Cull(face_frustums[face], &visible[0]);
+            for (size_t i = 0; i < visible.size(); i++)
+                if (visible[i])
+                    faces[i] |= 1u << face;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gl_state.h"
+#include "stb_image.h"
+#include "texture_compression.h"
+#include "trace.h"
+
+using namespace std;
+
+// image decoded by stb_image (or read from its cooked .dds file), not uploaded yet
+struct DecodedImage
+{
+    unsigned char * data = NULL;
+    int width = 0, height = 0, components = 0;
+    CompressedImage compressed;     // levels of a cooked image, data is NULL then
+
+    bool Loaded() const { return data != NULL || !compressed.data.empty(); }
+    bool Compressed() const { return compressed.format != BLOCK_NONE; }
+};
+
+// wrapping and filtering of a texture, part of the texture cache key
+struct TextureSampling
+{
+    GLenum wrap = GL_REPEAT;
+    GLenum min_filter = GL_LINEAR_MIPMAP_LINEAR;
+    GLenum mag_filter = GL_LINEAR;
+    bool mipmaps = true;
+
+    // sampling of the environment cubemaps
+    static TextureSampling Cubemap()
+    {
+        TextureSampling sampling;
+        sampling.wrap = GL_CLAMP_TO_EDGE;
+        sampling.min_filter = GL_LINEAR;
+        sampling.mipmaps = false;
+        return sampling;
+    }
+};
+
+bool DecodeImage(const string & filename, DecodedImage & image);
+void FreeImage(DecodedImage & image);
+GLenum ImageFormat(int components);
+GLuint UploadTexture(const DecodedImage & image, const void * pixels, const TextureSampling & sampling = TextureSampling());
+
+
+// textures of the whole process by canonical path, target and sampling, so a file used by several models (or loaded
+// again later) is decoded and uploaded once
+//
+// entries are created with no references; Acquire / Release count the users (materials, the skybox) and the last
+// Release deletes the texture. Find can be called from any thread, everything else needs the context
+class TextureCache
+{
+public:
+
+    static TextureCache & Get()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // "a\b/./c/../d.png" -> "a/b/d.png" (the same file reached through different relative paths gets one entry)
+    static string CanonicalPath(const string & path)
+    {
+        string unified = path;
+        replace(unified.begin(), unified.end(), '\\', '/');
+        bool absolute = !unified.empty() && unified[0] == '/';
+
+        vector<string> parts;
+        size_t start = 0;
+        while (start <= unified.size())
+        {
+            size_t end = unified.find('/', start);
+            if (end == string::npos)
+                end = unified.size();
+            string part = unified.substr(start, end - start);
+            if (part == "..")
+            {
+                if (!parts.empty() && parts.back() != "..")
+                    parts.pop_back();
+                else if (!absolute)
+                    parts.push_back(part);
+            }
+            else if (!part.empty() && part != ".")
+                parts.push_back(part);
+            start = end + 1;
+        }
+
+        string canonical = absolute ? "/" : "";
+        for (size_t i = 0; i < parts.size(); i++)
+            canonical += (i ? "/" : "") + parts[i];
+        return canonical;
+    }
+
+    // cache key of a file (a cubemap passes its six face paths joined with '|')
+    static string Key(const string & path, GLenum target, const TextureSampling & sampling)
+    {
+        return to_string(target) + ":" + to_string(sampling.wrap) + ":" + to_string(sampling.min_filter) + ":"
+             + to_string(sampling.mag_filter) + ":" + (sampling.mipmaps ? "m:" : ":") + CanonicalPath(path);
+    }
+
+    static string CubemapKey(const vector<string> & faces)
+    {
+        string joined;
+        for (const string & face : faces)
+            joined += (joined.empty() ? "" : "|") + CanonicalPath(face);
+        return to_string(GL_TEXTURE_CUBE_MAP) + ":" + joined;
+    }
+
+    // texture of a key, 0 if it was not uploaded yet
+    GLuint Find(const string & key) const
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        unordered_map<string, size_t>::const_iterator found = by_key.find(key);
+        return found != by_key.end() ? entries[found->second].texture : 0;
+    }
+
+    // registers an uploaded texture (faces = 6 for cubemaps), returns it
+    GLuint Insert(const string & key, const string & path, GLuint texture, GLenum target, const DecodedImage & image, bool mipmaps, int faces = 1)
+    {
+        Entry entry;
+        entry.key = key;
+        entry.path = path;
+        entry.texture = texture;
+        entry.target = target;
+        entry.width = image.width;
+        entry.height = image.height;
+        entry.components = image.components;
+        entry.format = image.compressed.format;
+        // level 0 of every face, plus a third for the mipmap chain (cooked images carry their own chain)
+        entry.bytes = (size_t)image.width * image.height * image.components * faces;
+        if (image.Compressed())
+            entry.bytes = image.compressed.Bytes() * faces;
+        else if (mipmaps)
+            entry.bytes += entry.bytes / 3;
+
+        lock_guard<mutex> lock(entries_mutex);
+        by_key[key] = entries.size();
+        by_texture[texture] = entries.size();
+        entries.push_back(entry);
+        return texture;
+    }
+
+    // 2D texture of an image file, decoded and uploaded on the first request
+    GLuint Load2D(const string & path, const TextureSampling & sampling = TextureSampling())
+    {
+        TRACE_SCOPE("TextureCache::Load2D");
+        string key = Key(path, GL_TEXTURE_2D, sampling);
+        GLuint texture = Find(key);
+        if (texture)
+            return texture;
+
+        DecodedImage image;
+        if (!DecodeImage(path, image))
+            cout << "Texture failed to load at path: " << path << endl;
+        texture = UploadTexture(image, image.Compressed() ? (const void *)&image.compressed.data[0] : image.data, sampling);
+        Insert(key, path, texture, GL_TEXTURE_2D, image, sampling.mipmaps);
+        FreeImage(image);
+        return texture;
+    }
+
+    void Acquire(GLuint texture)
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        unordered_map<GLuint, size_t>::iterator found = by_texture.find(texture);
+        if (found != by_texture.end())
+            entries[found->second].references++;
+    }
+
+    void Release(GLuint texture)
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        unordered_map<GLuint, size_t>::iterator found = by_texture.find(texture);
+        if (found == by_texture.end() || entries[found->second].references == 0)
+            return;
+        Entry & entry = entries[found->second];
+        if (--entry.references > 0)
+            return;
+
+        if (context_alive)
+        {
+            GLStateCache::Get().ForgetTexture(entry.texture);
+            glDeleteTextures(1, &entry.texture);
+        }
+        // the slot stays in the vector, only the lookups are removed
+        by_key.erase(entry.key);
+        entry.texture = 0;
+        entry.bytes = 0;
+        by_texture.erase(found);
+    }
+
+    // block format a texture was uploaded with, BLOCK_NONE for decoded images and unknown textures
+    BlockFormat Format(GLuint texture) const
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        unordered_map<GLuint, size_t>::const_iterator found = by_texture.find(texture);
+        return found != by_texture.end() ? entries[found->second].format : BLOCK_NONE;
+    }
+
+    // false decodes the image files even where a cooked .dds exists (set before loading)
+    void SetCookedTextures(bool enabled) { cooked_textures = enabled; }
+    bool CookedTextures() const { return cooked_textures; }
+
+    // deletes every texture while the context is still current, later releases only drop their counts
+    void DestroyAll()
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        for (Entry & entry : entries)
+            if (entry.texture)
+            {
+                GLStateCache::Get().ForgetTexture(entry.texture);
+                glDeleteTextures(1, &entry.texture);
+            }
+        context_alive = false;
+    }
+
+    size_t TotalBytes() const
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        size_t total = 0;
+        for (const Entry & entry : entries)
+            total += entry.bytes;
+        return total;
+    }
+
+    // every live texture, largest first (sizes are estimated from the uploaded format, the driver may pad them)
+    void PrintReport() const
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        vector<const Entry *> live;
+        size_t total = 0;
+        for (const Entry & entry : entries)
+            if (entry.texture)
+            {
+                live.push_back(&entry);
+                total += entry.bytes;
+            }
+        sort(live.begin(), live.end(), [](const Entry * a, const Entry * b) { return a->bytes > b->bytes; });
+
+        for (const Entry * entry : live)
+            cout << "TEXTURE_CACHE:: " << entry->bytes / 1024 << " KiB, " << entry->width << "x" << entry->height << "x" << entry->components
+                 << (entry->format != BLOCK_NONE ? string(" ") + BlockFormatName(entry->format) : "")
+                 << (entry->target == GL_TEXTURE_CUBE_MAP ? " cubemap" : "") << ", " << entry->references << " references, " << entry->path << endl;
+        cout << "TEXTURE_CACHE:: " << live.size() << " textures, " << total / (1024.0 * 1024.0) << " MiB" << endl;
+    }
+
+private:
+
+    struct Entry
+    {
+        string key, path;
+        GLuint texture = 0;
+        GLenum target = GL_TEXTURE_2D;
+        int width = 0, height = 0, components = 0;
+        BlockFormat format = BLOCK_NONE;
+        size_t bytes = 0;
+        unsigned int references = 0;
+    };
+
+    mutable mutex entries_mutex;
+    vector<Entry> entries;
+    unordered_map<string, size_t> by_key;
+    unordered_map<GLuint, size_t> by_texture;
+    bool context_alive = true;
+    bool cooked_textures = true;
+
+    TextureCache() {}
+};
+
+
+// decodes an image file into memory (or reads its cooked version, see CookTextures), needs no OpenGL context
+bool DecodeImage(const string & filename, DecodedImage & image)
+{
+    TRACE_SCOPE("DecodeImage");
+    if (TextureCache::Get().CookedTextures() && ReadCookedTexture(filename, image.compressed))
+    {
+        image.width = image.compressed.levels[0].width;
+        image.height = image.compressed.levels[0].height;
+        image.components = image.compressed.format == BLOCK_BC4 ? 1 : image.compressed.format == BLOCK_BC5 ? 2 : 4;
+        return true;
+    }
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+    return image.data != NULL;
+}
+
+// frees the pixels, the size and format of the image stay for the bookkeeping
+void FreeImage(DecodedImage & image)
+{
+    stbi_image_free(image.data);
+    image.data = NULL;
+    vector<unsigned char>().swap(image.compressed.data);
+}
+
+GLenum ImageFormat(int components)
+{
+    if (components == 1)
+        return GL_RED;
+    else if (components == 2)
+        return GL_RG;
+    else if (components == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+// creates a 2D texture of a decoded image (an image that failed to decode gives an empty texture)
+// pixels is either the image data (image.data, the compressed levels) or an offset into the bound GL_PIXEL_UNPACK_BUFFER
+GLuint UploadTexture(const DecodedImage & image, const void * pixels, const TextureSampling & sampling)
+{
+    TRACE_SCOPE("UploadTexture");
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    if (!image.Loaded())
+        return textureID;
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    if (image.Compressed())
+        UploadCompressedImage(GL_TEXTURE_2D, image.compressed, pixels);
+    else
+    {
+        GLenum format = ImageFormat(image.components);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        if (sampling.mipmaps)
+            glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampling.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampling.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling.min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampling.mag_filter);
+
+    return textureID;
+}
+
+#endif
@@ -0,0 +1,646 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gl_state.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// S3TC is an extension of OpenGL 3.3 (exposed by practically every desktop driver), RGTC is core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// block compressed formats of the cooked textures, every block holds 4x4 texels
+// BC7 is not cooked: it is an extension as well (GL_ARB_texture_compression_bptc) and would fit the same fallback, but a
+// useful encoder has to search eight modes and up to 64 partitions per block instead of the single endpoint fit below,
+// and the fallback would need a BC7 decoder; BC1 also takes half of its memory
+enum BlockFormat
+{
+    BLOCK_NONE = 0,
+    BLOCK_BC1,      // rgb, 8 bytes per block (color maps without alpha, skybox faces)
+    BLOCK_BC3,      // rgba, 16 bytes per block (color maps with alpha)
+    BLOCK_BC4,      // one channel, 8 bytes per block (height and specular maps)
+    BLOCK_BC5       // two channels, 16 bytes per block (normal maps, the shaders rebuild z)
+};
+
+const char * BlockFormatName(BlockFormat format)
+{
+    static const char * names[] = { "none", "BC1", "BC3", "BC4", "BC5" };
+    return names[format];
+}
+
+size_t BlockBytes(BlockFormat format)
+{
+    return format == BLOCK_BC1 || format == BLOCK_BC4 ? 8 : 16;
+}
+
+GLenum BlockInternalFormat(BlockFormat format)
+{
+    if (format == BLOCK_BC1)
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    else if (format == BLOCK_BC3)
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    else if (format == BLOCK_BC4)
+        return GL_COMPRESSED_RED_RGTC1;
+    return GL_COMPRESSED_RG_RGTC2;
+}
+
+// size of a level of width x height texels (partial blocks at the borders are stored whole)
+size_t BlockLevelBytes(BlockFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+struct CompressedLevel
+{
+    int width, height;
+    size_t offset, size;    // in CompressedImage::data
+};
+
+// block compressed image with its mip chain, as stored in a cooked .dds file
+struct CompressedImage
+{
+    BlockFormat format = BLOCK_NONE;
+    vector<CompressedLevel> levels;
+    vector<unsigned char> data;
+
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const CompressedLevel & level : levels)
+            bytes += level.size;
+        return bytes;
+    }
+
+    void AddLevel(int width, int height)
+    {
+        CompressedLevel level = { width, height, data.size(), BlockLevelBytes(format, width, height) };
+        levels.push_back(level);
+        data.resize(data.size() + level.size);
+    }
+};
+
+
+// ---------------- CPU encoder and decoder ----------------
+// a block is 16 rgba texels, row by row
+
+unsigned short PackColor565(const float color[3])
+{
+    int r = (int)(min(max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(min(max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(min(max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+void UnpackColor565(unsigned short packed, int color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    // bit replication, as the hardware does
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// palette of a BC1 color block, four_colors is false for the 3 color + transparent black mode of BC1 (c0 <= c1)
+void ColorPalette(unsigned short c0, unsigned short c1, bool four_colors, int palette[4][4])
+{
+    UnpackColor565(c0, palette[0]);
+    UnpackColor565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    for (int c = 0; c < 3; c++)
+    {
+        if (four_colors)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    palette[3][3] = four_colors ? 255 : 0;
+}
+
+// picks the nearest palette entry for every texel, returns the squared error
+float FitColorIndices(const unsigned char texels[16][4], unsigned short c0, unsigned short c1, unsigned int & indices)
+{
+    int palette[4][4];
+    ColorPalette(c0, c1, true, palette);
+    float error = 0.0f;
+    indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0, best_distance = 0x7FFFFFFF;
+        for (int p = 0; p < 4; p++)
+        {
+            int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best = p;
+            }
+        }
+        indices |= (unsigned int)best << (2 * i);
+        error += (float)best_distance;
+    }
+    return error;
+}
+
+// endpoints in 565, c0 > c1 so the block decodes in the four color mode (BC3 always uses that mode)
+void OrderColorEndpoints(unsigned short & c0, unsigned short & c1)
+{
+    if (c0 < c1)
+        swap(c0, c1);
+}
+
+// 8-byte color block of BC1 / BC3: endpoints along the principal axis of the texel colors,
+// then refined by least squares on the chosen indices
+void EncodeColorBlock(const unsigned char texels[16][4], unsigned char * block)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += texels[i][c] / 16.0f;
+
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };   // xx, xy, xz, yy, yz, zz
+    for (int i = 0; i < 16; i++)
+    {
+        float d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+        covariance[0] += d[0] * d[0]; covariance[1] += d[0] * d[1]; covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1]; covariance[4] += d[1] * d[2]; covariance[5] += d[2] * d[2];
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2] };
+        float length = sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float lowest = 0.0f, highest = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] + (texels[i][2] - mean[2]) * axis[2];
+        lowest = min(lowest, t);
+        highest = max(highest, t);
+    }
+    // the extremes are pulled in a little, they are rarely worth a whole palette entry
+    float inset = (highest - lowest) / 16.0f;
+    float start[3], end[3];
+    for (int c = 0; c < 3; c++)
+    {
+        start[c] = mean[c] + axis[c] * (highest - inset);
+        end[c] = mean[c] + axis[c] * (lowest + inset);
+    }
+
+    unsigned short c0 = PackColor565(start), c1 = PackColor565(end);
+    OrderColorEndpoints(c0, c1);
+    unsigned int indices;
+    float error = FitColorIndices(texels, c0, c1, indices);
+
+    // weight of c0 for the palette entries 0..3
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    for (int iteration = 0; iteration < 2 && error > 0.0f && c0 != c1; iteration++)
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+        {
+            float w = weights[(indices >> (2 * i)) & 3];
+            aa += w * w;
+            ab += w * (1.0f - w);
+            bb += (1.0f - w) * (1.0f - w);
+            for (int c = 0; c < 3; c++)
+            {
+                ax[c] += w * texels[i][c];
+                bx[c] += (1.0f - w) * texels[i][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (fabs(determinant) < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+        {
+            start[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+            end[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+        }
+
+        unsigned short r0 = PackColor565(start), r1 = PackColor565(end);
+        OrderColorEndpoints(r0, r1);
+        unsigned int refined_indices;
+        float refined_error = FitColorIndices(texels, r0, r1, refined_indices);
+        if (refined_error >= error)
+            break;
+        c0 = r0;
+        c1 = r1;
+        indices = refined_indices;
+        error = refined_error;
+    }
+
+    // c0 == c1 decodes in the three color mode, index 0 is c0 there as well
+    block[0] = (unsigned char)(c0 & 0xFF);
+    block[1] = (unsigned char)(c0 >> 8);
+    block[2] = (unsigned char)(c1 & 0xFF);
+    block[3] = (unsigned char)(c1 >> 8);
+    for (int i = 0; i < 4; i++)
+        block[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+void DecodeColorBlock(const unsigned char * block, bool allow_three_colors, unsigned char texels[16][4])
+{
+    unsigned short c0 = (unsigned short)(block[0] | (block[1] << 8)), c1 = (unsigned short)(block[2] | (block[3] << 8));
+    int palette[4][4];
+    ColorPalette(c0, c1, !allow_three_colors || c0 > c1, palette);
+    unsigned int indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+            texels[i][c] = (unsigned char)palette[(indices >> (2 * i)) & 3][c];
+}
+
+// palette of a BC4 block: 8 interpolated values if a0 > a1, otherwise 6 plus 0 and 255
+void ChannelPalette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+        for (int i = 2; i < 8; i++)
+            palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    else
+    {
+        for (int i = 2; i < 6; i++)
+            palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// 8-byte single channel block (BC4, the alpha of BC3, each half of BC5) of channel of the texels
+void EncodeChannelBlock(const unsigned char texels[16][4], int channel, unsigned char * block)
+{
+    int lowest = 255, highest = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        lowest = min(lowest, (int)texels[i][channel]);
+        highest = max(highest, (int)texels[i][channel]);
+    }
+
+    int palette[8];
+    ChannelPalette(highest, lowest, palette);
+    unsigned long long indices = 0;
+    for (int i = 0; i < 16 && highest > lowest; i++)
+    {
+        int best = 0, best_distance = 256;
+        for (int p = 0; p < 8; p++)
+        {
+            int distance = abs(texels[i][channel] - palette[p]);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                best = p;
+            }
+        }
+        indices |= (unsigned long long)best << (3 * i);
+    }
+
+    block[0] = (unsigned char)highest;
+    block[1] = (unsigned char)lowest;
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+void DecodeChannelBlock(const unsigned char * block, int channel, unsigned char texels[16][4])
+{
+    int palette[8];
+    ChannelPalette(block[0], block[1], palette);
+    unsigned long long indices = 0;
+    for (int i = 0; i < 6; i++)
+        indices |= (unsigned long long)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++)
+        texels[i][channel] = (unsigned char)palette[(indices >> (3 * i)) & 7];
+}
+
+// compresses width x height rgba texels (texels beyond the border repeat the last row / column)
+void CompressImage(const unsigned char * rgba, int width, int height, BlockFormat format, unsigned char * blocks)
+{
+    size_t block_bytes = BlockBytes(format);
+    for (int by = 0; by < height; by += 4)
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            unsigned char texels[16][4];
+            for (int y = 0; y < 4; y++)
+                for (int x = 0; x < 4; x++)
+                    memcpy(texels[y * 4 + x], rgba + ((size_t)min(by + y, height - 1) * width + min(bx + x, width - 1)) * 4, 4);
+
+            if (format == BLOCK_BC1)
+                EncodeColorBlock(texels, blocks);
+            else if (format == BLOCK_BC3)
+            {
+                EncodeChannelBlock(texels, 3, blocks);
+                EncodeColorBlock(texels, blocks + 8);
+            }
+            else if (format == BLOCK_BC4)
+                EncodeChannelBlock(texels, 0, blocks);
+            else
+            {
+                EncodeChannelBlock(texels, 0, blocks);
+                EncodeChannelBlock(texels, 1, blocks + 8);
+            }
+            blocks += block_bytes;
+        }
+}
+
+// decompresses into width x height rgba texels: BC4 gives (r, r, r, 255), BC5 (r, g, 0, 255)
+// (the same values the shaders see of the compressed texture, see UploadCompressedImage)
+void DecompressImage(const unsigned char * blocks, int width, int height, BlockFormat format, unsigned char * rgba)
+{
+    size_t block_bytes = BlockBytes(format);
+    for (int by = 0; by < height; by += 4)
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            unsigned char texels[16][4];
+            if (format == BLOCK_BC1)
+                DecodeColorBlock(blocks, true, texels);
+            else if (format == BLOCK_BC3)
+            {
+                DecodeColorBlock(blocks + 8, false, texels);
+                DecodeChannelBlock(blocks, 3, texels);
+            }
+            else
+            {
+                DecodeChannelBlock(blocks, 0, texels);
+                if (format == BLOCK_BC5)
+                    DecodeChannelBlock(blocks + 8, 1, texels);
+                for (int i = 0; i < 16; i++)
+                {
+                    if (format == BLOCK_BC4)
+                        texels[i][1] = texels[i][2] = texels[i][0];
+                    else
+                        texels[i][2] = 0;
+                    texels[i][3] = 255;
+                }
+            }
+            blocks += block_bytes;
+
+            for (int y = 0; y < 4 && by + y < height; y++)
+                for (int x = 0; x < 4 && bx + x < width; x++)
+                    memcpy(rgba + ((size_t)(by + y) * width + bx + x) * 4, texels[y * 4 + x], 4);
+        }
+}
+
+
+// ---------------- DDS container ----------------
+// legacy header with a FourCC (DXT1, DXT5, ATI1, ATI2), also read: BC4U / BC5U and the DX10 header of the same formats
+// cooked files keep the hash of their source image in the reserved words, so a changed source is noticed
+
+namespace DDS
+{
+    const unsigned int MAGIC = 0x20534444;          // "DDS "
+    const unsigned int COOKED_TAG = 0x4B4F4F43;     // "COOK" in dwReserved1[0]
+
+    const unsigned int HEADER_CAPS = 0x1, HEADER_HEIGHT = 0x2, HEADER_WIDTH = 0x4, HEADER_PIXELFORMAT = 0x1000;
+    const unsigned int HEADER_MIPMAPCOUNT = 0x20000, HEADER_LINEARSIZE = 0x80000;
+    const unsigned int PIXELFORMAT_FOURCC = 0x4;
+    const unsigned int CAPS_COMPLEX = 0x8, CAPS_TEXTURE = 0x1000, CAPS_MIPMAP = 0x400000;
+    const unsigned int CAPS2_CUBEMAP = 0x200;
+
+    struct PixelFormat
+    {
+        unsigned int size, flags, four_cc, rgb_bit_count, masks[4];
+    };
+
+    struct Header
+    {
+        unsigned int size, flags, height, width, pitch_or_linear_size, depth, mip_map_count;
+        unsigned int reserved1[11];
+        PixelFormat pixel_format;
+        unsigned int caps, caps2, caps3, caps4, reserved2;
+    };
+
+    struct HeaderDX10
+    {
+        unsigned int dxgi_format, resource_dimension, misc_flag, array_size, misc_flags2;
+    };
+
+    unsigned int FourCC(const char * code)
+    {
+        return (unsigned int)code[0] | ((unsigned int)code[1] << 8) | ((unsigned int)code[2] << 16) | ((unsigned int)code[3] << 24);
+    }
+
+    BlockFormat FormatOfFourCC(unsigned int four_cc)
+    {
+        if (four_cc == FourCC("DXT1"))
+            return BLOCK_BC1;
+        else if (four_cc == FourCC("DXT5"))
+            return BLOCK_BC3;
+        else if (four_cc == FourCC("ATI1") || four_cc == FourCC("BC4U"))
+            return BLOCK_BC4;
+        else if (four_cc == FourCC("ATI2") || four_cc == FourCC("BC5U"))
+            return BLOCK_BC5;
+        return BLOCK_NONE;
+    }
+
+    // DXGI_FORMAT_BC1_UNORM, BC3_UNORM, BC4_UNORM, BC5_UNORM
+    BlockFormat FormatOfDXGI(unsigned int dxgi_format)
+    {
+        if (dxgi_format == 71)
+            return BLOCK_BC1;
+        else if (dxgi_format == 77)
+            return BLOCK_BC3;
+        else if (dxgi_format == 80)
+            return BLOCK_BC4;
+        else if (dxgi_format == 83)
+            return BLOCK_BC5;
+        return BLOCK_NONE;
+    }
+
+    const char * FourCCOfFormat(BlockFormat format)
+    {
+        static const char * codes[] = { "", "DXT1", "DXT5", "ATI1", "ATI2" };
+        return codes[format];
+    }
+
+    bool Write(const string & path, const CompressedImage & image, unsigned long long source_hash)
+    {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        header.size = sizeof(Header);
+        header.flags = HEADER_CAPS | HEADER_HEIGHT | HEADER_WIDTH | HEADER_PIXELFORMAT | HEADER_MIPMAPCOUNT | HEADER_LINEARSIZE;
+        header.width = image.levels[0].width;
+        header.height = image.levels[0].height;
+        header.pitch_or_linear_size = (unsigned int)image.levels[0].size;
+        header.mip_map_count = (unsigned int)image.levels.size();
+        header.reserved1[0] = COOKED_TAG;
+        header.reserved1[1] = (unsigned int)(source_hash & 0xFFFFFFFFu);
+        header.reserved1[2] = (unsigned int)(source_hash >> 32);
+        header.pixel_format.size = sizeof(PixelFormat);
+        header.pixel_format.flags = PIXELFORMAT_FOURCC;
+        header.pixel_format.four_cc = FourCC(FourCCOfFormat(image.format));
+        header.caps = CAPS_TEXTURE | (image.levels.size() > 1 ? CAPS_COMPLEX | CAPS_MIPMAP : 0);
+
+        ofstream file(path, ios::binary);
+        if (!file)
+            return false;
+        file.write((const char *)&MAGIC, sizeof(MAGIC));
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)&image.data[0], image.data.size());
+        return (bool)file;
+    }
+
+    // reads a 2D texture (the first face of a cubemap file), has_hash is false for files that were not cooked by this program
+    bool Read(const string & path, CompressedImage & image, unsigned long long & source_hash, bool & has_hash)
+    {
+        MappedFile file;
+        if (!file.Open(path))
+            return false;
+        if (file.size < sizeof(MAGIC) + sizeof(Header) || memcmp(file.data, &MAGIC, sizeof(MAGIC)) != 0)
+        {
+            cout << "ERROR::DDS:: " << path << " is not a DDS file" << endl;
+            return false;
+        }
+
+        Header header;
+        memcpy(&header, file.data + sizeof(MAGIC), sizeof(header));
+        size_t offset = sizeof(MAGIC) + sizeof(Header);
+        BlockFormat format = BLOCK_NONE;
+        if ((header.pixel_format.flags & PIXELFORMAT_FOURCC) && header.pixel_format.four_cc == FourCC("DX10"))
+        {
+            HeaderDX10 dx10;
+            if (file.size < offset + sizeof(dx10))
+                return false;
+            memcpy(&dx10, file.data + offset, sizeof(dx10));
+            offset += sizeof(dx10);
+            format = FormatOfDXGI(dx10.dxgi_format);
+        }
+        else if (header.pixel_format.flags & PIXELFORMAT_FOURCC)
+            format = FormatOfFourCC(header.pixel_format.four_cc);
+        if (format == BLOCK_NONE)
+        {
+            cout << "ERROR::DDS:: " << path << ": only BC1, BC3, BC4 and BC5 are supported" << endl;
+            return false;
+        }
+
+        image.format = format;
+        image.levels.clear();
+        image.data.clear();
+        int width = (int)header.width, height = (int)header.height;
+        unsigned int level_count = (header.flags & HEADER_MIPMAPCOUNT) ? max(1u, header.mip_map_count) : 1u;
+        for (unsigned int level = 0; level < level_count; level++)
+        {
+            image.AddLevel(width, height);
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+        }
+        if (file.size < offset + image.data.size())
+        {
+            cout << "ERROR::DDS:: " << path << " is truncated" << endl;
+            return false;
+        }
+        memcpy(&image.data[0], file.data + offset, image.data.size());
+
+        has_hash = header.reserved1[0] == COOKED_TAG;
+        source_hash = ((unsigned long long)header.reserved1[2] << 32) | header.reserved1[1];
+        return true;
+    }
+}
+
+// the cooked version of an image file
+string CookedTexturePath(const string & path)
+{
+    return path + ".dds";
+}
+
+// reads the cooked version of an image file, false if there is none or if the image changed since it was cooked
+bool ReadCookedTexture(const string & path, CompressedImage & image)
+{
+    unsigned long long cooked_hash;
+    bool has_hash = false;
+    string cooked_path = CookedTexturePath(path);
+    if (!DDS::Read(cooked_path, image, cooked_hash, has_hash))
+        return false;
+
+    MappedFile source;
+    if (has_hash && source.Open(path) && HashBytes(source.data, source.size) != cooked_hash)
+    {
+        cout << "WARNING::DDS:: " << cooked_path << " is out of date, cook the textures again" << endl;
+        image = CompressedImage();
+        return false;
+    }
+    return true;
+}
+
+// true if the driver can sample the format (BC1 and BC3 need GL_EXT_texture_compression_s3tc)
+bool BlockFormatSupported(BlockFormat format)
+{
+    static int s3tc = -1;
+    if (format == BLOCK_BC4 || format == BLOCK_BC5)
+        return true;
+    if (s3tc < 0)
+        s3tc = HasGLExtension("GL_EXT_texture_compression_s3tc") ? 1 : 0;
+    return s3tc == 1;
+}
+
+// uploads every level of a compressed image to target (GL_TEXTURE_2D or a cubemap face) of the bound texture
+// pixels is either &image.data[0] or an offset into the bound GL_PIXEL_UNPACK_BUFFER holding image.data;
+// formats the driver cannot sample are decompressed on the CPU and uploaded as rgba
+void UploadCompressedImage(GLenum target, const CompressedImage & image, const void * pixels)
+{
+    bool supported = BlockFormatSupported(image.format);
+    if (!supported)
+    {
+        static bool warned = false;
+        if (!warned)
+            cout << "WARNING::DDS:: " << BlockFormatName(image.format) << " is not supported by the driver, decompressing on the CPU" << endl;
+        warned = true;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    vector<unsigned char> rgba;
+    for (size_t level = 0; level < image.levels.size(); level++)
+    {
+        const CompressedLevel & data = image.levels[level];
+        if (supported)
+            glCompressedTexImage2D(target, (GLint)level, BlockInternalFormat(image.format), data.width, data.height, 0,
+                                   (GLsizei)data.size, (const unsigned char *)pixels + data.offset);
+        else
+        {
+            rgba.resize((size_t)data.width * data.height * 4);
+            DecompressImage(&image.data[data.offset], data.width, data.height, image.format, &rgba[0]);
+            glTexImage2D(target, (GLint)level, GL_RGBA, data.width, data.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+        }
+    }
+
+    // the single channel formats read like the grayscale and normal maps they replace
+    GLenum texture_target = target == GL_TEXTURE_2D ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+    glTexParameteri(texture_target, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+    if (supported && image.format == BLOCK_BC4)
+    {
+        glTexParameteri(texture_target, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(texture_target, GL_TEXTURE_SWIZZLE_B, GL_RED);
+    }
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Model.h"
+#include "asset_loader.h"
+#include "stb_image.h"
+#include "texture_compression.h"
+
+using namespace std;
+
+// offline conversion of the images of a scene into block compressed .dds files with their whole mip chain
+// (<image>.dds next to every image, picked up by DecodeImage), runs on the CPU only and needs no OpenGL context
+//
+// formats by texture type: normal maps BC5, specular / height maps BC4, color maps BC1 (BC3 if they have alpha),
+// cubemap faces BC1 without mipmaps (the skybox is sampled without them)
+struct CookedTexture
+{
+    string path, type;
+    BlockFormat format = BLOCK_NONE;
+    int width = 0, height = 0, levels = 0;
+    size_t source_bytes = 0, cooked_bytes = 0;  // uploaded size of the image (with its mip chain) and of the cooked file
+    double rmse = 0.0, ms = 0.0;                // error of level 0 over the stored channels
+    bool up_to_date = false, failed = false;
+};
+
+BlockFormat CookedFormat(const string & type, const vector<unsigned char> & rgba)
+{
+    if (type == "normal_texture")
+        return BLOCK_BC5;
+    if (type == "specular_texture" || type == "height_texture")
+        return BLOCK_BC4;
+    for (size_t i = 3; i < rgba.size(); i += 4)
+        if (rgba[i] != 255)
+            return BLOCK_BC3;
+    return BLOCK_BC1;
+}
+
+// next level of the mip chain (2x2 box filter, the last row / column of odd sizes is repeated),
+// normal maps are renormalized so the shaders see unit vectors on every level
+void DownsampleImage(const vector<unsigned char> & source, int width, int height, bool normal_map,
+                     vector<unsigned char> & target, int & target_width, int & target_height)
+{
+    target_width = max(1, width / 2);
+    target_height = max(1, height / 2);
+    target.resize((size_t)target_width * target_height * 4);
+    for (int y = 0; y < target_height; y++)
+        for (int x = 0; x < target_width; x++)
+        {
+            int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+            int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+            float texel[4];
+            for (int c = 0; c < 4; c++)
+                texel[c] = (source[((size_t)y0 * width + x0) * 4 + c] + source[((size_t)y0 * width + x1) * 4 + c]
+                          + source[((size_t)y1 * width + x0) * 4 + c] + source[((size_t)y1 * width + x1) * 4 + c]) / 4.0f;
+
+            if (normal_map)
+            {
+                float n[3] = { texel[0] / 127.5f - 1.0f, texel[1] / 127.5f - 1.0f, texel[2] / 127.5f - 1.0f };
+                float length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length > 1e-6f)
+                    for (int c = 0; c < 3; c++)
+                        texel[c] = (n[c] / length + 1.0f) * 127.5f;
+            }
+            for (int c = 0; c < 4; c++)
+                target[((size_t)y * target_width + x) * 4 + c] = (unsigned char)min(255.0f, max(0.0f, texel[c] + 0.5f));
+        }
+}
+
+// root mean square error of the decompressed level over the channels the format stores
+double CompressionError(const vector<unsigned char> & rgba, const unsigned char * blocks, int width, int height, BlockFormat format)
+{
+    vector<unsigned char> decoded((size_t)width * height * 4);
+    DecompressImage(blocks, width, height, format, &decoded[0]);
+    int channels = format == BLOCK_BC4 ? 1 : format == BLOCK_BC5 ? 2 : format == BLOCK_BC1 ? 3 : 4;
+    double sum = 0.0;
+    for (size_t i = 0; i < decoded.size(); i += 4)
+        for (int c = 0; c < channels; c++)
+        {
+            double difference = (double)rgba[i + c] - decoded[i + c];
+            sum += difference * difference;
+        }
+    return sqrt(sum / ((double)width * height * channels));
+}
+
+// cooks one image, files whose cooked version was made from the same image are skipped
+void CookTexture(CookedTexture & texture, bool mipmaps)
+{
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    MappedFile source;
+    if (!source.Open(texture.path))
+    {
+        texture.failed = true;
+        return;
+    }
+    unsigned long long source_hash = HashBytes(source.data, source.size);
+
+    CompressedImage image;
+    unsigned long long cooked_hash;
+    bool has_hash = false;
+    if (DDS::Read(CookedTexturePath(texture.path), image, cooked_hash, has_hash) && has_hash && cooked_hash == source_hash)
+    {
+        texture.up_to_date = true;
+        texture.format = image.format;
+        texture.width = image.levels[0].width;
+        texture.height = image.levels[0].height;
+        texture.levels = (int)image.levels.size();
+        texture.cooked_bytes = image.Bytes();
+        return;
+    }
+
+    int components;
+    unsigned char * pixels = stbi_load_from_memory(source.data, (int)source.size, &texture.width, &texture.height, &components, 4);
+    if (!pixels)
+    {
+        texture.failed = true;
+        return;
+    }
+    vector<unsigned char> rgba(pixels, pixels + (size_t)texture.width * texture.height * 4);
+    stbi_image_free(pixels);
+    texture.source_bytes = (size_t)texture.width * texture.height * components;
+    if (mipmaps)
+        texture.source_bytes += texture.source_bytes / 3;
+
+    image = CompressedImage();
+    image.format = CookedFormat(texture.type, rgba);
+    int width = texture.width, height = texture.height;
+    for (;;)
+    {
+        image.AddLevel(width, height);
+        const CompressedLevel & level = image.levels.back();
+        CompressImage(&rgba[0], width, height, image.format, &image.data[level.offset]);
+        if (image.levels.size() == 1)
+            texture.rmse = CompressionError(rgba, &image.data[level.offset], width, height, image.format);
+        if (!mipmaps || (width == 1 && height == 1))
+            break;
+
+        vector<unsigned char> next;
+        DownsampleImage(rgba, width, height, texture.type == "normal_texture", next, width, height);
+        rgba.swap(next);
+    }
+
+    texture.format = image.format;
+    texture.levels = (int)image.levels.size();
+    texture.cooked_bytes = image.Bytes();
+    texture.failed = !DDS::Write(CookedTexturePath(texture.path), image, source_hash);
+    texture.ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// cooks every texture referenced by the models (their materials decide the formats) and every cubemap face,
+// one image per worker thread; returns false if an image could not be cooked
+bool CookTextures(const vector<string> & model_paths, const vector<vector<string>> & cubemaps, unsigned int thread_count = 0)
+{
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+    // the first type an image is used with decides its format
+    vector<CookedTexture> textures;
+    vector<bool> mipmaps;
+    set<string> seen;
+    for (const string & model_path : model_paths)
+    {
+        ImportedModel imported;
+        Model::Import(model_path, imported);
+        for (const MeshCache::MeshView & view : imported.views)
+            for (const Texture & reference : view.textures)
+            {
+                string path = TextureCache::CanonicalPath(imported.directory + '/' + reference.path);
+                if (!seen.insert(path).second)
+                    continue;
+                textures.push_back(CookedTexture());
+                textures.back().path = path;
+                textures.back().type = reference.type;
+                mipmaps.push_back(true);
+            }
+    }
+    for (const vector<string> & faces : cubemaps)
+        for (const string & face : faces)
+            if (seen.insert(TextureCache::CanonicalPath(face)).second)
+            {
+                textures.push_back(CookedTexture());
+                textures.back().path = TextureCache::CanonicalPath(face);
+                textures.back().type = "cubemap";
+                mipmaps.push_back(false);
+            }
+
+    {
+        ThreadPool pool(thread_count);
+        for (size_t i = 0; i < textures.size(); i++)
+            pool.Submit([&textures, &mipmaps, i]() { CookTexture(textures[i], mipmaps[i]); });
+    }
+
+    bool all_cooked = true;
+    size_t source_bytes = 0, cooked_bytes = 0;
+    for (const CookedTexture & texture : textures)
+    {
+        if (texture.failed)
+        {
+            cout << "ERROR::TEXTURE_COOKER:: cannot cook " << texture.path << endl;
+            all_cooked = false;
+            continue;
+        }
+        cout << "TEXTURE_COOKER:: " << texture.path << ": " << BlockFormatName(texture.format) << ", " << texture.width << "x" << texture.height
+             << ", " << texture.levels << " levels, ";
+        if (texture.up_to_date)
+            cout << texture.cooked_bytes / 1024 << " KiB, up to date" << endl;
+        else
+        {
+            cout << texture.source_bytes / 1024 << " KiB -> " << texture.cooked_bytes / 1024 << " KiB, rmse = " << texture.rmse
+                 << ", " << texture.ms << " ms" << endl;
+            source_bytes += texture.source_bytes;
+            cooked_bytes += texture.cooked_bytes;
+        }
+    }
+    cout << "TEXTURE_COOKER:: " << textures.size() << " images, cooked " << source_bytes / (1024.0 * 1024.0) << " MiB into "
+         << cooked_bytes / (1024.0 * 1024.0) << " MiB in " << chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count()
+         << " ms" << endl;
+    return all_cooked;
+}
+
+#endif
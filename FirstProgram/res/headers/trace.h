@@ -0,0 +1,202 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// scoped CPU timeline of the program, written as a Chrome trace (chrome://tracing, ui.perfetto.dev) to find frame time
+// spikes, e.g. while assets load
+//
+//   TRACE_SCOPE("name")        records the time until the end of the enclosing block, name has to be a string literal
+//   TRACE_THREAD_NAME("name")  names the calling thread in the trace
+//
+// recording is off until TraceRecorder::Start (--trace), a scope then costs one relaxed atomic load;
+// building with NO_TRACING removes the scopes altogether
+#ifndef NO_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) TraceRecorder::Get().SetThreadName(name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+#endif
+
+// a finished scope, times in ns since TraceRecorder::Start
+struct TraceEvent
+{
+    const char * name;
+    unsigned long long start_ns;
+    unsigned long long duration_ns;
+};
+
+// events of one thread: only that thread writes, so appending needs no lock; the ring keeps the newest CAPACITY events
+// and the count is published with release order, a reader sees every event below it complete
+struct TraceBuffer
+{
+    static const size_t CAPACITY = 1 << 16;
+
+    TraceEvent events[CAPACITY];
+    atomic<unsigned long long> written;
+    unsigned int thread_index = 0;
+    const char * thread_name = NULL;
+
+    TraceBuffer() : written(0) {}
+
+    void Add(const TraceEvent & event)
+    {
+        unsigned long long index = written.load(memory_order_relaxed);
+        events[index % CAPACITY] = event;
+        written.store(index + 1, memory_order_release);
+    }
+};
+
+// owner of the buffers of all threads that recorded (a buffer outlives its thread, so the workers of a finished load
+// stay in the trace); a thread registers its buffer under the lock once, with its first event
+class TraceRecorder
+{
+public:
+
+    static TraceRecorder & Get()
+    {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    void Start()
+    {
+        start = chrono::steady_clock::now();
+        // publishes start to the threads that see the recording enabled
+        enabled.store(true, memory_order_release);
+    }
+
+    bool Enabled() const { return enabled.load(memory_order_acquire); }
+
+    unsigned long long Now() const
+    {
+        return (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+    void Add(const char * name, unsigned long long start_ns, unsigned long long end_ns)
+    {
+        TraceEvent event = { name, start_ns, end_ns - start_ns };
+        ThreadBuffer().Add(event);
+    }
+
+    // name has to outlive the recorder (a string literal)
+    void SetThreadName(const char * name)
+    {
+        if (Enabled())
+            ThreadBuffer().thread_name = name;
+    }
+
+    // writes the events in the Chrome trace event format ("X" events, times in us) and stops the recording,
+    // the other threads must not record any more (the loader workers are joined when Load returns)
+    bool Write(const string & path)
+    {
+        enabled.store(false, memory_order_relaxed);
+        ofstream json(path);
+        if (!json)
+        {
+            cout << "ERROR::TRACE:: Cannot write " << path << endl;
+            return false;
+        }
+
+        lock_guard<mutex> lock(buffers_mutex);
+        unsigned long long events = 0, lost = 0;
+        json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        json << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"FirstProgram\"}}";
+        for (const unique_ptr<TraceBuffer> & buffer : buffers)
+        {
+            const char * thread_name = buffer->thread_name ? buffer->thread_name : "thread";
+            json << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_index
+                 << ",\"args\":{\"name\":\"" << thread_name << ' ' << buffer->thread_index << "\"}}";
+
+            unsigned long long written = buffer->written.load(memory_order_acquire);
+            unsigned long long first = written > TraceBuffer::CAPACITY ? written - TraceBuffer::CAPACITY : 0;
+            lost += first;
+            for (unsigned long long i = first; i < written; i++)
+            {
+                const TraceEvent & event = buffer->events[i % TraceBuffer::CAPACITY];
+                json << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_index
+                     << ",\"ts\":" << event.start_ns / 1000 << '.' << Fraction(event.start_ns)
+                     << ",\"dur\":" << event.duration_ns / 1000 << '.' << Fraction(event.duration_ns) << '}';
+                events++;
+            }
+        }
+        json << "\n]}\n";
+        cout << "TRACE:: " << events << " events of " << buffers.size() << " threads written to " << path;
+        if (lost > 0)
+            cout << " (" << lost << " older events overwritten)";
+        cout << endl;
+        return true;
+    }
+
+private:
+
+    atomic<bool> enabled;
+    chrono::steady_clock::time_point start;
+    mutex buffers_mutex;
+    vector<unique_ptr<TraceBuffer>> buffers;
+
+    TraceRecorder() : enabled(false) {}
+
+    TraceBuffer & ThreadBuffer()
+    {
+        thread_local TraceBuffer * buffer = NULL;
+        if (!buffer)
+        {
+            lock_guard<mutex> lock(buffers_mutex);
+            buffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer()));
+            buffer = buffers.back().get();
+            buffer->thread_index = (unsigned int)buffers.size();
+        }
+        return *buffer;
+    }
+
+    // the three digits below a microsecond
+    static string Fraction(unsigned long long ns)
+    {
+        string digits = to_string(ns % 1000);
+        return string(3 - digits.size(), '0') + digits;
+    }
+};
+
+// records the time from its construction to its destruction (see TRACE_SCOPE)
+class TraceScope
+{
+public:
+
+    explicit TraceScope(const char * name) : name(name)
+    {
+        if (TraceRecorder::Get().Enabled())
+            start_ns = TraceRecorder::Get().Now();
+    }
+
+    // scopes still open when the recording stops are dropped
+    ~TraceScope()
+    {
+        if (start_ns != NOT_RECORDED && TraceRecorder::Get().Enabled())
+            TraceRecorder::Get().Add(name, start_ns, TraceRecorder::Get().Now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope & operator=(const TraceScope &) = delete;
+
+private:
+
+    static const unsigned long long NOT_RECORDED = ~0ull;
+
+    const char * name;
+    unsigned long long start_ns = NOT_RECORDED;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "gl_state.h"
+#include "shader.h"
+
+// binding points of the uniform blocks shared by all programs in res/shaders
+enum UniformBlockBinding
+{
+    CAMERA_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    SHADOW_BLOCK_BINDING = 2,
+    MESH_DECODE_BLOCK_BINDING = 3,  // per mesh, see MeshDecodeBuffer
+    MATERIAL_BLOCK_BINDING = 4      // per model material, see MaterialBuffer
+};
+
+// C++ mirrors of the std140 blocks, vec3 members are padded to 16 bytes
+// (a following float can use the free 4 bytes, exactly as std140 places it)
+
+// layout (std140) uniform Camera { mat4 view; mat4 projection; vec3 view_pos; };
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 view_pos;
+    float padding;
+};
+
+// layout (std140) uniform Light { vec3 light_pos; vec3 light_color; float far_plane; };
+struct LightBlock
+{
+    glm::vec3 light_pos;
+    float padding;
+    glm::vec3 light_color;
+    float far_plane;
+};
+
+// layout (std140) uniform Shadow { mat4 shadowMatrices[6]; };
+struct ShadowBlock
+{
+    glm::mat4 shadow_matrices[6];
+};
+
+// layout (std140) uniform MeshDecode { vec3 position_offset; bool packed_vertices; vec3 position_scale; };
+struct MeshDecodeBlock
+{
+    glm::vec3 position_offset;
+    GLint packed_vertices;      // std140 bool
+    glm::vec3 position_scale;
+    float padding;
+};
+
+// layout (std140) uniform MaterialFlags { bool two_channel_normals; };
+struct MaterialBlock
+{
+    GLint two_channel_normals;  // std140 bool
+    float padding[3];
+};
+
+// uniform buffer with one or more slots of the block T (e.g. one camera slot per view)
+// all slots are updated at the start of the frame and each view only binds its range
+template <typename T>
+class UniformBuffer
+{
+public:
+    GLuint UBO = 0;
+
+    void Create(GLuint binding, GLuint slot_count = 1)
+    {
+        this->binding = binding;
+
+        // every bound range has to start at a multiple of the offset alignment
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = ((GLsizeiptr)sizeof(T) + alignment - 1) / alignment * alignment;
+
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, stride * slot_count, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        Bind(0);
+    }
+
+    void Update(GLuint slot, const T & data) const
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, slot * stride, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // every program that declares the block reads this slot from now on
+    void Bind(GLuint slot) const
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, UBO, slot * stride, sizeof(T));
+    }
+
+private:
+    GLuint binding = 0;
+    GLsizeiptr stride = 0;
+};
+
+// uniform buffer of blocks that are added once and never change (one per mesh or material), draws bind the slot
+// of their object through GLStateCache, so consecutive draws with the same slot bind it once;
+// the buffer is uploaded again before the first bind after a block was added
+template <typename T>
+class UniformSlotBuffer
+{
+public:
+
+    GLuint Add(const T & block)
+    {
+        blocks.push_back(block);
+        dirty = true;
+        return (GLuint)blocks.size() - 1;
+    }
+
+    void Bind(GLuint binding, GLuint slot)
+    {
+        if (dirty)
+            Upload();
+        GLStateCache::Get().BindUniformBufferRange(binding, UBO, slot * stride, sizeof(T));
+    }
+
+    // deletes the buffer while the context is still current
+    void Destroy()
+    {
+        if (UBO)
+        {
+            GLStateCache::Get().ForgetUniformBuffer(UBO);
+            glDeleteBuffers(1, &UBO);
+        }
+        UBO = 0;
+    }
+
+private:
+
+    GLuint UBO = 0;
+    GLsizeiptr stride = 0;
+    vector<T> blocks;
+    bool dirty = true;
+
+    void Upload()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = ((GLsizeiptr)sizeof(T) + alignment - 1) / alignment * alignment;
+
+        vector<unsigned char> data(stride * blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++)
+            memcpy(&data[i * stride], &blocks[i], sizeof(T));
+
+        if (!UBO)
+            glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, data.size(), &data[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        // the same name with new contents, the binding has to be made again
+        GLStateCache::Get().ForgetUniformBuffer(UBO);
+        dirty = false;
+    }
+};
+
+// connects the shared blocks of a program to their binding points (blocks the program does not declare are skipped)
+void BindSharedUniformBlocks(const Shader & shader)
+{
+    shader.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+    shader.bindUniformBlock("Light", LIGHT_BLOCK_BINDING);
+    shader.bindUniformBlock("Shadow", SHADOW_BLOCK_BINDING);
+    shader.bindUniformBlock("MeshDecode", MESH_DECODE_BLOCK_BINDING);
+    shader.bindUniformBlock("MaterialFlags", MATERIAL_BLOCK_BINDING);
+}
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "gl_state.h"
+#include "uniform_buffer.h"
+
+using namespace std;
+
+struct Vertex {
+
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+    glm::vec3 Tangent;
+    glm::vec3 Bitangent;
+};
+
+// layout of the vertex buffer of a mesh, chosen per model
+enum VertexFormat
+{
+    VERTEX_FORMAT_FLOAT = 0,    // Vertex, 56 bytes
+    VERTEX_FORMAT_PACKED = 1    // PackedVertex, 20 bytes, decoded in the vertex shaders (MeshDecode block)
+};
+
+// quantized vertex:
+//   position   GL_UNSIGNED_SHORT x4, normalized, relative to the bounding box of the mesh (w unused)
+//   normal     GL_INT_2_10_10_10_REV, octahedral x / y as 10 bit integers in [-511, 511]
+//   tangent    the same, w = handedness of the bitangent (+1 / -1), the bitangent is rebuilt as cross(normal, tangent) * w
+//   uv         two half floats
+// normal and tangent are not normalized by the attribute setup (GL 3.3 and 4.2 map signed normalized integers differently),
+// the shaders divide by 511
+struct PackedVertex
+{
+    unsigned short position[4];
+    GLuint normal;
+    GLuint tangent;
+    GLuint tex_coords;
+};
+
+const char * VertexFormatName(VertexFormat format)
+{
+    return format == VERTEX_FORMAT_PACKED ? "packed" : "float";
+}
+
+size_t VertexStride(VertexFormat format)
+{
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+// unit vector -> point of the octahedron unfolded onto [-1, 1]^2
+glm::vec2 OctahedronEncode(const glm::vec3 & n)
+{
+    float sum = fabs(n.x) + fabs(n.y) + fabs(n.z);
+    if (sum == 0.0f)
+        return glm::vec2(0.0f);
+    glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+    if (n.z < 0.0f)
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    return p;
+}
+
+// the decode of the vertex shaders
+glm::vec3 OctahedronDecode(const glm::vec2 & e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+    if (n.z < 0.0f)
+    {
+        glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        n.x = folded.x;
+        n.y = folded.y;
+    }
+    return glm::normalize(n);
+}
+
+GLuint PackInt2101010(int x, int y, int z, int w)
+{
+    return ((GLuint)x & 0x3FFu) | (((GLuint)y & 0x3FFu) << 10) | (((GLuint)z & 0x3FFu) << 20) | (((GLuint)w & 0x3u) << 30);
+}
+
+// sign extended component of a GL_INT_2_10_10_10_REV value
+int UnpackInt2101010(GLuint packed, int component)
+{
+    int bits = component == 3 ? 2 : 10;
+    int value = (int)((packed >> (component * 10)) & ((1u << bits) - 1));
+    return value >= (1 << (bits - 1)) ? value - (1 << bits) : value;
+}
+
+// 10 bit octahedral encoding of a unit vector, the rounding of x and y is chosen by the smallest angle to n
+// (plain rounding can be off by a grid cell on the folded half)
+GLuint PackDirection(const glm::vec3 & n, int w)
+{
+    glm::vec2 p = OctahedronEncode(n) * 511.0f;
+    int best_x = 0, best_y = 0;
+    float best = -2.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        int x = (int)glm::clamp((i & 1) ? ceil(p.x) : floor(p.x), -511.0f, 511.0f);
+        int y = (int)glm::clamp((i & 2) ? ceil(p.y) : floor(p.y), -511.0f, 511.0f);
+        float similarity = glm::dot(OctahedronDecode(glm::vec2((float)x, (float)y) / 511.0f), n);
+        if (similarity > best)
+        {
+            best = similarity;
+            best_x = x;
+            best_y = y;
+        }
+    }
+    return PackInt2101010(best_x, best_y, 0, w);
+}
+
+glm::vec3 UnpackDirection(GLuint packed)
+{
+    return OctahedronDecode(glm::vec2((float)UnpackInt2101010(packed, 0), (float)UnpackInt2101010(packed, 1)) / 511.0f);
+}
+
+// position and scale that map the normalized 16 bit positions back into the bounding box
+void PositionQuantization(const glm::vec3 & aabb_min, const glm::vec3 & aabb_max, MeshDecodeBlock & block)
+{
+    block.position_offset = aabb_min;
+    block.position_scale = aabb_max - aabb_min;
+    block.packed_vertices = 1;
+}
+
+PackedVertex PackVertex(const Vertex & vertex, const MeshDecodeBlock & block)
+{
+    PackedVertex packed;
+    for (int c = 0; c < 3; c++)
+    {
+        float t = block.position_scale[c] > 0.0f ? (vertex.Position[c] - block.position_offset[c]) / block.position_scale[c] : 0.0f;
+        packed.position[c] = (unsigned short)(glm::clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+    packed.position[3] = 0;
+
+    // meshes without texture coordinates have no tangent frame, its direction is arbitrary then
+    float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent);
+    packed.normal = PackDirection(vertex.Normal, 0);
+    packed.tangent = PackDirection(vertex.Tangent, handedness < 0.0f ? -1 : 1);
+    packed.tex_coords = glm::packHalf2x16(vertex.TexCoords);
+    return packed;
+}
+
+// what the vertex shaders see of a packed vertex
+Vertex UnpackVertex(const PackedVertex & packed, const MeshDecodeBlock & block)
+{
+    Vertex vertex;
+    for (int c = 0; c < 3; c++)
+        vertex.Position[c] = block.position_offset[c] + packed.position[c] / 65535.0f * block.position_scale[c];
+    vertex.Normal = UnpackDirection(packed.normal);
+    vertex.Tangent = UnpackDirection(packed.tangent);
+    vertex.Bitangent = glm::cross(vertex.Normal, vertex.Tangent) * (float)UnpackInt2101010(packed.tangent, 3);
+    vertex.TexCoords = glm::unpackHalf2x16(packed.tex_coords);
+    return vertex;
+}
+
+// error of the packed vertices against the float ones (directions as angles in degrees)
+struct VertexQuantizationError
+{
+    size_t vertices = 0;
+    double position_max = 0.0;          // object space units
+    double position_relative = 0.0;     // position_max / diagonal of the bounding box
+    double normal_max = 0.0, normal_sum = 0.0;
+    double tangent_max = 0.0;
+    double bitangent_max = 0.0;         // against the normalized bitangent of the importer, includes its non-orthogonality
+    double uv_max = 0.0;
+
+    double NormalMean() const { return vertices ? normal_sum / vertices : 0.0; }
+
+    VertexQuantizationError & operator+=(const VertexQuantizationError & other)
+    {
+        vertices += other.vertices;
+        position_max = max(position_max, other.position_max);
+        position_relative = max(position_relative, other.position_relative);
+        normal_max = max(normal_max, other.normal_max);
+        normal_sum += other.normal_sum;
+        tangent_max = max(tangent_max, other.tangent_max);
+        bitangent_max = max(bitangent_max, other.bitangent_max);
+        uv_max = max(uv_max, other.uv_max);
+        return *this;
+    }
+
+    void Add(const Vertex & reference, const Vertex & decoded, double diagonal)
+    {
+        vertices++;
+        double position = glm::length(decoded.Position - reference.Position);
+        position_max = max(position_max, position);
+        if (diagonal > 0.0)
+            position_relative = max(position_relative, position / diagonal);
+        double normal = Angle(reference.Normal, decoded.Normal);
+        normal_max = max(normal_max, normal);
+        normal_sum += normal;
+        // tangent frames of meshes without texture coordinates are all zero
+        if (glm::dot(reference.Tangent, reference.Tangent) > 0.0f)
+            tangent_max = max(tangent_max, Angle(reference.Tangent, decoded.Tangent));
+        if (glm::dot(reference.Bitangent, reference.Bitangent) > 0.0f)
+            bitangent_max = max(bitangent_max, Angle(reference.Bitangent, decoded.Bitangent));
+        uv_max = max(uv_max, (double)glm::max(fabs(decoded.TexCoords.x - reference.TexCoords.x), fabs(decoded.TexCoords.y - reference.TexCoords.y)));
+    }
+
+private:
+
+    static double Angle(const glm::vec3 & a, const glm::vec3 & b)
+    {
+        float lengths = glm::length(a) * glm::length(b);
+        if (lengths == 0.0f)
+            return 0.0;
+        return glm::degrees(acos(glm::clamp((double)glm::dot(a, b) / lengths, -1.0, 1.0)));
+    }
+};
+
+// packs the vertices of a mesh with the bounds aabb_min / aabb_max, fills the decode block and the error against the input
+void PackVertices(const Vertex * vertices, size_t vertex_count, const glm::vec3 & aabb_min, const glm::vec3 & aabb_max,
+                  vector<PackedVertex> & packed, MeshDecodeBlock & block, VertexQuantizationError & error)
+{
+    PositionQuantization(aabb_min, aabb_max, block);
+    double diagonal = glm::length(aabb_max - aabb_min);
+    packed.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        packed[i] = PackVertex(vertices[i], block);
+        error.Add(vertices[i], UnpackVertex(packed[i], block), diagonal);
+    }
+}
+
+// points the vertex attributes 0 - 4 of the bound vertex array at the bound GL_ARRAY_BUFFER, laid out as format
+// (the packed format has no bitangent attribute)
+void SetVertexAttributes(VertexFormat format)
+{
+    if (format == VERTEX_FORMAT_PACKED)
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, tex_coords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, tangent));
+        return;
+    }
+    // A great thing about structs is that their memory layout is sequential for all its items.
+    // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+    // again translates to 3/2 floats which translates to a byte array.
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+}
+
+
+// decode blocks of all meshes in one uniform buffer, slot 0 is the identity of float meshes
+class MeshDecodeBuffer
+{
+public:
+
+    static MeshDecodeBuffer & Get()
+    {
+        static MeshDecodeBuffer buffer;
+        return buffer;
+    }
+
+    GLuint Add(const MeshDecodeBlock & block) { return blocks.Add(block); }
+    void Bind(GLuint slot) { blocks.Bind(MESH_DECODE_BLOCK_BINDING, slot); }
+    void Destroy() { blocks.Destroy(); }
+
+private:
+
+    UniformSlotBuffer<MeshDecodeBlock> blocks;
+
+    MeshDecodeBuffer()
+    {
+        MeshDecodeBlock identity;
+        identity.position_offset = glm::vec3(0.0f);
+        identity.position_scale = glm::vec3(1.0f);
+        identity.packed_vertices = 0;
+        blocks.Add(identity);
+    }
+};
+
+
+// bytes of vertex buffer the draws read per frame, counted per draw as
+// every vertex of the mesh once per instance (perfect post-transform cache) up to one vertex per index (no cache)
+class VertexFetchStats
+{
+public:
+
+    static VertexFetchStats & Get()
+    {
+        static VertexFetchStats stats;
+        return stats;
+    }
+
+    void BeginFrame() { frames++; }
+
+    void AddDraw(size_t vertex_count, GLsizei index_count, size_t stride, GLsizei instance_count)
+    {
+        unique_bytes += (unsigned long long)vertex_count * stride * instance_count;
+        index_bytes += (unsigned long long)index_count * stride * instance_count;
+    }
+
+    void PrintReport() const
+    {
+        double per_frame = frames ? 1.0 / (frames * 1024.0 * 1024.0) : 0.0;
+        cout << "VERTEX_FORMAT:: vertex fetch per frame: " << unique_bytes * per_frame << " MiB (every vertex once) to "
+             << index_bytes * per_frame << " MiB (every index)" << endl;
+    }
+
+private:
+    unsigned long long frames = 0, unique_bytes = 0, index_bytes = 0;
+
+    VertexFetchStats() {}
+};
+
+#endif
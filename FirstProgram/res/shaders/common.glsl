@@ -0,0 +1,48 @@
+// declarations shared by all shaders, Shader inserts this file after the #version line of every stage
+
+// packed meshes store positions relative to their bounds and octahedral normal / tangent (see vertex_format.h),
+// float meshes bind the identity
+layout (std140) uniform MeshDecode
+{
+    vec3 position_offset;
+    bool packed_vertices;
+    vec3 position_scale;
+};
+
+// flags of the model material (MaterialBuffer in material.h)
+layout (std140) uniform MaterialFlags
+{
+    bool two_channel_normals;   // the normal map stores x and y only (BC5), z is rebuilt
+};
+
+// unit vector <-> point of the octahedron unfolded onto [-1, 1]^2 (OctahedronEncode / OctahedronDecode in vertex_format.h)
+vec2 octahedron_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 octahedron_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// normal / tangent of a packed vertex, x and y as 10 bit integers in [-511, 511]
+vec3 unpack_octahedron(vec2 e)
+{
+    return octahedron_decode(e / 511.0);
+}
+
+// normal of the G-buffer (deferred.h), stored in a GL_RG16 texture as [0, 1]
+vec2 gbuffer_normal_encode(vec3 n)
+{
+    return octahedron_encode(n) * 0.5 + 0.5;
+}
+
+vec3 gbuffer_normal_decode(vec2 e)
+{
+    return octahedron_decode(e * 2.0 - 1.0);
+}
@@ -0,0 +1,78 @@
+#version 330 core
+// the scene light of the forward shaders (ambient, diffuse, specular and the shadow cubemap) on the G-buffer
+out vec4 FragColor;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+layout (std140) uniform Light
+{
+    vec3 light_pos;
+    vec3 light_color;
+    float far_plane;
+};
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_material;
+uniform sampler2D gbuffer_depth;
+uniform samplerCube depthMap;
+uniform mat4 inverse_view_projection;
+
+in vec2 TexCoords;
+
+float ComputeShadow(vec3 FragPos) 
+{
+    vec3 lightToFrag = FragPos - light_pos;
+
+    float depth = texture(depthMap, lightToFrag).r;
+
+    // if object is out of the frustum return 1, so there is no dark region out of the fov of shadow perspective projection 
+    if (depth == 1)
+        return 1.0f;
+
+    depth *= far_plane;
+
+    float bias = 0.1f;
+    float delta = length(lightToFrag) - (depth + bias);
+
+    if (delta > 0) 
+        return 0.0f;
+    else
+        return 1.0f;
+}
+
+void main() 
+{
+    float depth = texture(gbuffer_depth, TexCoords).r;
+    // nothing was drawn here, the skybox fills it later
+    if (depth == 1.0)
+        discard;
+    vec4 world = inverse_view_projection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec3 FragPos = world.xyz / world.w;
+
+    vec4 albedo = texture(gbuffer_albedo, TexCoords);
+    vec3 normal = gbuffer_normal_decode(texture(gbuffer_normal, TexCoords).rg);
+    vec2 material = texture(gbuffer_material, TexCoords).rg;
+
+    vec3 ambient_color = albedo.rgb;
+    vec3 ambient = albedo.a * ambient_color * light_color;
+
+    vec3 light_dir = normalize(light_pos - FragPos);
+    float diff = max(dot(light_dir, normal), 0); 
+    vec3 diffuse = diff * light_color; 
+
+    vec3 view_dir = normalize(view_pos - FragPos);   
+    vec3 reflect_dir = reflect(-light_dir, normal);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0f), material.g * 255.0);
+    vec3 specular = material.r * spec * light_color;
+
+    float shadow = ComputeShadow(FragPos);
+    vec3 result = (ambient + shadow * (diffuse + specular)) * ambient_color;
+
+    FragColor = vec4(result, 1.0f);
+}
@@ -7,7 +7,12 @@ uniform bool mode; // 0 - reflection, 1 - refraction
 in vec3 Normal;
 in vec3 FragPos;
 
-uniform vec3 view_pos;
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 
 void main()
 {
@@ -3,16 +3,27 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance model matrix of instanced draws (columns in locations 5 - 8)
+layout (location = 5) in mat4 instance_model;
+uniform bool instanced;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 
 out vec3 Normal;
 out vec3 FragPos;
 
 void main()
 {
-    // right calculation for non uniform scaling on model
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    FragPos = vec3(model * vec4(aPos, 1.0f));
-    gl_Position = projection * view  * model * vec4(aPos, 1.0);
+    mat4 world = instanced ? instance_model : model;
+    vec3 position = position_offset + aPos * position_scale;
+    vec3 normal = packed_vertices ? unpack_octahedron(aNormal.xy) : aNormal;
+    // right calculation for non uniform scaling on world
+    Normal = mat3(transpose(inverse(world))) * normal;
+    FragPos = vec3(world * vec4(position, 1.0f));
+    gl_Position = projection * view  * world * vec4(position, 1.0);
 }
@@ -0,0 +1,29 @@
+#version 330 core
+// G-buffer of the deferred path (deferred.h), lit in deferred_light_fragment.glsl as in normal_mapping_fragment.glsl
+layout (location = 0) out vec4 Albedo;      // rgb: diffuse color, a: ambient strength
+layout (location = 1) out vec2 GNormal;     // octahedral world normal
+layout (location = 2) out vec2 Material;    // specular strength, shininess / 255
+
+uniform sampler2D diffuse_texture1;
+uniform sampler2D normal_texture1;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+in mat3 TBN;
+
+void main() 
+{
+    vec3 normal = texture(normal_texture1, TexCoords).rgb;
+    // from color to coordinates
+    normal = normal * 2.0 - 1.0;
+    // cooked (BC5) normal maps only store x and y
+    if (two_channel_normals)
+        normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    // from tangent to world space
+    normal = normalize(TBN * normal);
+
+    Albedo = vec4(texture(diffuse_texture1, TexCoords).rgb, 0.5);
+    GNormal = gbuffer_normal_encode(normal);
+    Material = vec2(0.40, 32.0 / 255.0);
+}
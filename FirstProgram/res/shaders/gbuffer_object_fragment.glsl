@@ -0,0 +1,18 @@
+#version 330 core
+// G-buffer of the deferred path (deferred.h), lit in deferred_light_fragment.glsl as in object_fragment.glsl
+layout (location = 0) out vec4 Albedo;      // rgb: diffuse color, a: ambient strength
+layout (location = 1) out vec2 GNormal;     // octahedral world normal
+layout (location = 2) out vec2 Material;    // specular strength, shininess / 255
+
+uniform sampler2D diffuse_texture1;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+void main() 
+{
+    Albedo = vec4(texture(diffuse_texture1, TexCoords).rgb, 0.55);
+    GNormal = gbuffer_normal_encode(normalize(Normal));
+    Material = vec2(0.40, 32.0 / 255.0);
+}
@@ -0,0 +1,70 @@
+#version 330 core
+// G-buffer of the deferred path (deferred.h), lit in deferred_light_fragment.glsl as in parallax_mapping_fragment.glsl;
+// the parallax search runs once per pixel here instead of once per fragment of every light
+layout (location = 0) out vec4 Albedo;      // rgb: diffuse color, a: ambient strength
+layout (location = 1) out vec2 GNormal;     // octahedral world normal
+layout (location = 2) out vec2 Material;    // specular strength, shininess / 255
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+uniform sampler2D diffuse_texture1;
+uniform sampler2D normal_texture1;
+uniform sampler2D specular_texture1; // height, not specular
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+in mat3 TBN;
+
+vec2 ComputeParallaxOffset(vec2 texCoords, vec3 viewDir)
+{
+    float height = 1 - texture(specular_texture1, texCoords).r;
+    float layers = 20;
+    float delta_height = 1 / layers;
+    float curr_height = 1;
+    vec2 delta_texture = viewDir.xy * 0.1f / layers;
+
+    while (curr_height > height)
+    {
+        curr_height -= delta_height;
+        texCoords += delta_texture;
+        height = 1 - texture(specular_texture1, texCoords).r;
+    }
+
+    vec2 delta = delta_texture * 0.5f;
+    vec2 new_tex =  texCoords - delta;
+    for (int i = 0; i < 8; i++)
+    {
+        delta *= 0.5f;
+        if (1 - texture(specular_texture1, new_tex).r > height)
+            new_tex += delta;
+        else
+            new_tex -= delta;
+    }
+
+    return new_tex;
+}
+
+void main() 
+{
+    vec3 viewDirTangentSpace = normalize(TBN * view_pos - TBN * FragPos);
+    vec2 newTexCoords = ComputeParallaxOffset(TexCoords, viewDirTangentSpace);
+
+    vec3 normal = texture(normal_texture1, newTexCoords).rgb;
+    // from color to coordinates
+    normal = normal * 2.0 - 1.0;
+    // cooked (BC5) normal maps only store x and y
+    if (two_channel_normals)
+        normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    // from tangent to world space
+    normal = normalize(TBN * normal);
+
+    Albedo = vec4(texture(diffuse_texture1, newTexCoords).rgb, 0.5);
+    GNormal = gbuffer_normal_encode(normal);
+    Material = vec2(0.40, 32.0 / 255.0);
+}
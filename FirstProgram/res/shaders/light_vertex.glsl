@@ -2,10 +2,20 @@
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance model matrix of instanced draws (columns in locations 5 - 8)
+layout (location = 5) in mat4 instance_model;
+uniform bool instanced;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    mat4 world = instanced ? instance_model : model;
+    vec3 position = position_offset + aPos * position_scale;
+    gl_Position = projection * view * world * vec4(position, 1.0);
 }
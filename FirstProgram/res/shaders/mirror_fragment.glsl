@@ -1,12 +1,12 @@
 #version 330 core
 out vec4 FragColor;
 
-in vec4 ClipCoord;
+in vec4 ReflectionCoord;
 uniform sampler2D mirrorTexture;
 
 void main()
 {
-	vec2 ndc = (ClipCoord.xy/ClipCoord.w)/2.0 + 0.5;
-	vec2 newTexCoords = vec2(1-ndc.x, ndc.y);
-	FragColor = texture(mirrorTexture, newTexCoords);
+	// the texture holds the true mirror image, the surface is projected into it like into a screen
+	vec2 texCoords = (ReflectionCoord.xy / ReflectionCoord.w) / 2.0 + 0.5;
+	FragColor = texture(mirrorTexture, texCoords);
 }
@@ -2,14 +2,23 @@
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// world to clip space of the camera the reflection texture was rendered with (see PlanarReflection)
+uniform mat4 reflection_matrix;
 
-out vec4 ClipCoord;
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+out vec4 ReflectionCoord;
 
 void main()
 {
-    ClipCoord = projection * view * model * vec4(aPos, 1.0);
-    gl_Position = ClipCoord;
+    vec3 position = position_offset + aPos * position_scale;
+    vec4 world = model * vec4(position, 1.0);
+    ReflectionCoord = reflection_matrix * world;
+    gl_Position = projection * view * world;
 }
 
@@ -2,11 +2,20 @@
 out vec4 FragColor;
 
 uniform vec3 object_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+layout (std140) uniform Light
+{
+    vec3 light_pos;
+    vec3 light_color;
+    float far_plane;
+};
 
-uniform float far_plane;
 uniform sampler2D diffuse_texture1;
 uniform sampler2D normal_texture1;
 uniform samplerCube depthMap;
@@ -43,6 +52,9 @@ void main()
     vec3 normal = texture(normal_texture1, TexCoords).rgb;
     // from color to coordinates
     normal = normal * 2.0 - 1.0;
+    // cooked (BC5) normal maps only store x and y
+    if (two_channel_normals)
+        normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
     // from tangent to world space
     normal = normalize(TBN * normal);
     
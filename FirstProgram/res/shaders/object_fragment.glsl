@@ -2,11 +2,20 @@
 out vec4 FragColor;
 
 uniform vec3 object_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+layout (std140) uniform Light
+{
+    vec3 light_pos;
+    vec3 light_color;
+    float far_plane;
+};
 
-uniform float far_plane;
 uniform sampler2D diffuse_texture1;
 uniform samplerCube depthMap;
 
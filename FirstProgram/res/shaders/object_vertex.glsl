@@ -4,8 +4,16 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance model matrix of instanced draws (columns in locations 5 - 8)
+layout (location = 5) in mat4 instance_model;
+uniform bool instanced;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 uniform bool reverse_normals;
 
 out vec3 Normal;
@@ -14,14 +22,17 @@ out vec2 TexCoords;
 
 void main()
 {
+    mat4 world = instanced ? instance_model : model;
+    vec3 position = position_offset + aPos * position_scale;
+    vec3 normal = packed_vertices ? unpack_octahedron(aNormal.xy) : aNormal;
 
     if (reverse_normals) 
-        Normal = transpose(inverse(mat3(model))) * (-1.0 * aNormal);
+        Normal = transpose(inverse(mat3(world))) * (-1.0 * normal);
     else
-        Normal = transpose(inverse(mat3(model))) * aNormal;
+        Normal = transpose(inverse(mat3(world))) * normal;
 
-    FragPos = vec3(model * vec4(aPos, 1.0f));
+    FragPos = vec3(world * vec4(position, 1.0f));
  
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * world * vec4(position, 1.0);
 }
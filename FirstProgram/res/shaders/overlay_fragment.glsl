@@ -0,0 +1,16 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec4 Color;
+
+// coverage of the glyphs in the red channel
+uniform sampler2D font;
+
+void main()
+{
+    float coverage = texture(font, TexCoords).r;
+    if (coverage == 0.0)
+        discard;
+    FragColor = vec4(Color.rgb, Color.a * coverage);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec4 aColor;
+
+out vec2 TexCoords;
+out vec4 Color;
+
+// positions are in pixels from the top left corner of the screen
+uniform vec2 screen_size;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Color = aColor;
+    gl_Position = vec4(aPos.x / screen_size.x * 2.0 - 1.0, 1.0 - aPos.y / screen_size.y * 2.0, 0.0, 1.0);
+}
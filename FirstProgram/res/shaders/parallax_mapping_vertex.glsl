@@ -2,12 +2,20 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in vec3 aTangent;
+layout (location = 3) in vec4 aTangent; // w: handedness of packed tangents
 layout (location = 4) in vec3 aBitangent;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance model matrix of instanced draws (columns in locations 5 - 8)
+layout (location = 5) in mat4 instance_model;
+uniform bool instanced;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 
 out vec3 Normal;
 out vec3 FragPos;
@@ -16,15 +24,24 @@ out mat3 TBN;
 
 void main()
 {
-    vec3 T = normalize(vec3(model * vec4(aTangent, 0.0)));
-    vec3 B = normalize(vec3(model * vec4(aBitangent, 0.0)));
-    vec3 N = normalize(vec3(model * vec4(aNormal, 0.0)));
+    mat4 world = instanced ? instance_model : model;
+    vec3 position = position_offset + aPos * position_scale;
+    vec3 normal = aNormal, tangent = aTangent.xyz, bitangent = aBitangent;
+    if (packed_vertices)
+    {
+        normal = unpack_octahedron(aNormal.xy);
+        tangent = unpack_octahedron(aTangent.xy);
+        bitangent = cross(normal, tangent) * aTangent.w;
+    }
+    vec3 T = normalize(vec3(world * vec4(tangent, 0.0)));
+    vec3 B = normalize(vec3(world * vec4(bitangent, 0.0)));
+    vec3 N = normalize(vec3(world * vec4(normal, 0.0)));
     TBN = mat3(T, B, N);
 
-    Normal = transpose(inverse(mat3(model))) * aNormal;
+    Normal = transpose(inverse(mat3(world))) * normal;
 
-    FragPos = vec3(model * vec4(aPos, 1.0f));
+    FragPos = vec3(world * vec4(position, 1.0f));
  
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * world * vec4(position, 1.0);
 }
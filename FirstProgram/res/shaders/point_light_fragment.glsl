@@ -0,0 +1,50 @@
+#version 330 core
+// one point light on the G-buffer, added to the lit frame (diffuse and specular as the scene light, no shadow)
+out vec4 FragColor;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_material;
+uniform sampler2D gbuffer_depth;
+uniform mat4 inverse_view_projection;
+uniform vec2 screen_size;
+
+flat in vec4 LightSphere;
+flat in vec3 LightColor;
+
+void main() 
+{
+    vec2 tex_coords = gl_FragCoord.xy / screen_size;
+    float depth = texture(gbuffer_depth, tex_coords).r;
+    if (depth == 1.0)
+        discard;
+    vec4 world = inverse_view_projection * vec4(vec3(tex_coords, depth) * 2.0 - 1.0, 1.0);
+    vec3 FragPos = world.xyz / world.w;
+
+    vec3 to_light = LightSphere.xyz - FragPos;
+    float light_distance = length(to_light);
+    if (light_distance >= LightSphere.w)
+        discard;
+    // inverse square falloff, windowed so that it reaches 0 at the radius
+    float window = 1.0 - pow(light_distance / LightSphere.w, 4.0);
+    float attenuation = window * window / (1.0 + light_distance * light_distance);
+
+    vec3 albedo = texture(gbuffer_albedo, tex_coords).rgb;
+    vec3 normal = gbuffer_normal_decode(texture(gbuffer_normal, tex_coords).rg);
+    vec2 material = texture(gbuffer_material, tex_coords).rg;
+
+    vec3 light_dir = to_light / light_distance;
+    float diff = max(dot(light_dir, normal), 0);
+    vec3 view_dir = normalize(view_pos - FragPos);
+    vec3 reflect_dir = reflect(-light_dir, normal);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0f), material.g * 255.0);
+
+    FragColor = vec4((diff + material.r * spec) * attenuation * LightColor * albedo, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+// light volume of the deferred path: the enclosing sphere mesh (deferred.h) placed around every point light
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aLightSphere;   // per light: position, radius
+layout (location = 2) in vec3 aLightColor;
+
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
+
+flat out vec4 LightSphere;
+flat out vec3 LightColor;
+
+void main()
+{
+    LightSphere = aLightSphere;
+    LightColor = aLightColor;
+    gl_Position = projection * view * vec4(aLightSphere.xyz + aPos * aLightSphere.w, 1.0);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform Shadow
+{
+    mat4 shadowMatrices[6];
+};
+
+uniform mat4 model;
+uniform int face; // cubemap face bound to the framebuffer
+
+out vec4 FragPos;
+
+void main()
+{
+    vec3 position = position_offset + aPos * position_scale;
+    FragPos = model * vec4(position, 1.0);
+    gl_Position = shadowMatrices[face] * FragPos;
+}
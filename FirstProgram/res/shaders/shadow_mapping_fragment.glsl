@@ -1,12 +1,16 @@
 #version 330 core
 in vec4 FragPos;
 
-uniform vec3 lightPos;
-uniform float far_plane;
+layout (std140) uniform Light
+{
+    vec3 light_pos;
+    vec3 light_color;
+    float far_plane;
+};
 
 void main()
 {
-    float lightDistance = length(FragPos.xyz - lightPos);
+    float lightDistance = length(FragPos.xyz - light_pos);
     
     // map lightDistance to [0,1] range 
     lightDistance = lightDistance / far_plane;
@@ -2,7 +2,13 @@
 layout (triangles) in;
 layout (triangle_strip, max_vertices=18) out;
 
-uniform mat4 shadowMatrices[6];
+layout (std140) uniform Shadow
+{
+    mat4 shadowMatrices[6];
+};
+
+// faces of the cubemap to render into (bit i = face i), the other faces keep their content
+uniform int face_mask;
 
 out vec4 FragPos; 
 
@@ -10,6 +16,8 @@ void main()
 {
     for (int face = 0; face < 6; face++)
     {
+        if ((face_mask & (1 << face)) == 0)
+            continue;
         gl_Layer = face; // built-in variable that specifies to which face we render.
         for (int i = 0; i < 3; ++i) // for each triangle's vertices
         {
@@ -0,0 +1,22 @@
+#version 330 core
+#extension GL_ARB_shader_viewport_layer_array : require
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform Shadow
+{
+    mat4 shadowMatrices[6];
+};
+
+uniform mat4 model;
+uniform int faces[6]; // cubemap face of every instance
+
+out vec4 FragPos;
+
+void main()
+{
+    vec3 position = position_offset + aPos * position_scale;
+    int face = faces[gl_InstanceID];
+    gl_Layer = face; // selects the face of the layered framebuffer without a geometry shader
+    FragPos = model * vec4(position, 1.0);
+    gl_Position = shadowMatrices[face] * FragPos;
+}
@@ -5,5 +5,6 @@ uniform mat4 model;
 
 void main()
 {
-    gl_Position = model * vec4(aPos, 1.0);
+    vec3 position = position_offset + aPos * position_scale;
+    gl_Position = model * vec4(position, 1.0);
 }
@@ -1,14 +1,20 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+};
 
 out vec3 TexCoords;
 
 void main()
 {
-    TexCoords = aPos;
-    vec4 pos = projection * view  * vec4(aPos, 1.0);
+    vec3 position = position_offset + aPos * position_scale;
+    TexCoords = position;
+    // we use mat3 instead of mat4 to remove translation from matrix (only rotation is needed)
+    vec4 pos = projection * mat4(mat3(view)) * vec4(position, 1.0);
     gl_Position = pos.xyww;
 }
@@ -13,13 +13,29 @@
 #include "Model.h"
 #include "shader.h"
 #include "camera.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "uniform_buffer.h"
+#include "asset_loader.h"
+#include "culling.h"
+#include "cluster_culling.h"
+#include "multi_draw.h"
+#include "shadow_cache.h"
+#include "scene.h"
+#include "instancing.h"
+#include "texture_cooker.h"
+#include "mesh_analyzer.h"
+#include "pass_timer.h"
+#include "overlay.h"
+#include "planar_reflection.h"
+#include "deferred.h"
+#include "trace.h"
 
 void framebuffer_size_callback(GLFWwindow * window, int width, int height);
 void mouse_callback(GLFWwindow * window, double xpos, double ypos);
 void mouse_button_callback(GLFWwindow * window, int button, int action, int mods);
 void processInput(GLFWwindow* window);
-void RenderShadow( Shader & shader, Model models[]);
-GLuint loadCubemap(vector<std::string> faces);
+struct SceneUniforms;
 
 // screen settings (aspect ratio = 16/9)
  GLuint SCR_WIDTH = 1244, SCR_HEIGHT = 700;
@@ -34,45 +50,151 @@ bool first_enter = true;
 // lighting settings
 glm::vec3 light_pos(1.0f, 8.0f, 4.0f);
 
+// shadow cubemap rendering path (keys 1, 2, 3 switch it)
+ShadowPath shadow_path = SHADOW_PATH_GEOMETRY_SHADER;
+
+// pass timings overlay (key O toggles it)
+bool show_overlay = true, overlay_key_down = false;
+
+// per-instance transforms of the instanced draws, the visible meshlets of the other draws (--meshlets)
+// and the draw call counts of Render()
+InstanceBuffer instance_buffer;
+ClusterStream cluster_stream;
+// indirect commands of the opaque batches (--multi-draw)
+MultiDrawList multi_draw;
+DrawStats draw_stats;
+
 // camera settings
 Camera camera(glm::vec3(0.0f, 10.0f, 15.0f), glm::vec3(0.0f, 0.0f, -1.0f));
 
 
-void Render(int depth_cubemap, int cubemap, float far_plane, Model models[], Shader shaders[]);
-glm::mat4 view = glm::mat4(1.0f);
-glm::mat4 model = glm::mat4(1.0f);
+// per-object uniform handles of one scene program, resolved once after linking (names the program does not use stay at -1)
+// camera, light and shadow data come from the shared uniform blocks (uniform_buffer.h)
+struct SceneUniforms
+{
+    Uniform<glm::mat4> model;
+    Uniform<glm::vec3> object_color, color;
+    Uniform<bool> mode, instanced;
+
+    SceneUniforms() {}
+    SceneUniforms(const Shader & shader)
+    {
+        model = shader.uniform<glm::mat4>("model");
+        object_color = shader.uniform<glm::vec3>("object_color");
+        color = shader.uniform<glm::vec3>("color");
+        mode = shader.uniform<bool>("mode");
+        instanced = shader.uniform<bool>("instanced");
+    }
+};
+
+// slots of the camera uniform buffer, one per view
+enum CameraSlot
+{
+    MAIN_VIEW = 0,
+    MIRRORED_VIEW = 1
+};
+
+// material of the scene file with its program and the uniform handles of that program
+// (without a program the material is not drawn by this set of materials, see DrawBatches)
+struct RenderMaterial
+{
+    const SceneMaterial * data;
+    Shader * shader;
+    SceneUniforms uniforms;
+};
+
+void Render(const Scene & scene, vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, const SceneCuller & culler, const ClusterView * clusters, GLuint depth_cubemap, GLuint skybox_cubemap);
+void PrepareBatches(const Scene & scene, vector<Model *> & models, vector<DrawBatch> & batches, const SceneCuller & culler, const ClusterView * clusters);
+void DrawBatches(const Scene & scene, vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, const SceneCuller & culler, bool clusters, GLuint depth_cubemap, GLuint skybox_cubemap);
+void RenderMultiDraw(vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, GLuint depth_cubemap, GLuint skybox_cubemap);
+void ApplyMaterial(RenderMaterial & material, GLuint depth_cubemap, GLuint skybox_cubemap);
+void ShadowCasters(const Scene & scene, vector<Model *> & models, vector<ShadowCaster> & casters);
 glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 
-int main()
+int main(int argc, char** argv)
 {
+    BenchmarkSettings benchmark = ParseBenchmarkArgs(argc, argv);
+    // the timeline starts before anything is loaded, so the asset loading is part of it
+    if (!benchmark.trace_path.empty())
+    {
+        TraceRecorder::Get().Start();
+        TRACE_THREAD_NAME("main");
+    }
+
+    // the cooking tool runs on the CPU only, before any context is created
+    if (benchmark.cook_textures)
+    {
+        Scene scene;
+        if (!scene.Load(benchmark.scene_path))
+            return -1;
+        vector<string> model_paths = scene.model_paths;
+        model_paths.push_back("res/models/Mirror/mirror.obj");
+        return CookTextures(model_paths, { scene.skybox_faces }, benchmark.load_threads) ? 0 : -1;
+    }
 
-    // -------- setting the GLFW and GLAD --------
+    if (benchmark.analyze_meshes)
+        return AnalyzeModels("res/models") ? 0 : -1;
 
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // -------- setting the GLFW and GLAD (or the headless EGL context) --------
 
+    GLFWwindow* window = NULL;
+    HeadlessContext headless_context;
+    OffscreenTarget offscreen_target;
     string window_title = "Press ESC to exit Demo; FPS = ", FPS = "0";
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, (window_title + FPS).c_str(), NULL, NULL);
-    if (window == NULL)
+
+    if (benchmark.headless)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwSetWindowPos(window, 1200, 100);
+        if (!headless_context.Create())
+            return -1;
+
+        if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::GetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        std::cout << "BENCHMARK:: renderer = " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << std::endl;
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        SCR_WIDTH = benchmark.width;
+        SCR_HEIGHT = benchmark.height;
+        projection = glm::perspective(glm::radians(60.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        if (!offscreen_target.Create(SCR_WIDTH, SCR_HEIGHT))
+            return -1;
+    }
+    else
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        // the depth format of the offscreen target, the deferred path copies its G-buffer depth into it
+        glfwWindowHint(GLFW_DEPTH_BITS, 24);
+        glfwWindowHint(GLFW_STENCIL_BITS, 8);
+
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, (window_title + FPS).c_str(), NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        glfwSetWindowPos(window, 1200, 100);
+
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        // hide and lock cursor on the window
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     }
 
+    // the headless mode renders into the offscreen target instead of the window framebuffer
+    GLuint screenFramebuffer = offscreen_target.FBO;
+
     // -----------------------------------------
     
 
@@ -80,44 +202,100 @@ int main()
 
     // -------- shader, model and skybox load + matrix creation --------
 
-    // changing color of screen ( by setting default values for the color buffers )
-    glClearColor(0.3f, 0.3f, 0.5f, 1.0f);
+    // default stencil clear value, the clear colors are set where the framebuffers are cleared
     glClearStencil(0);
     glEnable(GL_DEPTH_TEST);
-    // hide and lock cursor on the window
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     
     Shader EnvironmentShader("res/shaders/environment_mapping_vertex.glsl", "res/shaders/environment_mapping_fragment.glsl");
     Shader LightShader("res/shaders/light_vertex.glsl", "res/shaders/light_fragment.glsl");
     Shader ObjectShader("res/shaders/object_vertex.glsl", "res/shaders/object_fragment.glsl");
     Shader ShadowShader("res/shaders/shadow_mapping_vertex.glsl", "res/shaders/shadow_mapping_fragment.glsl", "res/shaders/shadow_mapping_geometry.glsl");
+    Shader ShadowFaceShader("res/shaders/shadow_mapping_face_vertex.glsl", "res/shaders/shadow_mapping_fragment.glsl");
+    // gl_Layer in the vertex shader is an extension of OpenGL 3.3
+    bool layered_shadows = HasGLExtension("GL_ARB_shader_viewport_layer_array");
+    Shader * ShadowLayerShader = layered_shadows ? new Shader("res/shaders/shadow_mapping_layer_vertex.glsl", "res/shaders/shadow_mapping_fragment.glsl") : NULL;
     Shader SkyboxShader("res/shaders/skybox_vertex.glsl", "res/shaders/skybox_fragment.glsl");
     Shader NormalShader("res/shaders/normal_mapping_vertex.glsl", "res/shaders/normal_mapping_fragment.glsl");
     Shader MirrorShader("res/shaders/mirror_vertex.glsl", "res/shaders/mirror_fragment.glsl");
     Shader ParallaxShader("res/shaders/parallax_mapping_vertex.glsl", "res/shaders/parallax_mapping_fragment.glsl");
-    Shader shaders[5] = {NormalShader, EnvironmentShader, LightShader, SkyboxShader, ParallaxShader};
+    Shader OverlayShader("res/shaders/overlay_vertex.glsl", "res/shaders/overlay_fragment.glsl");
+    // the lit programs again, writing the G-buffer of the deferred path instead, and its lighting passes
+    Shader GBufferObjectShader("res/shaders/object_vertex.glsl", "res/shaders/gbuffer_object_fragment.glsl");
+    Shader GBufferNormalShader("res/shaders/normal_mapping_vertex.glsl", "res/shaders/gbuffer_normal_fragment.glsl");
+    Shader GBufferParallaxShader("res/shaders/parallax_mapping_vertex.glsl", "res/shaders/gbuffer_parallax_fragment.glsl");
+    Shader DeferredLightShader("res/shaders/deferred_fullscreen_vertex.glsl", "res/shaders/deferred_light_fragment.glsl");
+    Shader PointLightShader("res/shaders/point_light_vertex.glsl", "res/shaders/point_light_fragment.glsl");
+    Shader * all_shaders[] = { &EnvironmentShader, &LightShader, &ObjectShader, &ShadowShader, &ShadowFaceShader, &SkyboxShader, &NormalShader, &MirrorShader, &ParallaxShader,
+                               &GBufferObjectShader, &GBufferNormalShader, &GBufferParallaxShader, &DeferredLightShader, &PointLightShader };
+    for (Shader * shader : all_shaders)
+        BindSharedUniformBlocks(*shader);
+    if (ShadowLayerShader)
+        BindSharedUniformBlocks(*ShadowLayerShader);
+    // programs the materials of a scene file can use
+    map<string, Shader *> programs = {
+        { "object", &ObjectShader }, { "normal", &NormalShader }, { "environment", &EnvironmentShader }, { "light", &LightShader },
+        { "skybox", &SkyboxShader }, { "parallax", &ParallaxShader }, { "mirror", &MirrorShader }
+    };
+    // the programs with a G-buffer version, the materials of the others stay forward in the deferred path
+    map<string, Shader *> gbuffer_programs = {
+        { "object", &GBufferObjectShader }, { "normal", &GBufferNormalShader }, { "parallax", &GBufferParallaxShader }
+    };
+    SceneUniforms mirror_uniforms(MirrorShader), light_uniforms(LightShader);
+    Uniform<glm::mat4> mirror_reflection_matrix = MirrorShader.uniform<glm::mat4>("reflection_matrix");
     //Shader TextureShader("res/shaders/texture_vertex.glsl", "res/shaders/texture_fragment.glsl");
 
-    vector<std::string> faces
+    Scene scene;
+    if (!scene.Load(benchmark.scene_path))
+        return -1;
+
+    vector<RenderMaterial> materials;
+    for (const SceneMaterial & material : scene.materials)
     {
-        "res/textures/japan_park_skybox/posx.jpg",
-        "res/textures/japan_park_skybox/negx.jpg",
-        "res/textures/japan_park_skybox/posy.jpg",
-        "res/textures/japan_park_skybox/negy.jpg",
-        "res/textures/japan_park_skybox/posz.jpg",
-        "res/textures/japan_park_skybox/negz.jpg"
-    };
-    GLuint cubemapTexture = loadCubemap(faces);
-
-    Model Teapot_model("res/models/Teapot/teapot.obj");
-    Model Sphere_model("res/models/sphere.obj");
-    Model Plane_model("res/models/Table/plane.obj");
-    Model Box_model("res/models/box.obj");
-    Model Cup_model("res/models/Cup/cup.obj");
-    Model Mirror_model("res/models/Mirror/mirror.obj");
-    Model Wall_model("res/models/StoneWall/wall.obj");
-    //Model Pumpkin_model("res/models/pumpkin.obj");
-    Model models[6] = { Teapot_model , Plane_model , Cup_model, Sphere_model, Box_model, Wall_model };
+        map<string, Shader *>::iterator program = programs.find(material.shader);
+        if (program == programs.end())
+        {
+            cout << "ERROR::SCENE:: material " << material.name << " uses the unknown shader " << material.shader << endl;
+            return -1;
+        }
+        materials.push_back({ &material, program->second, SceneUniforms(*program->second) });
+    }
+    // the deferred main view draws the materials in two parts: into the G-buffer, then the rest forward
+    vector<RenderMaterial> gbuffer_materials, forward_materials;
+    for (const RenderMaterial & material : materials)
+    {
+        map<string, Shader *>::iterator program = gbuffer_programs.find(material.data->shader);
+        bool lit = program != gbuffer_programs.end();
+        gbuffer_materials.push_back({ material.data, lit ? program->second : NULL, lit ? SceneUniforms(*program->second) : SceneUniforms() });
+        forward_materials.push_back({ material.data, lit ? NULL : material.shader, material.uniforms });
+    }
+
+    // models are imported and images decoded on worker threads, this thread only uploads them
+    TextureCache::Get().SetCookedTextures(benchmark.cooked_textures);
+    AssetLoader loader(benchmark.load_threads, benchmark.pixel_buffers);
+    loader.SetMeshOptimization(benchmark.mesh_optimization);
+    size_t skybox_asset = loader.AddCubemap(scene.skybox_faces);
+    // cluster culling copies the visible meshlets out of the indices, so they stay on the CPU
+    MeshRetainPolicy retain = benchmark.retain_mesh_data ? MESH_RETAIN_CPU_DATA : benchmark.meshlets ? MESH_RETAIN_INDICES : MESH_RELEASE_CPU_DATA;
+    vector<size_t> model_assets;
+    for (size_t i = 0; i < scene.model_paths.size(); i++)
+        model_assets.push_back(loader.AddModel(scene.model_paths[i], retain,
+                                               benchmark.packed_vertices || scene.model_packed_vertices[i] ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FLOAT));
+    size_t mirror_asset = loader.AddModel("res/models/Mirror/mirror.obj", MESH_RELEASE_CPU_DATA,
+                                          benchmark.packed_vertices ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FLOAT);
+    // with --geometry-arena (or --multi-draw) the meshes share their vertex and index buffers
+    GeometryArena::Get().SetEnabled(benchmark.geometry_arena || benchmark.multi_draw);
+    loader.Load();
+    loader.PrintReport();
+    TextureCache::Get().PrintReport();
+    loader.PrintMemoryReport();
+    loader.PrintVertexFormatReport();
+    loader.PrintLodReport();
+
+    GLuint cubemapTexture = loader.GetCubemap(skybox_asset);
+    vector<Model *> models;
+    for (size_t asset : model_assets)
+        models.push_back(&loader.GetModel(asset));
+    Model & Mirror_model = loader.GetModel(mirror_asset);
 
     // -----------------------------------------------------------------
 
@@ -127,89 +305,134 @@ int main()
     // ----------- shadow mapping -----------
 
     const GLuint SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
-    GLuint depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
-
-    // create depth cubemap texture
-    GLuint depthCubemap;
-    glGenTextures(1, &depthCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-
-    for (GLuint i = 0; i < 6; ++i)
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    // attach depth texture as FBO's depth buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the cubemap is only redrawn where the light or a caster moved
+    ShadowCubemap shadow_cubemap;
+    shadow_cubemap.Create(SHADOW_WIDTH, benchmark.shadow_cache);
+    shadow_cubemap.SetLodError(benchmark.lod.MaxError(RENDER_PASS_SHADOW));
+    shadow_cubemap.SetProgram(SHADOW_PATH_GEOMETRY_SHADER, &ShadowShader);
+    shadow_cubemap.SetProgram(SHADOW_PATH_PER_FACE, &ShadowFaceShader);
+    if (ShadowLayerShader)
+        shadow_cubemap.SetProgram(SHADOW_PATH_LAYERED, ShadowLayerShader);
+    shadow_path = benchmark.shadow_path;
+    GLuint depthCubemap = shadow_cubemap.depth_cubemap;
 
     // ----------------  reflection texture ----------------------
 
-    const GLuint REFLECTION_WIDTH = 1024, REFLECTION_HEIGHT = 1024;
-    unsigned int reflectionFramebuffer;
-    glGenFramebuffers(1, &reflectionFramebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, reflectionFramebuffer);
-
-    // create a color attachment texture
-    unsigned int reflectionTexture;
-    glGenTextures(1, &reflectionTexture);
-    glBindTexture(GL_TEXTURE_2D, reflectionTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, REFLECTION_WIDTH, REFLECTION_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reflectionTexture, 0);
-
-    // create a renderbuffer object for depth and stencil attachment (we won't be sampling these)
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, REFLECTION_WIDTH, REFLECTION_HEIGHT); // use a single renderbuffer object for both a depth AND stencil buffer.
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo); // now actually attach it
-
-    // now that we actually created the framebuffer and added all attachments we want to check if it is actually complete now
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the mirror on the far side of the table and its frame (a slightly larger quad just behind it)
+    glm::mat4 mirror_transform = glm::mat4(1.0f);
+    mirror_transform = glm::translate(mirror_transform, glm::vec3(0.0f, 5.0f, -15.0f));
+    mirror_transform = glm::rotate(mirror_transform, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    glm::mat4 mirror_frame_transform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.01f)) * mirror_transform, glm::vec3(16.2f, 1.0f, 6.2f));
+    mirror_transform = glm::scale(mirror_transform, glm::vec3(16.0f, 1.0f, 6.0f));
+
+    PlanarReflection mirror_reflection;
+    mirror_reflection.Create(SCR_WIDTH, SCR_HEIGHT, benchmark.reflection_scale);
+    mirror_reflection.SetUpdateRate(benchmark.reflection_interval, benchmark.reflection_on_change);
+    mirror_reflection.SetCulling(benchmark.reflection_culling);
+    mirror_reflection.SetMirror(mirror_transform);
+
+    // ----------- shared uniform buffers -----------
+
+    UniformBuffer<CameraBlock> camera_buffer;
+    UniformBuffer<LightBlock> light_buffer;
+    UniformBuffer<ShadowBlock> shadow_buffer;
+    camera_buffer.Create(CAMERA_BLOCK_BINDING, 2);
+    light_buffer.Create(LIGHT_BLOCK_BINDING);
+    shadow_buffer.Create(SHADOW_BLOCK_BINDING);
 
     // --------------------------------------
 
-    ObjectShader.use();
-    ObjectShader.setInt("diffuse_texture1", 0);
-    ObjectShader.setInt("depthMap", 1);
+    // sampler uniforms are assigned at link time (SamplerTextureUnit)
 
-    NormalShader.use();
-    NormalShader.setInt("diffuse_texture1", 0);
-    NormalShader.setInt("normal_texture1", 1);
-    NormalShader.setInt("depthMap", 2);
+    // views indexed by CameraSlot
+    SceneCuller scene_culler({ "main view", "mirrored view" });
+
+    // instances with the same model and material are drawn together, the batches sorted by their state
+    vector<DrawBatch> draw_batches = BuildDrawBatches(scene, benchmark.instancing);
+    if (benchmark.sort_draws)
+    {
+        vector<GLuint> material_programs;
+        for (const RenderMaterial & material : materials)
+            material_programs.push_back(material.shader->ID);
+        SortDrawBatches(draw_batches, material_programs);
+    }
+    GLStateCache::Get().SetFiltering(benchmark.state_filtering);
+    instance_buffer.Create();
+    if (benchmark.multi_draw)
+        multi_draw.Create(benchmark.headless ? (GLADloadproc)HeadlessContext::GetProcAddress : (GLADloadproc)glfwGetProcAddress, benchmark.indirect_draws);
+    if (benchmark.meshlets)
+    {
+        cluster_stream.Create();
+        shadow_cubemap.SetClusterStream(&cluster_stream, benchmark.meshlet_cones);
+    }
 
-    MirrorShader.use();
-    MirrorShader.setInt("mirrorTexture", 0);
+    // every pass is timed, the headless mode keeps the timings of all frames for the report (and --pass-csv)
+    PassTimer & pass_timer = PassTimer::Get();
+    pass_timer.Create(benchmark.headless);
+    // the overlay is only drawn into the headless frames with --overlay, so the screenshots stay comparable
+    TextOverlay overlay;
+    overlay.Create(&OverlayShader);
+    show_overlay = !benchmark.headless || benchmark.overlay;
+
+    // the main view lit from a G-buffer (--deferred), the mirror pass stays forward
+    DeferredRenderer deferred;
+    LightSweep light_sweep;
+    light_sweep.warmup = benchmark.warmup;
+    light_sweep.frames = benchmark.frames;
+    float light_time = 0.0f;
+    if (benchmark.deferred && !DeferredRenderer::CanLightInto(screenFramebuffer))
+    {
+        cout << "WARNING::DEFERRED:: the screen has no 24 bit depth and 8 bit stencil buffer, using forward shading" << endl;
+        benchmark.deferred = benchmark.light_sweep = false;
+    }
+    if (benchmark.deferred)
+    {
+        deferred.Create(&DeferredLightShader, &PointLightShader);
+        deferred.SetLightCount(benchmark.lights);
+    }
 
-    ParallaxShader.use();
-    ParallaxShader.setInt("diffuse_texture1", 0);
-    ParallaxShader.setInt("normal_texture1", 1);
-    ParallaxShader.setInt("specular_texture1", 2);
-    ParallaxShader.setInt("depthMap", 3);
+    FrameTimer * frame_timer = benchmark.headless ? new FrameTimer() : NULL;
+    CameraPath camera_path;
+    int frame = 0, total_frames = benchmark.light_sweep ? light_sweep.TotalFrames() : benchmark.warmup + benchmark.frames;
+    // refilled every frame, its storage is kept
+    vector<ShadowCaster> shadow_casters;
 
     // ---------------- render loop start ----------------
-    while (!glfwWindowShouldClose(window))
+    while (benchmark.headless ? frame < total_frames : !glfwWindowShouldClose(window))
     {
+        TRACE_SCOPE("frame");
+        // state bound outside of the cache (resizing, loading) is forgotten
+        GLStateCache::Get().BeginFrame();
+        VertexFetchStats::Get().BeginFrame();
+        TriangleStats::Get().BeginFrame();
+        pass_timer.BeginFrame(frame);
+
+        if (benchmark.headless)
+        {
+            frame_timer->BeginFrame(frame);
+            glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer);
+            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        }
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-        processInput(window);
+        if (benchmark.headless)
+        {
+            // fixed timestep and scripted camera, so the frames do not depend on the machine speed
+            delta_frametime = 1.0f / 60.0f;
+            camera_path.Apply(benchmark.light_sweep ? light_sweep.PathTime(frame) : (float)frame / (float)max(1, total_frames - 1), camera);
+            if (benchmark.light_sweep)
+                deferred.SetLightCount(light_sweep.LightCount(frame));
+        }
+        else
+        {
+            processInput(window);
 
-        // calculates how much time does it takes to render one frame (delta_frametime)
-        curr_frametime = (float)glfwGetTime();
-        delta_frametime = curr_frametime - prev_frametime;
-        prev_frametime = curr_frametime;
+            // calculates how much time does it takes to render one frame (delta_frametime)
+            curr_frametime = (float)glfwGetTime();
+            delta_frametime = curr_frametime - prev_frametime;
+            prev_frametime = curr_frametime;
+        }
 
 
         // ---------------- rendering the shadow cubemap ----------------
@@ -217,91 +440,215 @@ int main()
         float near_plane = 1.0f;
         float far_plane = 40.0f;
         glm::mat4 shadow_projection = glm::perspective(glm::radians(90.0f), (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, near_plane, far_plane);
-        std::vector<glm::mat4> shadowTransforms;
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-        shadowTransforms.push_back(shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        ShadowShader.use();
-        for (GLuint i = 0; i < 6; ++i)
-            ShadowShader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
-        ShadowShader.setFloat("far_plane", far_plane);
-        ShadowShader.setVec3("lightPos", light_pos);
-
-        RenderShadow(ShadowShader, models);
+        ShadowBlock shadow_block = { {
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+            shadow_projection * glm::lookAt(light_pos, light_pos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))
+        } };
+
+        // all per-frame data shared by the programs: a handful of buffer updates instead of uniforms per object
+        LightBlock light_block = { light_pos, 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), far_plane };
+        CameraBlock main_view_block = { camera.GetViewMatrix(), projection, camera.camera_pos, 0.0f };
+        CameraBlock mirrored_view_block;
+        mirror_reflection.Reflect(main_view_block.view, projection, SCR_WIDTH, SCR_HEIGHT, mirrored_view_block.view, mirrored_view_block.projection);
+        mirrored_view_block.view_pos = glm::vec3(glm::inverse(mirrored_view_block.view)[3]);
+        mirrored_view_block.padding = 0.0f;
+        shadow_buffer.Update(0, shadow_block);
+        light_buffer.Update(0, light_block);
+        camera_buffer.Update(MAIN_VIEW, main_view_block);
+        camera_buffer.Update(MIRRORED_VIEW, mirrored_view_block);
+
+        // world bounds of the drawn instances, culled against each view before it is drawn
+        scene_culler.BeginFrame();
+        for (size_t i = 0; i < scene.InstanceCount(); i++)
+            if (scene.instance_flags[i] & INSTANCE_DRAW)
+                scene_culler.AddObject(*models[scene.instance_model[i]], scene.WorldTransform(i, light_pos));
+
+        if (shadow_path != shadow_cubemap.Path())
+        {
+            shadow_cubemap.SetPath(shadow_path);
+            shadow_path = shadow_cubemap.Path();
+        }
+        pass_timer.Begin(TIMED_PASS_SHADOW);
+        ShadowCasters(scene, models, shadow_casters);
+        unsigned int dirty_faces = shadow_cubemap.Update(light_pos, far_plane, shadow_block.shadow_matrices, shadow_casters);
+        TriangleStats::Get().BeginPass(RENDER_PASS_SHADOW);
+        shadow_cubemap.Render(shadow_casters, dirty_faces);
+        pass_timer.End(TIMED_PASS_SHADOW);
 
 
         // ---------- rendering the reflection texture ------------
 
-        glBindFramebuffer(GL_FRAMEBUFFER, reflectionFramebuffer);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
-
-        glViewport(0, 0, REFLECTION_WIDTH, REFLECTION_HEIGHT);
-
-        view = camera.GetMirroredViewMatrix();
-        Render(depthCubemap, cubemapTexture, far_plane, models, shaders);
+        // the reflected frustum (oblique near plane at the mirror, cropped to it) culls everything the mirror cannot show,
+        // the whole pass is skipped while the mirror is out of view or occluded
+        pass_timer.Begin(TIMED_PASS_REFLECTION);
+        glm::mat4 mirrored_view_projection = mirrored_view_block.projection * mirrored_view_block.view;
+        if (mirror_reflection.NeedsUpdate(frame, mirrored_view_projection, light_pos))
+        {
+            mirror_reflection.BeginRender();
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_DEPTH_TEST);
+
+            camera_buffer.Bind(MIRRORED_VIEW);
+            scene_culler.Cull(MIRRORED_VIEW, mirrored_view_projection);
+            scene_culler.SelectLods(LodView::FromCamera(mirrored_view_block.view, mirrored_view_block.projection, mirror_reflection.ViewportHeight(),
+                                                        benchmark.lod.MaxError(RENDER_PASS_REFLECTION)));
+            TriangleStats::Get().BeginPass(RENDER_PASS_REFLECTION);
+            ClusterView mirrored_clusters = ClusterView::FromCamera(RENDER_PASS_REFLECTION, mirrored_view_block.view, mirrored_view_block.projection, benchmark.meshlet_cones);
+            Render(scene, models, materials, draw_batches, scene_culler, benchmark.meshlets ? &mirrored_clusters : NULL, depthCubemap, cubemapTexture);
+            mirror_reflection.EndRender();
+        }
+        pass_timer.End(TIMED_PASS_REFLECTION);
 
         // reset to default values
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer);
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
 
         // ---------- drawing objects of the scene ------------
 
-        view = camera.GetViewMatrix();
-        Render(depthCubemap, cubemapTexture, far_plane, models, shaders);
+        // the deferred path times the G-buffer, the lighting and the forward materials separately instead
+        pass_timer.Begin(benchmark.deferred ? TIMED_PASS_GBUFFER : TIMED_PASS_MAIN);
+        camera_buffer.Bind(MAIN_VIEW);
+        scene_culler.Cull(MAIN_VIEW, main_view_block.projection * main_view_block.view);
+        scene_culler.SelectLods(LodView::FromCamera(main_view_block.view, projection, SCR_HEIGHT, benchmark.lod.MaxError(RENDER_PASS_MAIN)));
+        TriangleStats::Get().BeginPass(RENDER_PASS_MAIN);
+        ClusterView main_clusters = ClusterView::FromCamera(RENDER_PASS_MAIN, main_view_block.view, projection, benchmark.meshlet_cones);
+        if (!benchmark.deferred)
+        {
+            Render(scene, models, materials, draw_batches, scene_culler, benchmark.meshlets ? &main_clusters : NULL, depthCubemap, cubemapTexture);
+            pass_timer.End(TIMED_PASS_MAIN);
+        }
+        else
+        {
+            // lit materials into the G-buffer, lighting into the screen (with the depth), then the other materials forward
+            PrepareBatches(scene, models, draw_batches, scene_culler, benchmark.meshlets ? &main_clusters : NULL);
+            deferred.BeginGeometry(SCR_WIDTH, SCR_HEIGHT);
+            DrawBatches(scene, models, gbuffer_materials, draw_batches, scene_culler, benchmark.meshlets, depthCubemap, cubemapTexture);
+            pass_timer.End(TIMED_PASS_GBUFFER);
+
+            pass_timer.Begin(TIMED_PASS_LIGHTING);
+            light_time += delta_frametime;
+            deferred.Animate(light_time);
+            deferred.Light(screenFramebuffer, main_view_block.projection * main_view_block.view, depthCubemap);
+            pass_timer.End(TIMED_PASS_LIGHTING);
+
+            pass_timer.Begin(TIMED_PASS_FORWARD);
+            DrawBatches(scene, models, forward_materials, draw_batches, scene_culler, benchmark.meshlets, depthCubemap, cubemapTexture);
+            pass_timer.End(TIMED_PASS_FORWARD);
+        }
 
         //glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
         //glStencilFunc(GL_ALWAYS, 1, 0xFF);
         //glStencilMask(0xFF);
 
+        pass_timer.Begin(TIMED_PASS_MIRROR);
         MirrorShader.use();
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 5.0f, -15.0f));
-        model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(16.0f, 1.0f, 6.0f));
-        view = camera.GetViewMatrix();
-        MirrorShader.setMat4("model", model);
-        MirrorShader.setMat4("view", view);
-        MirrorShader.setMat4("projection", projection);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, reflectionTexture);
-        Mirror_model.Draw(MirrorShader);
+        mirror_uniforms.model.set(mirror_transform);
+        mirror_reflection_matrix.set(mirror_reflection.Matrix());
+        GLStateCache::Get().BindTexture(REFLECTION_TEXTURE_UNIT, GL_TEXTURE_2D, mirror_reflection.Texture());
+        mirror_reflection.BeginOcclusionQuery(frame);
+        Mirror_model.Draw();
+        mirror_reflection.EndOcclusionQuery();
 
         //glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
         //glStencilMask(0x00);
             
         LightShader.use();
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 5.0f, -15.01f));
-        model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(16.2f, 1.0f, 6.2f));
-        LightShader.setVec3("light_color", glm::vec3(0.4f, 0.6f, 0.9f));
-        LightShader.setMat4("model", model);
-        LightShader.setMat4("view", view);
-        LightShader.setMat4("projection", projection);
-        Mirror_model.Draw(LightShader);
+        light_uniforms.color.set(glm::vec3(0.4f, 0.6f, 0.9f));
+        light_uniforms.model.set(mirror_frame_transform);
+        Mirror_model.Draw();
+        pass_timer.End(TIMED_PASS_MIRROR);
+        pass_timer.EndFrame();
 
         // ----------------------------------------------------------
 
+        if (show_overlay)
+        {
+            overlay.Begin();
+            AddPassTimings(overlay, pass_timer, (float)max(1u, SCR_HEIGHT / 360));
+            overlay.Draw(SCR_WIDTH, SCR_HEIGHT);
+        }
+
+
+        if (benchmark.headless)
+        {
+            frame_timer->EndFrame(frame);
+            if (frame == total_frames - 1 && !benchmark.screenshot_path.empty())
+                SaveFramebufferPPM(benchmark.screenshot_path, SCR_WIDTH, SCR_HEIGHT);
+            frame++;
+            continue;
+        }
 
         FPS = to_string(floor(1 / delta_frametime));
         glfwSetWindowTitle(window, (window_title + FPS).c_str());
         
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
+        frame++;
     }
     // ---------------- render loop end ----------------
 
+    // the GL objects of the program, released on both exits while the context still exists
+    auto destroy_resources = [&]()
+    {
+        instance_buffer.Destroy();
+        cluster_stream.Destroy();
+        multi_draw.Destroy();
+        overlay.Destroy();
+        pass_timer.Destroy();
+        shadow_cubemap.Destroy();
+        mirror_reflection.Destroy();
+        deferred.Destroy();
+        loader.DestroyModels();
+        GeometryArena::Get().Destroy();
+        MeshDecodeBuffer::Get().Destroy();
+        MaterialBuffer::Get().Destroy();
+        TextureCache::Get().DestroyAll();
+        delete ShadowLayerShader;
+    };
+
+    if (benchmark.headless)
+    {
+        frame_timer->Finish();
+        frame_timer->Report(benchmark.warmup, benchmark.csv_path);
+        pass_timer.Finish();
+        pass_timer.PrintReport(benchmark.warmup);
+        if (benchmark.light_sweep)
+            light_sweep.PrintReport(pass_timer, *frame_timer);
+        if (!benchmark.trace_path.empty())
+            TraceRecorder::Get().Write(benchmark.trace_path);
+        if (!benchmark.pass_csv_path.empty())
+            pass_timer.WriteCsv(benchmark.pass_csv_path, benchmark.warmup);
+        shadow_cubemap.PrintReport();
+        mirror_reflection.PrintReport();
+        if (benchmark.deferred)
+            deferred.PrintReport();
+        scene_culler.PrintReport();
+        draw_stats.PrintReport(draw_batches);
+        GLStateCache::Get().PrintReport();
+        VertexFetchStats::Get().PrintReport();
+        GeometryArena::Get().PrintReport();
+        TriangleStats::Get().PrintReport();
+        cluster_stream.PrintReport();
+        destroy_resources();
+        offscreen_target.Destroy();
+        delete frame_timer;
+        return 0;
+    }
+
+    if (!benchmark.trace_path.empty())
+        TraceRecorder::Get().Write(benchmark.trace_path);
+    destroy_resources();
     glfwTerminate();
     return 0;
 }
@@ -309,150 +656,209 @@ int main()
 
 
 
-void Render(int depth_cubemap, int cubemap, float far_plane, Model models[], Shader shaders[])
+// draws the batches of the scene in their sorted order (the skybox is the last layer)
+// instances outside of the view frustum (culler.Visible) are skipped before any uniform or texture is set,
+// instanced batches draw each mesh once for all instances in which it is visible, the meshes of the other batches are
+// drawn with their visible clusters when clusters is given (instanced draws share one index range, so they are not cluster culled)
+// with --multi-draw the opaque batches are submitted as multi-draws instead (see RenderMultiDraw)
+void Render(const Scene & scene, vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, const SceneCuller & culler, const ClusterView * clusters, GLuint depth_cubemap, GLuint skybox_cubemap)
 {
-    //------------------ teapot -----------------------
-
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(3.0f, 0.0f, -3.0f));
-    shaders[0].use();
-    shaders[0].setVec3("object_color", 0.8f, 0.35f, 0.54f);
-    shaders[0].setVec3("light_color", 1.0f, 1.0f, 1.0f);
-    shaders[0].setVec3("light_pos", light_pos);
-    shaders[0].setVec3("view_pos", camera.camera_pos);
-    shaders[0].setMat4("model", model);
-    shaders[0].setMat4("view", view);
-    shaders[0].setMat4("projection", projection);
-    shaders[0].setFloat("far_plane", far_plane);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depth_cubemap);
-    models[0].Draw(shaders[0]);
-
-    //----------------- wooden plane -----------------
-
-    shaders[0].use();
-    model = glm::mat4(1.0f);
-    shaders[0].setVec3("light_color", 1.0f, 1.0f, 1.0f);
-    shaders[0].setVec3("light_pos", light_pos);
-    shaders[0].setVec3("view_pos", camera.camera_pos);
-    shaders[0].setMat4("model", model);
-    shaders[0].setMat4("view", view);
-    shaders[0].setMat4("projection", projection);
-    shaders[0].setFloat("far_plane", far_plane);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depth_cubemap);
-    models[1].Draw(shaders[0]);
-
-    //-------------------- cup ---------------------
-
-    shaders[1].use();
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 2.0f));
-    shaders[1].setBool("mode", 0); // mode for refraction
-    shaders[1].setMat4("model", model);
-    shaders[1].setMat4("view", view);
-    shaders[1].setMat4("projection", projection);
-    shaders[1].setVec3("view_pos", camera.camera_pos);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-    models[2].Draw(shaders[1]);
-
-    // ------------------- drawing the light --------------------
-
-    shaders[2].use();
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, light_pos);
-    model = glm::scale(model, glm::vec3(0.1f));
-    shaders[2].setMat4("model", model);
-    shaders[2].setMat4("view", view);
-    shaders[2].setMat4("projection", projection);
-    shaders[2].setVec3("light_color", glm::vec3(0.9f, 0.9f, 0.7f));
-    models[3].Draw(shaders[2]);
-
-    //------------------ rock wall -----------------------
-
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(15.0f, 5.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(6.0f, 6.0f, 6.0f));
-    shaders[4].use();
-    shaders[4].setVec3("object_color", 0.8f, 0.35f, 0.54f);
-    shaders[4].setVec3("light_color", 1.0f, 1.0f, 1.0f);
-    shaders[4].setVec3("light_pos", light_pos);
-    shaders[4].setVec3("view_pos", camera.camera_pos);
-    shaders[4].setMat4("model", model);
-    shaders[4].setMat4("view", view);
-    shaders[4].setMat4("projection", projection);
-    shaders[4].setFloat("far_plane", far_plane);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depth_cubemap);
-    models[5].Draw(shaders[4]);
-
-    // ------------------ drawing the skybox --------------------
-
-    shaders[3].use();
-    glDepthFunc(GL_LEQUAL);
-    // we use mat3 instead of mat4 to remove translation from matrix (only rotation is needed)
-    view = glm::mat4(glm::mat3(view));
-    shaders[3].setMat4("view", view);
-    shaders[3].setMat4("projection", projection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-    models[4].Draw(shaders[3]);
-    glDepthFunc(GL_LESS);
+    TRACE_SCOPE("Render");
+    PrepareBatches(scene, models, batches, culler, clusters);
+    DrawBatches(scene, models, materials, batches, culler, clusters != NULL, depth_cubemap, skybox_cubemap);
 }
 
 
-void RenderShadow( Shader & shader, Model models[])
+// the per-pass data of Render: the instance ranges and the visible clusters of every batch, uploaded once per view,
+// so the same view can be drawn in parts (the deferred path draws the lit and the other materials separately)
+void PrepareBatches(const Scene & scene, vector<Model *> & models, vector<DrawBatch> & batches, const SceneCuller & culler, const ClusterView * clusters)
 {
-    glm::mat4 model = glm::mat4(1.0f);
+    draw_stats.AddPass();
 
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(3.0f, 0.0f, -3.0f));
-    shader.setMat4("model", model);
-    models[0].Draw(shader);
-
-    model = glm::scale(model, glm::vec3(10.0f, 0.0f, 10.0f));
-    shader.setMat4("model", model);
-    models[1].Draw(shader);
+    // the model matrices of all instanced draws of the pass go into the buffer with a single upload,
+    // grouped by mesh and level of detail (multi-draws read the matrix of the other batches from it too)
+    instance_buffer.Begin();
+    for (DrawBatch & batch : batches)
+    {
+        const Model & batch_model = *models[batch.model];
+        batch.ranges.clear();
+        if (!batch.Instanced())
+        {
+            if (!multi_draw.Enabled() || batch.layer == SKYBOX_LAYER || !culler.Visible(batch.objects[0]))
+                continue;
+            size_t first = instance_buffer.Size();
+            instance_buffer.Add(scene.WorldTransform(batch.instances[0], light_pos));
+            for (size_t mesh = 0; mesh < batch_model.MeshCount(); mesh++)
+                if (culler.MeshVisibility(batch.objects[0])[mesh])
+                {
+                    DrawBatch::InstanceRange range = { mesh, culler.MeshLods(batch.objects[0])[mesh], first, 1 };
+                    batch.ranges.push_back(range);
+                }
+            continue;
+        }
+        for (size_t mesh = 0; mesh < batch_model.MeshCount(); mesh++)
+            for (unsigned int lod = 0; lod < batch_model.GetMesh(mesh).LodCount(); lod++)
+            {
+                DrawBatch::InstanceRange range = { mesh, lod, instance_buffer.Size(), 0 };
+                for (size_t k = 0; k < batch.instances.size(); k++)
+                    if (culler.MeshVisibility(batch.objects[k])[mesh] && culler.MeshLods(batch.objects[k])[mesh] == lod)
+                        instance_buffer.Add(scene.WorldTransform(batch.instances[k], light_pos));
+                range.count = (GLsizei)(instance_buffer.Size() - range.first);
+                if (range.count > 0)
+                    batch.ranges.push_back(range);
+            }
+    }
+    instance_buffer.Upload();
 
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-5.0f, 0.0f, 2.0f));
-    shader.setMat4("model", model);
-    models[2].Draw(shader);
+    // the visible meshlets of the other batches go into the cluster stream, also with a single upload
+    if (clusters)
+    {
+        cluster_stream.Begin(clusters->pass);
+        for (DrawBatch & batch : batches)
+        {
+            batch.cluster_ranges.clear();
+            if (batch.layer == SKYBOX_LAYER || batch.Instanced() || !culler.Visible(batch.objects[0]))
+                continue;
+            const Model & batch_model = *models[batch.model];
+            glm::mat4 transform = scene.WorldTransform(batch.instances[0], light_pos);
+            const unsigned char * visible = culler.MeshVisibility(batch.objects[0]);
+            const unsigned char * lods = culler.MeshLods(batch.objects[0]);
+            for (size_t mesh = 0; mesh < batch_model.MeshCount(); mesh++)
+                batch.cluster_ranges.push_back(visible[mesh] ? cluster_stream.Add(batch_model.GetMesh(mesh), lods[mesh], transform, *clusters) : IndexRange());
+        }
+        cluster_stream.Upload();
+    }
 }
 
 
-// loading the cubemap (for skybox)
-GLuint loadCubemap(vector<std::string> faces)
+// the draws of Render for the prepared batches (PrepareBatches), batches whose material has no program are skipped
+void DrawBatches(const Scene & scene, vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, const SceneCuller & culler, bool clusters, GLuint depth_cubemap, GLuint skybox_cubemap)
 {
-    GLuint cubemapID;
-    glGenTextures(1, &cubemapID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapID);
+    if (multi_draw.Enabled())
+    {
+        RenderMultiDraw(models, materials, batches, depth_cubemap, skybox_cubemap);
+        return;
+    }
 
-    int width, height, components;
-    for (GLuint i = 0; i < faces.size(); i++)
+    GLStateCache & state = GLStateCache::Get();
+    state.DepthFunc(GL_LESS);
+    for (DrawBatch & batch : batches)
     {
-        unsigned char * data = stbi_load(faces[i].c_str(), &width, &height, &components, 0);
-        if (data)
+        RenderMaterial & material = materials[batch.material];
+        Model & batch_model = *models[batch.model];
+        if (!material.shader)
+            continue;
+        if (batch.layer == SKYBOX_LAYER)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            PassTimer::Get().Begin(TIMED_PASS_SKYBOX);
+            state.DepthFunc(GL_LEQUAL);
+            ApplyMaterial(material, depth_cubemap, skybox_cubemap);
+            batch_model.Draw();
+            draw_stats.AddDraws(batch_model.MeshCount());
+            state.DepthFunc(GL_LESS);
+            PassTimer::Get().End(TIMED_PASS_SKYBOX);
+            continue;
         }
-        else
+        if (!batch.Instanced())
+        {
+            if (!culler.Visible(batch.objects[0]))
+                continue;
+            ApplyMaterial(material, depth_cubemap, skybox_cubemap);
+            material.uniforms.model.set(scene.WorldTransform(batch.instances[0], light_pos));
+            draw_stats.AddDraws(batch_model.DrawVisible(culler.MeshVisibility(batch.objects[0]), culler.MeshLods(batch.objects[0]),
+                                                        clusters ? batch.cluster_ranges.data() : NULL));
+            continue;
+        }
+
+        if (batch.ranges.empty())
+            continue;
+        ApplyMaterial(material, depth_cubemap, skybox_cubemap);
+        material.uniforms.instanced.set(true);
+        for (const DrawBatch::InstanceRange & range : batch.ranges)
+        {
+            batch_model.DrawMeshInstanced(range.mesh, instance_buffer.Id(), range.first, range.count, range.lod);
+            draw_stats.AddInstancedDraw(range.count);
+        }
+        material.uniforms.instanced.set(false);
+    }
+}
+
+
+// the opaque batches of Render as multi-draws: every instance range of a batch (DrawBatch::ranges, one per visible mesh of
+// a batch that is not instanced) becomes one command, the commands of consecutive batches with the same material are
+// submitted per mesh draw state, so the submission cost follows the materials and meshes of the scene, not its objects
+void RenderMultiDraw(vector<Model *> & models, vector<RenderMaterial> & materials, vector<DrawBatch> & batches, GLuint depth_cubemap, GLuint skybox_cubemap)
+{
+    TRACE_SCOPE("RenderMultiDraw");
+    multi_draw.Begin();
+    for (const DrawBatch & batch : batches)
+    {
+        if (!materials[batch.material].shader)
+            continue;
+        const Model & batch_model = *models[batch.model];
+        for (const DrawBatch::InstanceRange & range : batch.ranges)
+        {
+            const Mesh & mesh = batch_model.GetMesh(range.mesh);
+            IndexRange indices = batch.cluster_ranges.empty() ? mesh.LodRange(range.lod) : batch.cluster_ranges[range.mesh];
+            if (indices.index_count > 0)
+                multi_draw.Add(batch.material, mesh, indices, range.lod, range.count, (GLuint)range.first);
+        }
+    }
+    multi_draw.Upload();
+
+    GLStateCache & state = GLStateCache::Get();
+    state.DepthFunc(GL_LESS);
+    for (const MultiDrawGroup & group : multi_draw.Groups())
+    {
+        RenderMaterial & material = materials[group.material];
+        ApplyMaterial(material, depth_cubemap, skybox_cubemap);
+        material.uniforms.instanced.set(true);
+        draw_stats.AddMultiDraw(multi_draw.Submit(group, instance_buffer.Id()), group.command_count);
+        material.uniforms.instanced.set(false);
+    }
+
+    for (const DrawBatch & batch : batches)
+        if (batch.layer == SKYBOX_LAYER && materials[batch.material].shader)
         {
-            std::cout << "Cubemap texture failed to load, path = " << faces[i] << std::endl;
-            stbi_image_free(data);
+            PassTimer::Get().Begin(TIMED_PASS_SKYBOX);
+            state.DepthFunc(GL_LEQUAL);
+            ApplyMaterial(materials[batch.material], depth_cubemap, skybox_cubemap);
+            models[batch.model]->Draw();
+            draw_stats.AddDraws(models[batch.model]->MeshCount());
+            state.DepthFunc(GL_LESS);
+            PassTimer::Get().End(TIMED_PASS_SKYBOX);
         }
+}
+
+
+// activates the program of a material, sets its constant uniforms and binds its cubemaps
+void ApplyMaterial(RenderMaterial & material, GLuint depth_cubemap, GLuint skybox_cubemap)
+{
+    const SceneMaterial & data = *material.data;
+    material.shader->use();
+    if (data.has_object_color)
+        material.uniforms.object_color.set(data.object_color);
+    if (data.has_color)
+        material.uniforms.color.set(data.color);
+    if (data.mode >= 0)
+        material.uniforms.mode.set(data.mode != 0);
+    for (SceneTextureSource source : data.textures)
+    {
+        if (source == SHADOW_CUBEMAP_SOURCE)
+            GLStateCache::Get().BindTexture(SHADOW_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, depth_cubemap);
+        else
+            GLStateCache::Get().BindTexture(ENVIRONMENT_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, skybox_cubemap);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
 
-    return cubemapID;
+// instances that cast shadows, into casters (cleared first)
+void ShadowCasters(const Scene & scene, vector<Model *> & models, vector<ShadowCaster> & casters)
+{
+    casters.clear();
+    for (size_t i = 0; i < scene.InstanceCount(); i++)
+        if (scene.instance_flags[i] & INSTANCE_SHADOW_CASTER)
+            casters.push_back({ models[scene.instance_model[i]], scene.WorldTransform(i, light_pos) });
 }
 
 
@@ -488,6 +894,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 // listen for (ESC) key for exit and (WASD) keys for changing camera position
 void processInput(GLFWwindow* window)
 {
+    TRACE_SCOPE("processInput");
     float multiplier = 5.0f, number = 7.0f;
     if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
         multiplier /= number;
@@ -516,6 +923,20 @@ void processInput(GLFWwindow* window)
         light_pos.x -= delta_frametime * multiplier;
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
         light_pos.x += delta_frametime * multiplier;
+
+    // use 1, 2, 3 to switch the shadow path (geometry shader, per-face, layered instancing)
+    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+        shadow_path = SHADOW_PATH_GEOMETRY_SHADER;
+    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+        shadow_path = SHADOW_PATH_PER_FACE;
+    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+        shadow_path = SHADOW_PATH_LAYERED;
+
+    // use O to show or hide the pass timings (once per key press)
+    bool overlay_key = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (overlay_key && !overlay_key_down)
+        show_overlay = !show_overlay;
+    overlay_key_down = overlay_key;
 }
 
 // update screen dimentions on window resize